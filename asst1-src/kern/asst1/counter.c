@@ -6,59 +6,40 @@
 #include <test.h>
 #include <thread.h>
 #include <synch.h>
+#include <percpu_counter.h>
 
 
 /*
  * Declare the counter variable that all threads increment or decrement
  * via the interface provided here.
  *
- * Declaring it "volatile" instructs the compiler to always (re)read the
- * variable from memory and not to optimise by keeping the value in a process 
- * register and avoid memory references.
- *
- * NOTE: The volatile declaration is actually not needed for the provided code 
- * as the variable is only loaded once in each function.
- */
-
-static volatile int the_counter;
-
-/*
- * ********************************************************************
- * INSERT ANY GLOBAL VARIABLES YOU REQUIRE HERE
- * ********************************************************************
+ * It is a per-cpu counter: each cpu counts into its own slot without
+ * taking a lock, and the slots are only added up when the value is
+ * read at the end. The counter is never read while it is being
+ * updated, so no batching into the shared total is needed.
  */
 
-struct lock *counter_lock;
+static struct percpu_counter the_counter;
 
 void counter_increment(void)
 {
-        lock_acquire(counter_lock);
-        the_counter = the_counter + 1;
-        lock_release(counter_lock);
+        percpu_counter_inc(&the_counter);
 }
 
 void counter_decrement(void)
 {
-        lock_acquire(counter_lock);
-        the_counter = the_counter - 1;
-        lock_release(counter_lock);
+        percpu_counter_dec(&the_counter);
 }
 
 int counter_initialise(int val)
 {
-        the_counter = val;
+        int result;
 
-        /*
-         * ********************************************************************
-         * INSERT ANY INITIALISATION CODE YOU REQUIRE HERE
-         * ********************************************************************
-         */
-        
-        counter_lock = lock_create("counter");
-        if (counter_lock == NULL){
-                return ENOMEM;
+        result = percpu_counter_init(&the_counter, val, 0);
+        if (result) {
+                return result;
         }
-        
+
         /*
          * Return 0 to indicate success
          * Return non-zero to indicate error.
@@ -77,6 +58,9 @@ int counter_read_and_destroy(void)
          * INSERT ANY CLEANUP CODE YOU REQUIRE HERE
          * **********************************************************************
          */
-        lock_destroy(counter_lock);
-        return the_counter;
+        int val;
+
+        val = percpu_counter_read(&the_counter);
+        percpu_counter_cleanup(&the_counter);
+        return val;
 }
@@ -5,6 +5,7 @@
 #include <test.h>
 #include <thread.h>
 #include <synch.h>
+#include <clock.h>
 
 /* THIS FILE WILL BE REPLACED IN AUTOMARKING SO YOU SHOULD NOT RELY ON ANY CHANGES
    YOU MAKE HERE FOR PERSONAL TESTING */
@@ -127,3 +128,96 @@ int counter_tester (int data1, char **data2)
         return 0;
 }
 
+
+
+/*
+ * Throughput benchmark.
+ *
+ * Runs 1, 2, 4, 8 and 16 threads, each doing BENCH_INCS increments,
+ * and reports increments per second for each, to show how the counter
+ * scales with the number of threads. Run it with several cpus in
+ * sys161.conf; with one cpu there is nothing to scale across.
+ */
+
+#define BENCH_INCS 100000
+
+static struct semaphore *bench_start;
+
+static void bench_thread(void * unusedpointer, unsigned long threadnumber)
+{
+        int i;
+
+        (void) unusedpointer;
+        (void) threadnumber;
+
+        P(bench_start);
+        for (i = 0; i < BENCH_INCS; i++) {
+                counter_increment();
+        }
+        V(finished);
+}
+
+int counter_bench(int data1, char **data2)
+{
+        static const int nthreads[] = { 1, 2, 4, 8, 16 };
+        struct timespec start, end, diff;
+        uint64_t nsecs, incs;
+        int run, index, error, final_count;
+
+        (void) data1;
+        (void) data2;
+
+        finished = sem_create("finished", 0);
+        bench_start = sem_create("bench_start", 0);
+        if (finished == NULL || bench_start == NULL) {
+                panic("counter_bench: sem create failed");
+        }
+
+        for (run = 0; run < (int)(sizeof(nthreads) / sizeof(nthreads[0])); run++) {
+                error = counter_initialise(0);
+                if (error) {
+                        panic("counter_bench: initialise counter failed");
+                }
+
+                for (index = 0; index < nthreads[run]; index++) {
+                        error = thread_fork("bench thread", NULL,
+                                            &bench_thread, NULL, index);
+                        if (error) {
+                                panic("bench thread: thread_fork failed: %s\n",
+                                      strerror(error));
+                        }
+                }
+
+                gettime(&start);
+                for (index = 0; index < nthreads[run]; index++) {
+                        V(bench_start);
+                }
+                for (index = 0; index < nthreads[run]; index++) {
+                        P(finished);
+                }
+                gettime(&end);
+
+                final_count = counter_read_and_destroy();
+                incs = (uint64_t)nthreads[run] * BENCH_INCS;
+                if ((uint64_t)final_count != incs) {
+                        kprintf("*** Error! Final count %d, expected %llu\n",
+                                final_count, (unsigned long long)incs);
+                }
+
+                timespec_sub(&end, &start, &diff);
+                nsecs = (uint64_t)diff.tv_sec * 1000000000 + diff.tv_nsec;
+                if (nsecs == 0) {
+                        nsecs = 1;
+                }
+                kprintf("%2d threads: %llu increments in %llu.%03llu seconds, "
+                        "%llu per second\n", nthreads[run],
+                        (unsigned long long)incs,
+                        (unsigned long long)(nsecs / 1000000000),
+                        (unsigned long long)(nsecs % 1000000000 / 1000000),
+                        (unsigned long long)(incs * 1000000000 / nsecs));
+        }
+
+        sem_destroy(bench_start);
+        sem_destroy(finished);
+        return 0;
+}
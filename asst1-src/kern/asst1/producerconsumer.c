@@ -1,25 +1,193 @@
 /* This file will contain your solution. Modify it as you wish. */
 #include <types.h>
 #include <lib.h>
+#include <membar.h>
+#include <spinlock.h>
+#include <wchan.h>
 #include <synch.h>
 #include "producerconsumer.h"
 
-/* Declare any variables you need here to keep track of and
-   synchronise your bounded buffer. A sample declaration of a buffer is shown
-   below. It is an array of pointers to items.
-   
-   You can change this if you choose another implementation. 
-   However, your implementation should accept at least BUFFER_SIZE 
-   prior to blocking
-*/
+/*
+ * The bounded buffer is a lock-free multi-producer multi-consumer ring
+ * (Vyukov's bounded queue). Each cell carries a sequence number that
+ * says whose turn it is:
+ *
+ *    seq == pos        the cell is free for the producer at position pos
+ *    seq == pos + 1    the cell holds the item for the consumer at pos
+ *
+ * A producer claims position pos by advancing pc_tail from pos to pos+1
+ * with compare-and-swap, stores its item, then publishes it by setting
+ * the cell's seq to pos+1. A consumer likewise claims pos by advancing
+ * pc_head, takes the item, and hands the cell on to the producer one
+ * lap later by setting seq to pos + BUFFER_SIZE. So a send or receive
+ * that doesn't have to wait is one CAS and a couple of barriers, with
+ * no lock at all.
+ *
+ * Positions count modulo PC_POSMAX rather than 2^32 so that they stay
+ * in step with the cell index (pos % BUFFER_SIZE) when they wrap.
+ *
+ * Threads only block when the ring is really full (or empty). The
+ * sleeper registers in pc_nfullwait (pc_nemptywait) under pc_waitlock,
+ * then looks at the ring once more before sleeping; the other side
+ * checks the count after publishing and only takes the spinlock to wake
+ * someone if it is nonzero. The barriers on both sides guarantee at
+ * least one of them sees the other.
+ */
 
-#define BUFFLEN (BUFFER_SIZE + 1)
+#define PC_CACHELINE 64
+#define PC_POSMAX (BUFFER_SIZE * 4096)  /* must be a multiple of BUFFER_SIZE */
 
-data_item_t * item_buffer[BUFFER_SIZE+1];
+struct pc_cell {
+        volatile unsigned c_seq;
+        data_item_t *volatile c_item;
+};
 
-struct semaphore *mutex, *empty, *full;
+/*
+ * The two ends live on separate cache lines so that producers and
+ * consumers don't steal the line from each other on every operation.
+ */
+struct pc_index {
+        volatile unsigned pi_pos;
+        char pi_pad[PC_CACHELINE - sizeof(unsigned)];
+} __attribute__((aligned(PC_CACHELINE)));
 
-volatile int head, tail;
+static struct pc_cell item_buffer[BUFFER_SIZE];
+static struct pc_index pc_head;         /* next position to receive */
+static struct pc_index pc_tail;         /* next position to send */
+
+static struct spinlock pc_waitlock;
+static struct wchan *pc_emptywchan;     /* consumers wait here */
+static struct wchan *pc_fullwchan;      /* producers wait here */
+static volatile unsigned pc_nemptywait;
+static volatile unsigned pc_nfullwait;
+
+/*
+ * Compare-and-swap on a word with LL/SC, as in spinlock_data_testandset.
+ * Returns true if *p was OLD and is now NEW.
+ */
+static inline
+bool
+pc_cas(volatile unsigned *p, unsigned old, unsigned new)
+{
+        unsigned x, y;
+
+        y = new;
+        __asm volatile(
+                ".set push;"            /* save assembler mode */
+                ".set mips32;"          /* allow MIPS32 instructions */
+                ".set volatile;"        /* avoid unwanted optimization */
+                ".set noreorder;"       /* we fill the delay slots */
+                "ll %0, 0(%2);"         /*   x = *p */
+                "bne %0, %3, 1f;"       /*   if (x != old) fail */
+                " nop;"
+                "sc %1, 0(%2);"         /*   *p = y; y = success? */
+                "b 2f;"
+                " nop;"
+                "1: move %1, $0;"       /*   y = 0 (failed) */
+                "2: .set pop"           /* restore assembler mode */
+                : "=&r" (x), "+r" (y) : "r" (p), "r" (old) : "memory");
+        return y != 0;
+}
+
+static inline
+unsigned
+pc_posadd(unsigned pos, unsigned n)
+{
+        return (pos + n) % PC_POSMAX;
+}
+
+/* a - b, as a signed distance around the position space */
+static inline
+int
+pc_posdiff(unsigned a, unsigned b)
+{
+        unsigned d;
+
+        d = (a + PC_POSMAX - b) % PC_POSMAX;
+        if (d > PC_POSMAX / 2) {
+                return (int)d - PC_POSMAX;
+        }
+        return d;
+}
+
+/* Put ITEM in the ring; false if it's full. */
+static
+bool
+pc_tryput(data_item_t *item)
+{
+        struct pc_cell *cell;
+        unsigned pos;
+        int diff;
+
+        pos = pc_tail.pi_pos;
+        while (1) {
+                cell = &item_buffer[pos % BUFFER_SIZE];
+                diff = pc_posdiff(cell->c_seq, pos);
+                if (diff == 0) {
+                        if (pc_cas(&pc_tail.pi_pos, pos, pc_posadd(pos, 1))) {
+                                break;
+                        }
+                }
+                else if (diff < 0) {
+                        /* a lap behind: still in use by a consumer */
+                        return false;
+                }
+                pos = pc_tail.pi_pos;
+        }
+
+        /* don't let the store below pass our read of c_seq */
+        membar_any_store();
+        cell->c_item = item;
+        membar_store_store();
+        cell->c_seq = pc_posadd(pos, 1);
+        return true;
+}
+
+/* Take an item from the ring; NULL if it's empty. */
+static
+data_item_t *
+pc_tryget(void)
+{
+        struct pc_cell *cell;
+        data_item_t *item;
+        unsigned pos;
+        int diff;
+
+        pos = pc_head.pi_pos;
+        while (1) {
+                cell = &item_buffer[pos % BUFFER_SIZE];
+                diff = pc_posdiff(cell->c_seq, pc_posadd(pos, 1));
+                if (diff == 0) {
+                        if (pc_cas(&pc_head.pi_pos, pos, pc_posadd(pos, 1))) {
+                                break;
+                        }
+                }
+                else if (diff < 0) {
+                        /* not produced yet */
+                        return NULL;
+                }
+                pos = pc_head.pi_pos;
+        }
+
+        membar_load_load();
+        item = cell->c_item;
+        membar_any_store();
+        cell->c_seq = pc_posadd(pos, BUFFER_SIZE);
+        return item;
+}
+
+/* Wake one thread on WC if the count says anyone is sleeping there. */
+static
+void
+pc_wakeup(volatile unsigned *nwaiting, struct wchan *wc)
+{
+        membar_any_any();
+        if (*nwaiting > 0) {
+                spinlock_acquire(&pc_waitlock);
+                wchan_wakeone(wc, &pc_waitlock);
+                spinlock_release(&pc_waitlock);
+        }
+}
 
 
 /* consumer_receive() is called by a consumer to request more data. It
@@ -28,21 +196,25 @@ volatile int head, tail;
 
 data_item_t * consumer_receive(void)
 {
-        P(full);
-        P(mutex);
         data_item_t * item;
 
+        item = pc_tryget();
+        while (item == NULL) {
+                spinlock_acquire(&pc_waitlock);
+                pc_nemptywait++;
+                membar_any_any();
+                item = pc_tryget();
+                if (item == NULL) {
+                        wchan_sleep(pc_emptywchan, &pc_waitlock);
+                }
+                pc_nemptywait--;
+                spinlock_release(&pc_waitlock);
+                if (item == NULL) {
+                        item = pc_tryget();
+                }
+        }
 
-        item = item_buffer[tail];
-        tail = (tail + 1) % BUFFLEN;
-
-        
-        /******************
-         * Remove above here
-         */
-        V(mutex);
-        V(empty);
-
+        pc_wakeup(&pc_nfullwait, pc_fullwchan);
         return item;
 }
 
@@ -52,12 +224,25 @@ data_item_t * consumer_receive(void)
 
 void producer_send(data_item_t *item)
 {
-        P(empty);
-        P(mutex);
-        item_buffer[head] = item;
-        head = (head + 1) % BUFFLEN;
-        V(mutex);
-        V(full);
+        bool done;
+
+        done = pc_tryput(item);
+        while (!done) {
+                spinlock_acquire(&pc_waitlock);
+                pc_nfullwait++;
+                membar_any_any();
+                done = pc_tryput(item);
+                if (!done) {
+                        wchan_sleep(pc_fullwchan, &pc_waitlock);
+                }
+                pc_nfullwait--;
+                spinlock_release(&pc_waitlock);
+                if (!done) {
+                        done = pc_tryput(item);
+                }
+        }
+
+        pc_wakeup(&pc_nemptywait, pc_emptywchan);
 }
 
 
@@ -68,20 +253,27 @@ void producer_send(data_item_t *item)
 
 void producerconsumer_startup(void)
 {
-        head = tail = 0;
-        empty = sem_create("empty", BUFFER_SIZE);
-        full = sem_create("full", 0);
-        mutex = sem_create("mutex", 1);
-        if (empty == NULL || full == NULL || mutex == NULL){
-                panic("FAILED Memory allocation for producer/consumer semaphores");
+        unsigned i;
+
+        for (i = 0; i < BUFFER_SIZE; i++) {
+                item_buffer[i].c_seq = i;
+                item_buffer[i].c_item = NULL;
+        }
+        pc_head.pi_pos = pc_tail.pi_pos = 0;
+        pc_nemptywait = pc_nfullwait = 0;
+
+        spinlock_init(&pc_waitlock);
+        pc_emptywchan = wchan_create("pc_empty");
+        pc_fullwchan = wchan_create("pc_full");
+        if (pc_emptywchan == NULL || pc_fullwchan == NULL){
+                panic("FAILED Memory allocation for producer/consumer wait channels");
         }
 }
 
 /* Perform any clean-up you need here */
 void producerconsumer_shutdown(void)
 {
-        sem_destroy(empty);
-        sem_destroy(full);
-        sem_destroy(mutex);
+        wchan_destroy(pc_emptywchan);
+        wchan_destroy(pc_fullwchan);
+        spinlock_cleanup(&pc_waitlock);
 }
-
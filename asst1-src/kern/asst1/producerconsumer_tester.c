@@ -13,6 +13,7 @@
 #include <lib.h>    /* for kprintf */
 #include <synch.h>  /* for P(), V(), sem_* */
 #include <thread.h> /* for thread_fork() */
+#include <clock.h>  /* for gettime() */
 #include <test.h>
 
 #include "producerconsumer.h"
@@ -267,3 +268,176 @@ run_producerconsumer(int nargs, char **args)
         return 0;
 }
 
+
+
+/*
+ * Throughput benchmark.
+ *
+ * Runs NPRODUCERS producers and NCONSUMERS consumers through the
+ * buffer and reports items per second. Unlike the simulation above
+ * nothing is allocated per item: every producer sends the same static
+ * item over and over, and consumers stop when they see the stop item,
+ * so the time measured is (almost) all producer_send/consumer_receive.
+ *
+ * With no arguments it runs a sweep over 1, 2, 4 and 8 of each; run it
+ * with the cpu count in sys161.conf set to 1 and to several to see the
+ * difference.
+ */
+
+#define BENCH_MAXTHREADS 32
+#define BENCH_ITEMS 200000      /* total items per run */
+
+static data_item_t bench_item = { 1, 2 };
+static data_item_t bench_stop = { 0, 0 };
+static struct semaphore *bench_start;
+static struct semaphore *bench_done;
+static struct lock *bench_lock;         /* for bench_received */
+static volatile unsigned long bench_received;
+static unsigned bench_peritem;
+
+static void
+bench_producer(void *unused_ptr, unsigned long thread_num)
+{
+        unsigned i;
+
+        (void)unused_ptr;
+        (void)thread_num;
+
+        P(bench_start);
+        for (i = 0; i < bench_peritem; i++) {
+                producer_send(&bench_item);
+        }
+        V(bench_done);
+}
+
+static void
+bench_consumer(void *unused_ptr, unsigned long thread_num)
+{
+        data_item_t *item;
+        unsigned long count = 0;
+
+        (void)unused_ptr;
+        (void)thread_num;
+
+        P(bench_start);
+        while ((item = consumer_receive()) != &bench_stop) {
+                count++;
+        }
+
+        lock_acquire(bench_lock);
+        bench_received += count;
+        lock_release(bench_lock);
+
+        V(bench_done);
+}
+
+static void
+bench_fork(const char *name, unsigned n,
+           void (*func)(void *, unsigned long))
+{
+        unsigned i;
+        int result;
+
+        for (i = 0; i < n; i++) {
+                result = thread_fork(name, NULL, func, NULL, i);
+                if (result) {
+                        panic("%s: couldn't fork (%s)\n", name,
+                              strerror(result));
+                }
+        }
+}
+
+static void
+bench_one(unsigned nproducers, unsigned nconsumers)
+{
+        struct timespec start, end, diff;
+        uint64_t nsecs, items;
+        unsigned i;
+
+        bench_peritem = BENCH_ITEMS / nproducers;
+        items = (uint64_t)bench_peritem * nproducers;
+        bench_received = 0;
+
+        producerconsumer_startup();
+        bench_fork("bench consumer", nconsumers, bench_consumer);
+        bench_fork("bench producer", nproducers, bench_producer);
+
+        gettime(&start);
+        for (i = 0; i < nproducers + nconsumers; i++) {
+                V(bench_start);
+        }
+        for (i = 0; i < nproducers; i++) {
+                P(bench_done);
+        }
+        for (i = 0; i < nconsumers; i++) {
+                producer_send(&bench_stop);
+        }
+        for (i = 0; i < nconsumers; i++) {
+                P(bench_done);
+        }
+        gettime(&end);
+
+        producerconsumer_shutdown();
+
+        if (bench_received != items) {
+                kprintf("*** Error! %lu items received, %llu sent\n",
+                        bench_received, (unsigned long long)items);
+        }
+
+        timespec_sub(&end, &start, &diff);
+        nsecs = (uint64_t)diff.tv_sec * 1000000000 + diff.tv_nsec;
+        if (nsecs == 0) {
+                nsecs = 1;
+        }
+        kprintf("%2u producers %2u consumers: %llu items in "
+                "%llu.%03llu seconds, %llu items/sec\n",
+                nproducers, nconsumers, (unsigned long long)items,
+                (unsigned long long)(nsecs / 1000000000),
+                (unsigned long long)(nsecs % 1000000000 / 1000000),
+                (unsigned long long)(items * 1000000000 / nsecs));
+}
+
+int
+run_producerconsumer_bench(int nargs, char **args)
+{
+        static const unsigned sweep[] = { 1, 2, 4, 8 };
+        unsigned np, nc;
+        unsigned i, j;
+
+        if (nargs != 1 && nargs != 3) {
+                kprintf("Usage: %s [producers consumers]\n", args[0]);
+                return 0;
+        }
+
+        bench_start = sem_create("bench_start", 0);
+        bench_done = sem_create("bench_done", 0);
+        bench_lock = lock_create("bench_lock");
+        if (bench_start == NULL || bench_done == NULL || bench_lock == NULL) {
+                panic("run_producerconsumer_bench: couldn't create semaphore\n");
+        }
+
+        if (nargs == 3) {
+                np = atoi(args[1]);
+                nc = atoi(args[2]);
+                if (np < 1 || np > BENCH_MAXTHREADS ||
+                    nc < 1 || nc > BENCH_MAXTHREADS) {
+                        kprintf("%s: thread counts must be 1-%d\n",
+                                args[0], BENCH_MAXTHREADS);
+                }
+                else {
+                        bench_one(np, nc);
+                }
+        }
+        else {
+                for (i = 0; i < sizeof(sweep) / sizeof(sweep[0]); i++) {
+                        for (j = 0; j < sizeof(sweep) / sizeof(sweep[0]); j++) {
+                                bench_one(sweep[i], sweep[j]);
+                        }
+                }
+        }
+
+        lock_destroy(bench_lock);
+        sem_destroy(bench_done);
+        sem_destroy(bench_start);
+        return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PERCPU_COUNTER_H_
+#define _PERCPU_COUNTER_H_
+
+/*
+ * Per-cpu counters.
+ *
+ * A counter that's bumped from many threads at once but read rarely
+ * (statistics, reference-ish counts that are only checked at the end)
+ * doesn't need a shared lock on every update. Each cpu adds into its
+ * own slot, on its own cache line, with interrupts off and no lock;
+ * reading sums the slots.
+ *
+ * If BATCH is nonzero, a slot that drifts to +/-BATCH is folded into
+ * the shared total under the counter's spinlock, which bounds how far
+ * percpu_counter_read_approx can be off: by less than BATCH per cpu.
+ * With BATCH 0 slots are never folded and only percpu_counter_read
+ * gives a useful answer.
+ *
+ * percpu_counter_read is exact once updates have stopped; while they
+ * are still going on it returns some value the counter had, or is
+ * about to have, within the updates in flight.
+ */
+
+#include <spinlock.h>
+
+#define PERCPU_CACHELINE	64
+
+struct percpu_slot {
+	volatile long ps_count;
+	char ps_pad[PERCPU_CACHELINE - sizeof(long)];
+};
+
+struct percpu_counter {
+	struct spinlock pc_lock;	/* protects pc_count and folds */
+	volatile long pc_count;		/* folded total */
+	long pc_batch;			/* fold threshold, 0 for never */
+	struct percpu_slot *pc_slots;	/* one per cpu, MAXCPUS of them */
+	void *pc_slotmem;		/* block pc_slots is carved from */
+};
+
+int percpu_counter_init(struct percpu_counter *pc, long val, long batch);
+void percpu_counter_cleanup(struct percpu_counter *pc);
+
+void percpu_counter_add(struct percpu_counter *pc, long delta);
+long percpu_counter_read(struct percpu_counter *pc);
+long percpu_counter_read_approx(struct percpu_counter *pc);
+
+#define percpu_counter_inc(pc) percpu_counter_add(pc, 1)
+#define percpu_counter_dec(pc) percpu_counter_add(pc, -1)
+
+
+#endif /* _PERCPU_COUNTER_H_ */
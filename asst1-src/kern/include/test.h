@@ -38,7 +38,9 @@
 #ifdef OPT_SYNCHPROBS
 int twolocks(int, char **);
 int counter_tester(int, char **);
+int counter_bench(int, char **);
 int run_producerconsumer(int, char **);
+int run_producerconsumer_bench(int, char **);
 int run_client_server_system(int, char**);
 #endif
 
@@ -599,8 +599,10 @@ static const char *mainmenu[] = {
 	"[?t] Tests menu                     ",
 #if OPT_SYNCHPROBS
 	"[1a] Counter synchronisation        ",
+	"[1ab] Counter throughput            ",
 	"[1b] Simple deadlock                ",
 	"[1c] Producer/consumer problem      ",
+	"[1cb] Producer/consumer throughput  ",
 	"[1d] Client/Server problem          ",
 #endif
 	"[kh] Kernel heap stats              ",
@@ -656,8 +658,10 @@ static struct {
 #if OPT_SYNCHPROBS
 	/* in-kernel synchronization problem(s) */
 	{ "1a",     counter_tester },
+	{ "1ab",    counter_bench },
 	{ "1b",     twolocks }, 
         { "1c",     run_producerconsumer},
+        { "1cb",    run_producerconsumer_bench},
         { "1d",     run_client_server_system},
 #endif
 
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Per-cpu counters. See percpu_counter.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <platform/maxcpus.h>
+#include <percpu_counter.h>
+
+/*
+ * Set up PC with initial value VAL and fold threshold BATCH.
+ */
+int
+percpu_counter_init(struct percpu_counter *pc, long val, long batch)
+{
+	unsigned i;
+
+	KASSERT(batch >= 0);
+
+	/*
+	 * kmalloc doesn't promise cache-line alignment, and slots
+	 * that straddle lines would share them with their neighbors;
+	 * so get a line's worth extra and round up.
+	 */
+	pc->pc_slotmem = kmalloc(MAXCPUS * sizeof(struct percpu_slot) +
+				 PERCPU_CACHELINE - 1);
+	if (pc->pc_slotmem == NULL) {
+		return ENOMEM;
+	}
+	pc->pc_slots = (struct percpu_slot *)
+		ROUNDUP((uintptr_t)pc->pc_slotmem, PERCPU_CACHELINE);
+	for (i=0; i<MAXCPUS; i++) {
+		pc->pc_slots[i].ps_count = 0;
+	}
+	spinlock_init(&pc->pc_lock);
+	pc->pc_count = val;
+	pc->pc_batch = batch;
+	return 0;
+}
+
+void
+percpu_counter_cleanup(struct percpu_counter *pc)
+{
+	spinlock_cleanup(&pc->pc_lock);
+	kfree(pc->pc_slotmem);
+	pc->pc_slotmem = NULL;
+	pc->pc_slots = NULL;
+}
+
+/*
+ * Add DELTA. Interrupts are off only so that we can't be preempted
+ * (and maybe moved to another cpu) between loading our slot and
+ * storing it back; nobody else ever writes it except a fold, which
+ * is also done by this cpu.
+ */
+void
+percpu_counter_add(struct percpu_counter *pc, long delta)
+{
+	struct percpu_slot *slot;
+	long n;
+	int spl;
+
+	spl = splhigh();
+	slot = &pc->pc_slots[curcpu->c_number];
+	n = slot->ps_count + delta;
+	if (pc->pc_batch > 0 && (n >= pc->pc_batch || n <= -pc->pc_batch)) {
+		/*
+		 * Clear the slot inside the spinlock too, so that
+		 * percpu_counter_read never sees the same updates
+		 * both in the total and in the slot.
+		 */
+		spinlock_acquire(&pc->pc_lock);
+		pc->pc_count += n;
+		slot->ps_count = 0;
+		spinlock_release(&pc->pc_lock);
+	}
+	else {
+		slot->ps_count = n;
+	}
+	splx(spl);
+}
+
+/*
+ * Sum up the total and all the slots.
+ */
+long
+percpu_counter_read(struct percpu_counter *pc)
+{
+	long total;
+	unsigned i;
+
+	spinlock_acquire(&pc->pc_lock);
+	total = pc->pc_count;
+	for (i=0; i<MAXCPUS; i++) {
+		total += pc->pc_slots[i].ps_count;
+	}
+	spinlock_release(&pc->pc_lock);
+
+	return total;
+}
+
+/*
+ * Just the folded total, without looking at the slots. Cheap, but
+ * only meaningful with a nonzero batch.
+ */
+long
+percpu_counter_read_approx(struct percpu_counter *pc)
+{
+	return pc->pc_count;
+}
@@ -47,6 +47,12 @@ spinlock_data_t spinlock_data_get(volatile spinlock_data_t *sd);
 SPINLOCK_INLINE
 spinlock_data_t spinlock_data_testandset(volatile spinlock_data_t *sd);
 
+/* Atomic operations on pointers, for queued spinlocks */
+SPINLOCK_INLINE
+void *spinlock_ptr_swap(void *volatile *p, void *val);
+SPINLOCK_INLINE
+bool spinlock_ptr_cas(void *volatile *p, void *old, void *new);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -118,5 +124,66 @@ spinlock_data_testandset(volatile spinlock_data_t *sd)
 	return x;
 }
 
+/*
+ * Atomically exchange a pointer: store VAL in *P and return the old
+ * value. This is the same LL/SC pair as in test-and-set, but retried
+ * until the SC succeeds, since there's no "pretend it failed" answer
+ * for a swap.
+ */
+SPINLOCK_INLINE
+void *
+spinlock_ptr_swap(void *volatile *p, void *val)
+{
+	void *x;
+	void *y;
+
+	do {
+		y = val;
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "+r" (y) : "r" (p));
+	} while (y == NULL);
+	return x;
+}
+
+/*
+ * Atomic compare-and-swap on a pointer: if *P is OLD, replace it with
+ * NEW and return true; otherwise leave it alone and return false.
+ * The branch between the LL and the SC is allowed; it's only other
+ * memory accesses that aren't.
+ */
+SPINLOCK_INLINE
+bool
+spinlock_ptr_cas(void *volatile *p, void *old, void *new)
+{
+	void *x;
+	void *y;
+
+	while (1) {
+		y = new;
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%3);"		/*   x = *p */
+			"bne %0, %2, 1f;"	/*   if (x != old) skip */
+			"sc %1, 0(%3);"		/*   *p = y; y = success? */
+			"1:"
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "+r" (y) : "r" (old), "r" (p));
+		if (x != old) {
+			return false;
+		}
+		if (y != NULL) {
+			return true;
+		}
+	}
+}
+
 
 #endif /* _MIPS_SPINLOCK_H_ */
@@ -129,12 +129,12 @@ paddr_t ram_getfirstfree(void);
  */
 
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	vaddr_t ts_vaddr;	/* page to invalidate, or TLBSHOOTDOWN_ALL */
 };
 
+/* Page 0 is never mapped, so its address can mean "everything". */
+#define TLBSHOOTDOWN_ALL 0
+
 #define TLBSHOOTDOWN_MAX 16
 
 
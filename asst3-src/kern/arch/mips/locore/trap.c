@@ -164,6 +164,7 @@ mips_trap(struct trapframe *tf)
 
 		old_in = curthread->t_in_interrupt;
 		curthread->t_in_interrupt = 1;
+		curthread->t_intr_fromuser = !iskern;
 
 		/*
 		 * The processor has turned interrupts off; if the
@@ -203,6 +204,19 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+		curthread->t_intr_fromuser = false;
+
+		/*
+		 * If we interrupted a user thread whose process is
+		 * exiting, don't let it go back; this is what stops
+		 * threads that never make a syscall. Turn interrupts
+		 * back on (as below) first.
+		 */
+		if (!iskern && curproc->p_exiting) {
+			spl = splhigh();
+			splx(spl);
+			proc_threadexit(NULL);
+		}
 		goto done2;
 	}
 
@@ -323,6 +337,14 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	/*
+	 * Another thread may have called _exit while we were in here
+	 * (or in user mode); if so, leave instead of returning.
+	 */
+	if (!iskern && curproc->p_exiting) {
+		proc_threadexit(NULL);
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -38,6 +38,7 @@
 #include <copyinout.h>
 #include <syscall.h>
 #include <addrspace.h>
+#include <ktrace.h>
 
 
 /*
@@ -90,6 +91,7 @@ syscall(struct trapframe *tf)
 	KASSERT(curthread->t_iplhigh_count == 0);
 
 	callno = tf->tf_v0;
+	KTRACE(KTRACE_SYSCALL, callno, tf->tf_a0, tf->tf_a1, tf->tf_a2);
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -114,6 +116,11 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
 
 	    /* process calls */
 
@@ -121,6 +128,10 @@ syscall(struct trapframe *tf)
 		err = sys_fork(tf, &retval);
 		break;
 
+	    case SYS_vfork:
+		err = sys_vfork(tf, &retval);
+		break;
+
 	    case SYS_execv:
 		err = sys_execv(
 			(userptr_t)tf->tf_a0,
@@ -143,6 +154,37 @@ syscall(struct trapframe *tf)
 		err = sys_getpid(&retval);
 		break;
 
+	    case SYS_getrusage:
+		err = sys_getrusage(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+
+
+	    /* thread calls */
+
+	    case SYS___thread_create:
+		err = sys___thread_create(tf,
+			(userptr_t)tf->tf_a0,
+			(userptr_t)tf->tf_a1,
+			(userptr_t)tf->tf_a2,
+			&retval);
+		break;
+
+	    case SYS_thread_exit:
+		sys_thread_exit((userptr_t)tf->tf_a0);
+		panic("Returning from thread_exit\n");
+
+	    case SYS_thread_join:
+		err = sys_thread_join(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_futex:
+		err = sys_futex(
+			(userptr_t)tf->tf_a0,
+			tf->tf_a1,
+			tf->tf_a2,
+			&retval);
+		break;
+
 
 	    /* file calls */
 
@@ -165,6 +207,10 @@ syscall(struct trapframe *tf)
 		err = sys_close(tf->tf_a0);
 		break;
 
+	    case SYS_pipe:
+		err = sys_pipe((userptr_t)tf->tf_a0, &retval);
+		break;
+
 	    case SYS_read:
 		err = sys_read(
 			tf->tf_a0,
@@ -179,6 +225,20 @@ syscall(struct trapframe *tf)
 			tf->tf_a2,
 			&retval);
 		break;
+	    case SYS_readv:
+		err = sys_readv(
+			tf->tf_a0,
+			(userptr_t)tf->tf_a1,
+			tf->tf_a2,
+			&retval);
+		break;
+	    case SYS_writev:
+		err = sys_writev(
+			tf->tf_a0,
+			(userptr_t)tf->tf_a1,
+			tf->tf_a2,
+			&retval);
+		break;
 	    case SYS_lseek:
 		{
 			/*
@@ -212,6 +272,37 @@ syscall(struct trapframe *tf)
 		}
 		break;
 
+	    case SYS_pread:
+	    case SYS_pwrite:
+		{
+			/*
+			 * The position is 64 bits wide, so it has to be
+			 * aligned; it skips a3 and goes on the stack.
+			 */
+			off_t pos;
+
+			err = copyin((userptr_t)tf->tf_sp + 16,
+				     &pos, sizeof(pos));
+			if (err) {
+				break;
+			}
+
+			err = (callno == SYS_pread) ?
+				sys_pread(tf->tf_a0, (userptr_t)tf->tf_a1,
+					  tf->tf_a2, pos, &retval) :
+				sys_pwrite(tf->tf_a0, (userptr_t)tf->tf_a1,
+					   tf->tf_a2, pos, &retval);
+		}
+		break;
+
+	    case SYS_copy_file_range:
+		err = sys_copy_file_range(
+			tf->tf_a0,
+			tf->tf_a1,
+			tf->tf_a2,
+			&retval);
+		break;
+
 	    case SYS_chdir:
 		err = sys_chdir((userptr_t)tf->tf_a0);
 		break;
@@ -291,6 +382,7 @@ syscall(struct trapframe *tf)
 		break;
 	}
 
+	KTRACE(KTRACE_SYSRET, callno, err, retval, 0);
 
 	if (err) {
 		/*
@@ -338,3 +430,24 @@ enter_forked_process(struct trapframe *tf)
 
 	mips_usermode(tf);
 }
+
+/*
+ * Enter user mode for a new thread in an existing process.
+ *
+ * TF is a copy of the creating thread's trapframe, which supplies
+ * the registers we don't otherwise care about (notably gp). Leave
+ * the usual 16 bytes at the top of the stack for the entry function
+ * to spill its argument registers into.
+ */
+void
+enter_new_thread(struct trapframe *tf, userptr_t arg0, userptr_t arg1,
+		 vaddr_t stack, vaddr_t entry)
+{
+	tf->tf_epc = entry;
+	tf->tf_a0 = (vaddr_t)arg0;
+	tf->tf_a1 = (vaddr_t)arg1;
+	tf->tf_sp = stack - 16;
+	tf->tf_ra = 0;
+
+	mips_usermode(tf);
+}
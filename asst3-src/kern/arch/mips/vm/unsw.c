@@ -32,6 +32,7 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <spinlock.h>
+#include <qspinlock.h>
 
 vaddr_t firstfree;   /* first free virtual address; set by start.S */
 
@@ -60,7 +61,7 @@ static uint32_t last_frame;
  * uniprocessor) as this implementation does not block.
  */ 
 
-static struct spinlock frame_table_spinlock = SPINLOCK_INITIALIZER;
+static struct qspinlock frame_table_spinlock = QSPINLOCK_INITIALIZER;
 
 /*
  * Called very early in system boot to figure out how much physical
@@ -208,14 +209,14 @@ static paddr_t alloc_one_frame(unsigned int npages)
         
         KASSERT(npages == 1);
 
-        spinlock_acquire(&frame_table_spinlock);
+        qspinlock_acquire(&frame_table_spinlock);
         for (i =  first_frame; i < last_frame; i++) {
                 if (frame_table[i].allocated == FALSE) {
                         frame_table[i].allocated = TRUE;
                         frame_table[i].not_last = FALSE;
                         frame_table[i].ref_count = 1;
 
-                        spinlock_release(&frame_table_spinlock);
+                        qspinlock_release(&frame_table_spinlock);
 
                         return (paddr_t) (i << PAGE_BITS);
                 }
@@ -223,7 +224,7 @@ static paddr_t alloc_one_frame(unsigned int npages)
         
         /* Did not find an unallocated frame :-( */
 
-        spinlock_release(&frame_table_spinlock);
+        qspinlock_release(&frame_table_spinlock);
         return (paddr_t) 0;
 }
 
@@ -238,7 +239,7 @@ static paddr_t alloc_multiple_frames(unsigned int npages)
          */
         
 
-        spinlock_acquire(&frame_table_spinlock);
+        qspinlock_acquire(&frame_table_spinlock);
 
         i = first_frame; j = 0;
 
@@ -260,14 +261,14 @@ static paddr_t alloc_multiple_frames(unsigned int npages)
                 frame_table[j].allocated = TRUE;
                 frame_table[j].not_last = FALSE;
 
-                spinlock_release(&frame_table_spinlock);
+                qspinlock_release(&frame_table_spinlock);
                 
                 return (paddr_t) (i << PAGE_BITS);
         }
         
         /* Did not find an unallocated contiguous range of frames :-( */
 
-        spinlock_release(&frame_table_spinlock);
+        qspinlock_release(&frame_table_spinlock);
         return (paddr_t) 0;
 }
 
@@ -282,7 +283,7 @@ static void free_frames(vaddr_t vaddr)
 
         i = paddr >> PAGE_BITS;
 
-        spinlock_acquire(&frame_table_spinlock);
+        qspinlock_acquire(&frame_table_spinlock);
 
         if (frame_table[i].allocated == FALSE) { /* check for double free error */
                 panic("Double free error!!");
@@ -294,7 +295,7 @@ static void free_frames(vaddr_t vaddr)
                         i++;
                 }
         }
-        spinlock_release(&frame_table_spinlock);
+        qspinlock_release(&frame_table_spinlock);
 }
         
 /* Allocate/free some kernel-space virtual pages */
@@ -321,19 +322,42 @@ free_kpages(vaddr_t addr)
         free_frames(addr);
 }
 
+/*
+ * The reference counts are shared between processes (copy-on-write
+ * after fork, shared text pages), so they are updated under the frame
+ * table lock like the allocation bits.
+ */
 void free_frame(uint32_t frame){
-        frame_table[frame].ref_count --;
-        if (frame_table[frame].ref_count == 0){
+        uint32_t refs;
+
+        qspinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[frame].ref_count > 0);
+        refs = --frame_table[frame].ref_count;
+        qspinlock_release(&frame_table_spinlock);
+
+        if (refs == 0){
                 free_kpages(PADDR_TO_KVADDR(frame << PAGE_BITS));
         }
 }
 
 void frame_add(uint32_t frame){
+        qspinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[frame].ref_count > 0);
         frame_table[frame].ref_count ++;
+        qspinlock_release(&frame_table_spinlock);
+}
+
+uint32_t frame_refcount(uint32_t frame){
+        uint32_t refs;
+
+        qspinlock_acquire(&frame_table_spinlock);
+        refs = frame_table[frame].ref_count;
+        qspinlock_release(&frame_table_spinlock);
+        return refs;
 }
 
 int get_write_frame(uint32_t frame){
-        if (frame_table[frame].ref_count == 1) return frame;
+        if (frame_refcount(frame) == 1) return frame;
         vaddr_t addr = alloc_kpages(1);
         if (addr == 0){
                 return -1;
@@ -344,6 +368,7 @@ int get_write_frame(uint32_t frame){
         for (int i=0; i<(1 << PAGE_BITS); i++){
                 new[i] = old[i];
         }
-        frame_table[frame].ref_count --;
+        // the other sharers may have let go meanwhile; drop ours properly
+        free_frame(frame);
         return new_frame;
-}
\ No newline at end of file
+}
@@ -54,7 +54,10 @@
 #include <cpu.h>
 #include <thread.h>
 #include <current.h>
+#include <spinlock.h>
+#include <wchan.h>
 #include <synch.h>
+#include <proc.h>
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
@@ -135,6 +138,8 @@ putch_intr(struct con_softc *cs, int ch)
 
 /*
  * Read a character, using interrupts to wait for I/O completion.
+ * Returns -1 instead if the current process is exiting, so a thread
+ * of it waiting for input can leave (see getch_wakeall).
  */
 static
 int
@@ -142,10 +147,18 @@ getch_intr(struct con_softc *cs)
 {
 	unsigned char ret;
 
-	P(cs->cs_rsem);
+	spinlock_acquire(&cs->cs_rlock);
+	while (cs->cs_gotchars_head == cs->cs_gotchars_tail) {
+		if (curproc->p_exiting) {
+			spinlock_release(&cs->cs_rlock);
+			return -1;
+		}
+		wchan_sleep(cs->cs_rwchan, &cs->cs_rlock);
+	}
 	ret = cs->cs_gotchars[cs->cs_gotchars_tail];
 	cs->cs_gotchars_tail =
 		(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
+	spinlock_release(&cs->cs_rlock);
 	return ret;
 }
 
@@ -153,10 +166,7 @@ getch_intr(struct con_softc *cs)
  * Called from underlying device when a read-ready interrupt occurs.
  *
  * Note: if gotchars_head == gotchars_tail, the buffer is empty. Thus
- * if gotchars_head+1 == gotchars_tail, the buffer is full. A slightly
- * tidier way to implement this check (that avoids wasting a slot,
- * too) would be with a second semaphore used with a nonblocking P,
- * but we don't have that in OS/161.
+ * if gotchars_head+1 == gotchars_tail, the buffer is full.
  */
 void
 con_input(void *vcs, int ch)
@@ -164,16 +174,19 @@ con_input(void *vcs, int ch)
 	struct con_softc *cs = vcs;
 	unsigned nexthead;
 
+	spinlock_acquire(&cs->cs_rlock);
 	nexthead = (cs->cs_gotchars_head + 1) % CONSOLE_INPUT_BUFFER_SIZE;
 	if (nexthead == cs->cs_gotchars_tail) {
 		/* overflow; drop character */
+		spinlock_release(&cs->cs_rlock);
 		return;
 	}
 
 	cs->cs_gotchars[cs->cs_gotchars_head] = ch;
 	cs->cs_gotchars_head = nexthead;
 
-	V(cs->cs_rsem);
+	wchan_wakeone(cs->cs_rwchan, &cs->cs_rlock);
+	spinlock_release(&cs->cs_rlock);
 }
 
 /*
@@ -225,6 +238,24 @@ getch(void)
 	return getch_intr(cs);
 }
 
+/*
+ * Wake everyone waiting for console input. Used when a process is
+ * exiting; the caller sets p_exiting first, so its threads give up
+ * (getch returns -1) and everyone else goes back to sleep.
+ */
+void
+getch_wakeall(void)
+{
+	struct con_softc *cs = the_console;
+
+	if (cs == NULL) {
+		return;
+	}
+	spinlock_acquire(&cs->cs_rlock);
+	wchan_wakeall(cs->cs_rwchan, &cs->cs_rlock);
+	spinlock_release(&cs->cs_rlock);
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -245,6 +276,7 @@ int
 con_io(struct device *dev, struct uio *uio)
 {
 	int result;
+	int getres;
 	char ch;
 	struct lock *lk;
 
@@ -262,7 +294,13 @@ con_io(struct device *dev, struct uio *uio)
 
 	while (uio->uio_resid > 0) {
 		if (uio->uio_rw==UIO_READ) {
-			ch = getch();
+			getres = getch();
+			if (getres < 0) {
+				/* process exiting; see getch_intr */
+				lock_release(lk);
+				return EINTR;
+			}
+			ch = getres;
 			if (ch=='\r') {
 				ch = '\n';
 			}
@@ -343,7 +381,8 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
+	struct wchan *rwchan;
+	struct semaphore *wsem;
 	struct lock *rlk, *wlk;
 
 	/*
@@ -359,30 +398,31 @@ config_con(struct con_softc *cs, int unit)
 	}
 	KASSERT(the_console==NULL);
 
-	rsem = sem_create("console read", 0);
-	if (rsem == NULL) {
+	rwchan = wchan_create("console read");
+	if (rwchan == NULL) {
 		return ENOMEM;
 	}
 	wsem = sem_create("console write", 1);
 	if (wsem == NULL) {
-		sem_destroy(rsem);
+		wchan_destroy(rwchan);
 		return ENOMEM;
 	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
-		sem_destroy(rsem);
+		wchan_destroy(rwchan);
 		sem_destroy(wsem);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
-		sem_destroy(rsem);
+		wchan_destroy(rwchan);
 		sem_destroy(wsem);
 		return ENOMEM;
 	}
 
-	cs->cs_rsem = rsem;
+	spinlock_init(&cs->cs_rlock);
+	cs->cs_rwchan = rwchan;
 	cs->cs_wsem = wsem;
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
@@ -49,6 +49,8 @@
 #include <uio.h>
 #include <membar.h>
 #include <synch.h>
+#include <current.h>
+#include <thread.h>
 #include <lamebus/emu.h>
 #include <platform/bus.h>
 #include <vfs.h>
@@ -288,6 +290,7 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	if (result) {
 		goto out;
 	}
+	KUSAGE_COUNT(ku_inblock);
 
 	membar_load_load();
 	result = uiomove(sc->e_iobuf, emu_rreg(sc, REG_IOLEN), uio);
@@ -351,6 +354,9 @@ emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 
 	emu_wreg(sc, REG_OPER, EMU_OP_WRITE);
 	result = emu_waitdone(sc);
+	if (result == 0) {
+		KUSAGE_COUNT(ku_oublock);
+	}
 
  out:
 	lock_release(sc->e_lock);
@@ -591,6 +597,11 @@ emufs_getdirentry(struct vnode *v, struct uio *uio)
 
 /*
  * VOP_WRITE
+ *
+ * Each trip through the loop moves up to EMU_MAXIO bytes into the
+ * device buffer with uiomove, which gathers across iovecs; so a
+ * writev of several small pieces is still a single write to the
+ * emulator rather than one per piece.
  */
 static
 int
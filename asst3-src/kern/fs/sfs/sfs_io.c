@@ -36,6 +36,8 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <uio.h>
+#include <current.h>
+#include <thread.h>
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
@@ -98,6 +100,14 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 				uio->uio_offset / SFS_BLOCKSIZE, tries);
 		}
 	}
+	if (result == 0) {
+		if (uio->uio_rw == UIO_READ) {
+			KUSAGE_COUNT(ku_inblock);
+		}
+		else {
+			KUSAGE_COUNT(ku_oublock);
+		}
+	}
 	return result;
 }
 
@@ -287,6 +297,13 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
+ *
+ * The uio may have several iovecs (from readv/writev). Nothing here
+ * looks at them directly: the partial-block path uses uiomove and the
+ * whole-block path hands the uio to the device, which also uses
+ * uiomove, and uiomove walks from one iovec to the next. So a block
+ * can straddle iovecs, and the whole transfer is one pass over the
+ * file no matter how the caller's memory is split up.
  */
 int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
@@ -40,6 +40,7 @@
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct lock;
 
 #define REGION_REGULAR 0
 #define REGION_HEAP 1
@@ -80,6 +81,7 @@ struct addrspace {
         /* Put stuff here for your VM system */
         page_table_t page_table;
         struct as_regions *asr;
+        struct lock *as_lock; // protects page_table and asr; threads of a process share them
 #endif
 };
 
@@ -107,6 +109,11 @@ void as_region_load(struct as_regions *cur, int prepare);
 // returns 0 on success or -1 if address is not part of a mmap region. 
 int as_region_mmap(struct as_regions *cur, vaddr_t addr, uint64_t *offset, struct vnode *v, struct as_regions **prev);
 
+// defines (or reuses) the user stack for thread slot `slot`. slot 0 is the stack from as_define_stack,
+// the others sit below it, each separated by an unmapped guard page.
+// returns 0 and the initial stack pointer on success, ENOMEM if the slot overlaps another region.
+int as_define_threadstack(struct addrspace *as, unsigned slot, vaddr_t *stackptr);
+
 // syscall functions
 int sys_sbrk(int a0, int *retval);
 
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _CALLOUT_H_
+#define _CALLOUT_H_
+
+/*
+ * Callouts: kernel functions scheduled to run at some point in the
+ * future, with hardclock resolution.
+ *
+ * The caller provides the storage for the struct callout, so arming
+ * and cancelling a callout never allocates memory and can be done
+ * with spinlocks held. Callouts are kept in a hierarchical timer
+ * wheel (see callout.c) so both operations are constant time.
+ *
+ * Callout functions are called from the timer interrupt (on cpu 0)
+ * with no locks held. They must not sleep.
+ *
+ * Functions:
+ *    callout_init  - set up a callout that calls FUNC(DATA) when it fires.
+ *    callout_reset - arm the callout to fire TICKS hardclocks from now,
+ *                    replacing any earlier time if it was already armed.
+ *                    A TICKS of 0 means the next hardclock.
+ *    callout_stop  - disarm the callout. Returns true if it was armed,
+ *                    false if it had already fired (or is firing right
+ *                    now) or was never armed.
+ *
+ * Note that if callout_stop returns false the function may still be
+ * running on another cpu; callers that free the callout must
+ * arrange to synchronize with the function themselves.
+ */
+
+#include <clock.h>
+
+struct callout {
+	struct callout *co_next;	/* link on wheel slot */
+	struct callout **co_prevp;	/* pointer to whatever points to us */
+	uint64_t co_expires;		/* tick at which to fire */
+	void (*co_func)(void *);	/* function to call */
+	void *co_data;			/* argument for co_func */
+	bool co_pending;		/* true if on the wheel */
+};
+
+void callout_init(struct callout *co, void (*func)(void *), void *data);
+void callout_reset(struct callout *co, unsigned ticks);
+bool callout_stop(struct callout *co);
+
+/* Convert a relative time to hardclocks, rounding up. */
+unsigned callout_timespec_to_ticks(const struct timespec *ts);
+
+/* Called from hardclock_bootstrap. */
+void callout_bootstrap(void);
+
+/* Called from hardclock. */
+void callout_tick(void);
+
+
+#endif /* _CALLOUT_H_ */
@@ -79,5 +79,17 @@ void timespec_sub(const struct timespec *t1,
  */
 void clocksleep(int seconds);
 
+/*
+ * clocknap() suspends execution for the requested number of
+ * hardclocks (1/HZ seconds each). See also <callout.h>.
+ *
+ * clocknap_intr() is the same, except that it returns EINTR early if
+ * the current process is exiting; clocknap_wakeall() wakes all napping
+ * threads so they can check.
+ */
+void clocknap(unsigned ticks);
+int clocknap_intr(unsigned ticks);
+void clocknap_wakeall(void);
+
 
 #endif /* _CLOCK_H_ */
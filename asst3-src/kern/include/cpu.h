@@ -32,10 +32,15 @@
 
 
 #include <spinlock.h>
+#include <qspinlock.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
+/* Number of scheduler priority levels (multi-level feedback queue). */
+#define SCHED_LEVELS	4
+
+
 /*
  * Per-cpu structure
  *
@@ -59,16 +64,23 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_threadcache; /* Dead threads kept for reuse */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	struct qspinlock_node c_qnodes[QSPINLOCK_NODES]; /* For qspinlocks */
+	unsigned c_qnodes_used;		/* Bitmap of c_qnodes in use */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
+	 *
+	 * The run queue is split into one list per scheduler
+	 * priority level; c_runqueue[0] is the highest priority.
+	 * See the scheduler notes in thread.c.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
-	struct spinlock c_runqueue_lock;
+	struct threadlist c_runqueue[SCHED_LEVELS]; /* Run queues */
+	struct qspinlock c_runqueue_lock;
 
 	/*
 	 * Accessed by other cpus.
@@ -155,6 +167,8 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_broadcast sends TLB shootdown data to all CPUs
+ * except the current one, and waits until they have all acted on it.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -169,6 +183,7 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
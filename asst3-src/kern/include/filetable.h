@@ -35,30 +35,47 @@
 #define _FILETABLE_H_
 
 #include <limits.h> /* for OPEN_MAX */
+#include <spinlock.h>
 
 
 /*
  * The file table is an array of open files.
  *
- * There is no particular reason to use a fixed size array (of size
- * OPEN_MAX) instead of a dynamically sized array (using array.h) --
- * the code was just written this way years ago and there's no
- * compelling reason to change it that outweighs this benefit: you can
- * look through the code to see what it would take to make it dynamic,
- * or even to make it dynamic with the limit being user-settable. (See
- * setrlimit(2) on a Unix machine.)
+ * The array starts out small (FILETABLE_MINSIZE slots) and is doubled
+ * on demand, up to OPEN_MAX, when a file is placed past the end of it
+ * or when it fills up. Most processes only ever have the standard
+ * three files open, but some want thousands, and it would be a waste
+ * to give everyone a table big enough for those.
  *
- * Because we only have single-threaded processes, the file table is
- * never shared and so it doesn't require synchronization. On fork,
- * the table is copied. Another exercise: what would you need to do to
- * make this code safe for multithreaded processes? What happens if
- * one thread calls close() while another one is in the middle of e.g.
- * read() using the same file handle?
+ * ft_inuse has a bit set for each slot that's occupied; place finds
+ * the lowest free descriptor by scanning it a word at a time instead
+ * of looking at every slot. ft_top is one past the highest occupied
+ * slot, so that fork and exit only need to look at the part of the
+ * table that's actually in use.
+ *
+ * The threads of a process share its file table, so the slots are
+ * protected by ft_lock. (On fork, the table is copied.) ft_lock is
+ * only held to look at or change a slot, never across I/O, and never
+ * across kmalloc; growing the table allocates the new array first and
+ * then swaps it in under the lock.
+ *
+ * filetable_get hands out its own reference to the openfile, which
+ * filetable_put drops. So if one thread calls close() while another
+ * is in the middle of e.g. read() on the same file handle, the close
+ * empties the slot at once but the openfile (and its vnode) live on
+ * until the read finishes; the read is not disturbed.
  */
 struct filetable {
-	struct openfile *ft_openfiles[OPEN_MAX];
+	struct spinlock ft_lock;
+	struct openfile **ft_openfiles;	/* array of ft_size slots */
+	struct bitmap *ft_inuse;	/* which slots are not NULL */
+	unsigned ft_size;		/* number of slots allocated */
+	unsigned ft_top;		/* one past highest slot in use */
 };
 
+/* Initial table size; must be a power of 2, and a multiple of 8. */
+#define FILETABLE_MINSIZE	32
+
 /*
  * Filetable ops:
  *
@@ -68,10 +85,12 @@ struct filetable {
  * okfd -    Check if a file handle is in range.
  * get/put - Retrieve a fd for use and put it back when done. (Checks
  *           okfd and also fails on files not open; returned openfile
- *           is not NULL.) Call put with the file returned from get.
+ *           is not NULL, and holds a reference until put.) Call put
+ *           with the file returned from get.
  * place -   Insert a file and return the fd.
  * placeat - Insert a file at a specific slot and return the file
- *           previously there.
+ *           previously there. (Can fail with ENOMEM growing the
+ *           table; placing NULL never fails.)
  */
 
 struct filetable *filetable_create(void);
@@ -83,8 +102,8 @@ int filetable_get(struct filetable *ft, int fd, struct openfile **ret);
 void filetable_put(struct filetable *ft, int fd, struct openfile *file);
 
 int filetable_place(struct filetable *ft, struct openfile *file, int *fd);
-void filetable_placeat(struct filetable *ft, struct openfile *newfile, int fd,
-		       struct openfile **oldfile_ret);
+int filetable_placeat(struct filetable *ft, struct openfile *newfile, int fd,
+		      struct openfile **oldfile_ret);
 
 
 #endif /* _FILETABLE_H_ */
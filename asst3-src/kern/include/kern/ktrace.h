@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_KTRACE_H_
+#define _KERN_KTRACE_H_
+
+/*
+ * Kernel event trace definitions visible to userspace. This covers
+ * the format of the trace files written by the kernel menu's
+ * "ktrace dump" command and read by ktracedump.
+ *
+ * A trace file is a struct ktrace_header followed by kh_nrecords
+ * struct ktrace_records. Each cpu's records are in time order; the
+ * cpus follow one another. All fields are in the kernel's (that is,
+ * big-endian) byte order.
+ */
+
+#define KTRACE_MAGIC	0x6b747263	/* "ktrc" */
+
+struct ktrace_header {
+	uint32_t kh_magic;		/* KTRACE_MAGIC */
+	uint32_t kh_ncpus;		/* number of cpus traced */
+	uint32_t kh_nrecords;		/* number of records following */
+	uint32_t kh_dropped;		/* records overwritten before dump */
+};
+
+struct ktrace_record {
+	uint32_t kr_sec;		/* timestamp: seconds */
+	uint32_t kr_nsec;		/* timestamp: nanoseconds */
+	uint16_t kr_cpu;		/* cpu number */
+	uint16_t kr_event;		/* KTRACE_* event code */
+	uint32_t kr_thread;		/* address of current thread */
+	uint32_t kr_arg[4];		/* event arguments, as below */
+};
+
+/* Event codes. */
+#define KTRACE_SWITCH	1	/* next thread, old state, old/new priority */
+#define KTRACE_WAKEUP	2	/* woken thread, its cpu number */
+#define KTRACE_VMFAULT	3	/* fault type, fault address */
+#define KTRACE_SYSCALL	4	/* call number, a0, a1, a2 */
+#define KTRACE_SYSRET	5	/* call number, error, retval */
+
+
+#endif /* _KERN_KTRACE_H_ */
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KTRACE_H_
+#define _KTRACE_H_
+
+/*
+ * Kernel event tracing.
+ *
+ * When tracing is on, each cpu logs fixed-size binary records of
+ * context switches, wakeups, VM faults and system calls into a ring
+ * buffer of its own. Logging takes no locks (the ring belongs to the
+ * cpu, so it's enough to turn interrupts off) and doesn't print
+ * anything, so it disturbs timing much less than kprintf would. When
+ * tracing is off the cost is one test of a global flag.
+ *
+ * The rings can be dumped to a file with the "ktrace" menu command
+ * and decoded with ktracedump (see <kern/ktrace.h> for the format).
+ *
+ * Functions:
+ *    ktrace_start - allocate the rings if needed, clear them, and
+ *                   start logging.
+ *    ktrace_stop  - stop logging.
+ *    ktrace_dump  - write the rings to the file PATH. Stops logging
+ *                   while doing so, and restarts it afterwards if it
+ *                   was on.
+ */
+
+#include <kern/ktrace.h>
+
+int ktrace_start(void);
+void ktrace_stop(void);
+int ktrace_dump(const char *path);
+
+/* Log an event. Use KTRACE(), not this. */
+void ktrace_event(unsigned event, uint32_t a0, uint32_t a1,
+		  uint32_t a2, uint32_t a3);
+
+extern volatile bool ktrace_on;
+
+#define KTRACE(ev, a0, a1, a2, a3) \
+	do { \
+		if (ktrace_on) { \
+			ktrace_event(ev, (uint32_t)(a0), (uint32_t)(a1), \
+				     (uint32_t)(a2), (uint32_t)(a3)); \
+		} \
+	} while (0)
+
+
+#endif /* _KTRACE_H_ */
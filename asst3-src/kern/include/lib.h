@@ -163,6 +163,7 @@ const char *strerror(int errcode);
  */
 void putch(int ch);
 int getch(void);
+void getch_wakeall(void);
 void beep(void);
 
 /*
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+/*
+ * Lock contention profiler. Enable with "options lockstat" in the
+ * kernel config.
+ *
+ * For every lock class this counts acquisitions, acquisitions that
+ * had to wait, the total time spent waiting, and the longest time
+ * the lock was held, timed with the hardware clock. Sleep locks and
+ * reader-writer locks are classed by name; spinlocks and qspinlocks
+ * have no names and are classed by the place they were acquired from.
+ * Reads of a reader-writer lock are counted, but only writes are
+ * timed for hold time.
+ *
+ * This is not free: every acquire and release reads the clock and
+ * takes a global lock, so expect everything to run slower with it
+ * turned on. Use the "lockstat" menu command to look at the results.
+ */
+
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+
+struct lockstat_class;
+
+struct lockstat {
+	struct lockstat_class *ls_class;  /* Class the current hold is in */
+	uint64_t ls_holdstart;		  /* When it was acquired (nsecs) */
+};
+
+/* Value of a wait start time meaning "didn't wait" */
+#define LOCKSTAT_NOWAIT		((uint64_t)-1)
+
+void lockstat_bootstrap(void);
+void lockstat_init(struct lockstat *ls, const char *name);
+uint64_t lockstat_now(void);
+void lockstat_acquire(struct lockstat *ls, const char *name,
+		      const void *site, uint64_t waitstart);
+void lockstat_release(struct lockstat *ls);
+
+void lockstat_print(unsigned max);
+void lockstat_reset(void);
+
+#define LOCKSTAT(sym)		struct lockstat sym
+#define LOCKSTAT_WAITVAR(sym)	uint64_t sym = LOCKSTAT_NOWAIT
+
+/* Note: includes its own trailing comma; see SPINLOCK_INITIALIZER. */
+#define LOCKSTAT_INITIALIZER	{ NULL, 0 },
+
+#define LOCKSTAT_INIT(ls, n)	lockstat_init(ls, n)
+#define LOCKSTAT_WAIT(w) \
+	((w) = ((w) == LOCKSTAT_NOWAIT ? lockstat_now() : (w)))
+#define LOCKSTAT_ACQUIRE(ls, w)	lockstat_acquire(ls, NULL, NULL, w)
+#define LOCKSTAT_SITEACQUIRE(ls, n, w) \
+	lockstat_acquire(ls, n, __builtin_return_address(0), w)
+#define LOCKSTAT_RELEASE(ls)	lockstat_release(ls)
+
+#else
+
+#define LOCKSTAT(sym)
+#define LOCKSTAT_WAITVAR(sym)
+
+#define LOCKSTAT_INITIALIZER
+
+#define LOCKSTAT_INIT(ls, n)
+#define LOCKSTAT_WAIT(w)
+#define LOCKSTAT_ACQUIRE(ls, w)
+#define LOCKSTAT_SITEACQUIRE(ls, n, w)
+#define LOCKSTAT_RELEASE(ls)
+
+#endif
+
+#endif /* LOCKSTAT_H */
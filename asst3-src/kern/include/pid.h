@@ -34,6 +34,7 @@
 #ifndef _PID_H_
 #define _PID_H_
 
+struct kusage;
 
 #define INVALID_PID	0	/* nothing has this pid */
 #define KERNEL_PID	1	/* kernel proc has this pid */
@@ -59,16 +60,24 @@ void pid_unalloc(pid_t targetpid);
 void pid_disown(pid_t targetpid);
 
 /*
- * Set the exit status of the current thread to status.  Wakes up any threads
- * waiting to read this status, and decrefs the current thread's pid.
+ * Set the exit status of process PID to status, and record its
+ * resource usage (including its children's) for the parent.  Wakes
+ * up any threads waiting to read this status, and decrefs the pid.
  */
-void pid_setexitstatus(int status);
+void pid_setexitstatus(pid_t pid, int status, const struct kusage *usage);
 
 /*
  * Causes the current thread to wait for the thread with pid PID to
- * exit, returning the exit status when it does.
+ * exit, returning the exit status when it does. The child's resource
+ * usage is added to the current process's children's usage.
  */
 int pid_wait(pid_t targetpid, int *status, int flags, pid_t *retpid);
 
+/*
+ * Wake the current process's threads waiting in pid_wait, so they
+ * notice it is exiting.
+ */
+void pid_wakeall(void);
+
 
 #endif /* _PID_H_ */
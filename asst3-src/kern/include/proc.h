@@ -40,13 +40,25 @@
 #include <thread.h> /* required for struct threadarray */
 
 struct addrspace;
+struct semaphore;
 struct vnode;
+struct wchan;
+
+/*
+ * Maximum number of user threads in one process. Each thread id also
+ * names a user stack slot (see as_define_threadstack), so thread ids
+ * are only reused once the old thread has been joined.
+ */
+#define PROC_MAXUTHREADS	32
+#define PROC_TIDBIT(tid)	((uint32_t)1 << (tid))
 
 /*
  * Process structure.
  *
- * Note that unless you implement multithreaded processes, p_threads
- * will only contain one thread for all processes other than kproc.
+ * p_threads holds every thread attached to the process; for user
+ * processes these are the user threads made with fork and
+ * thread_create. The user thread fields (p_nuthreads and below) are
+ * protected by p_lock.
  *
  * Note: you can't protect p_threads with a spinlock because it needs
  * to be able to call kmalloc.
@@ -60,14 +72,39 @@ struct proc {
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
+	struct semaphore *p_vforkdone;	/* if set, p_addrspace is our
+					   vfork parent's; V when done */
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
 	struct filetable *p_filetable;	/* table of open files */
 
+	/* user threads */
+	unsigned p_nuthreads;		/* live user threads */
+	uint32_t p_tidsused;		/* thread ids allocated (PROC_TIDBIT) */
+	uint32_t p_tidsdone;		/* ...that have exited, not joined */
+	userptr_t p_uthreadret[PROC_MAXUTHREADS]; /* thread_exit values */
+	struct wchan *p_uthreadwchan;	/* thread_join sleeps here */
+	bool p_exiting;			/* _exit called; threads must leave */
+	int p_exitstatus;		/* status for the last one out */
+
+	/* resource usage (see rusage.h); protected by p_lock */
+	struct kusage p_usage;		/* threads that have left */
+	struct kusage p_cusage;		/* children collected by pid_wait */
+
 	/* add more material here as needed */
 };
 
+/*
+ * Array of processes.
+ */
+#ifndef PROCINLINE
+#define PROCINLINE INLINE
+#endif
+
+DECLARRAY(proc, PROCINLINE);
+DEFARRAY(proc, PROCINLINE);
+
 /* This is the process structure for the kernel and for kernel-only threads. */
 extern struct proc *kproc;
 
@@ -77,8 +114,16 @@ void proc_bootstrap(void);
 /* Create a fresh process for use by runprogram(). */
 int proc_create_runprogram(const char *name, struct proc **ret);
 
-/* Create a fresh process for use by fork() */
-int proc_fork(struct proc **ret);
+/*
+ * Create a fresh process for use by fork(), or by vfork() if VFORKDONE
+ * is not NULL: then the new process borrows the caller's address space
+ * instead of getting a copy, and VFORKDONE is V'd when it gives it
+ * back by calling execv or exiting.
+ */
+int proc_fork(struct semaphore *vforkdone, struct proc **ret);
+
+/* Give a borrowed address space back to our vfork parent. */
+void proc_vforkdone(struct proc *proc);
 
 /* Undo proc_fork if nothing's run in the new process yet. */
 void proc_unfork(struct proc *proc);
@@ -95,6 +140,13 @@ void proc_destroy(struct proc *proc);
  */
 void proc_exit(int status);
 
+/*
+ * Make the current thread leave its (user) process, recording RETVAL
+ * for thread_join. The last thread to leave makes the process exit.
+ * Does not return.
+ */
+__DEAD void proc_threadexit(userptr_t retval);
+
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
@@ -107,5 +159,17 @@ struct addrspace *proc_getas(void);
 /* Change the address space of the current process, and return the old one. */
 struct addrspace *proc_setas(struct addrspace *);
 
+/*
+ * Get the resource usage of a process (WHO is RUSAGE_SELF), or of
+ * the children it has waited for (RUSAGE_CHILDREN).
+ */
+int proc_getusage(struct proc *proc, int who, struct kusage *ret);
+
+/* Add the usage of a child collected by pid_wait. */
+void proc_addchildusage(struct proc *proc, const struct kusage *ku);
+
+/* Print a table of all processes and their usage (the "ps" command). */
+void proc_printall(void);
+
 
 #endif /* _PROC_H_ */
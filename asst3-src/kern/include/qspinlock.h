@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _QSPINLOCK_H_
+#define _QSPINLOCK_H_
+
+/*
+ * Queued spinlocks.
+ *
+ * These are MCS locks: each cpu waiting for the lock spins on a wait
+ * node of its own, and the lock itself only holds a pointer to the
+ * last node in the queue. A waiting cpu joins the queue with one
+ * atomic swap, and the holder hands the lock directly to the next
+ * cpu in line on release. So waiters don't all hammer the same
+ * memory word, each handoff costs a constant amount of traffic, and
+ * the lock is granted in FIFO order.
+ *
+ * Use these instead of regular spinlocks for locks that are heavily
+ * contended between cpus. Uncontended, they cost a little more than
+ * a regular spinlock.
+ *
+ * Otherwise they behave exactly like spinlocks: they are held by
+ * cpus, acquiring one disables interrupts, they count towards
+ * curcpu->c_spinlocks, and they are visible to the deadlock detector.
+ * They cannot be passed to wchan_sleep.
+ */
+
+#include <cdefs.h>
+#include <hangman.h>
+#include <lockstat.h>
+#include <spinlock.h>	/* for spinlock_ptr_* */
+
+/*
+ * Wait node. Each cpu has a small array of these (one per qspinlock
+ * it can be holding or waiting for at once); see struct cpu.
+ */
+struct qspinlock_node {
+	struct qspinlock_node *volatile qn_next; /* Next waiter in queue */
+	volatile unsigned qn_wait;	/* Nonzero while we must wait */
+};
+
+/* Number of wait nodes per cpu, i.e. max qspinlocks held at once. */
+#define QSPINLOCK_NODES		8
+
+struct qspinlock {
+	struct qspinlock_node *volatile qsplk_tail; /* Last node in queue */
+	struct qspinlock_node *qsplk_node;  /* Holder's node */
+	struct cpu *qsplk_holder;	    /* CPU holding this lock */
+	LOCKSTAT(qsplk_lockstat);	    /* Contention profiler hook */
+	HANGMAN_LOCKABLE(qsplk_hangman);    /* Deadlock detector hook */
+};
+
+/*
+ * Initializer for cases where a qspinlock needs to be static or global.
+ */
+#ifdef OPT_HANGMAN
+#define QSPINLOCK_INITIALIZER	{ NULL, NULL, NULL, \
+				  LOCKSTAT_INITIALIZER \
+				  HANGMAN_LOCKABLE_INITIALIZER }
+#else
+#define QSPINLOCK_INITIALIZER	{ NULL, NULL, NULL, \
+				  LOCKSTAT_INITIALIZER }
+#endif
+
+/*
+ * Functions: same as for spinlocks.
+ *
+ * init		Initialize the contents of a qspinlock.
+ * cleanup	Opposite of init. Lock must be unlocked.
+ *
+ * acquire	Get the lock, spinning as necessary. Also disables interrupts.
+ * release	Release the lock. May re-enable interrupts.
+ *
+ * do_i_hold	Check if the current CPU holds the lock.
+ */
+
+void qspinlock_init(struct qspinlock *lk);
+void qspinlock_cleanup(struct qspinlock *lk);
+
+void qspinlock_acquire(struct qspinlock *lk);
+void qspinlock_release(struct qspinlock *lk);
+
+bool qspinlock_do_i_hold(struct qspinlock *lk);
+
+
+#endif /* _QSPINLOCK_H_ */
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _RUSAGE_H_
+#define _RUSAGE_H_
+
+/*
+ * Resource usage accounting.
+ *
+ * Each thread counts what it uses in its t_usage. Only the thread
+ * itself updates its counts (hardclock charges the thread it
+ * interrupted, on its own cpu), so counting takes no locks; readers
+ * of other threads' counts get a slightly stale value. When a thread
+ * leaves its process its counts are folded into the process's
+ * p_usage, so a process's own usage is that plus the counts of its
+ * live threads. When a process exits, its usage plus that of the
+ * children it waited for is handed to its parent, which adds it to
+ * p_cusage when it collects the exit status in pid_wait.
+ */
+
+#include <kern/time.h>
+#include <kern/resource.h>
+
+struct kusage {
+	uint32_t ku_uticks;		/* hardclocks taken in user mode */
+	uint32_t ku_sticks;		/* hardclocks taken in the kernel */
+	uint32_t ku_rfaults;		/* read faults (VM_FAULT_READ) */
+	uint32_t ku_wfaults;		/* write faults (VM_FAULT_WRITE) */
+	uint32_t ku_mfaults;		/* write to readonly (VM_FAULT_READONLY) */
+	uint32_t ku_cowcopies;		/* shared pages copied on write */
+	uint32_t ku_inblock;		/* blocks read from disk */
+	uint32_t ku_oublock;		/* blocks written to disk */
+	uint32_t ku_nvcsw;		/* voluntary context switches */
+	uint32_t ku_nivcsw;		/* involuntary (preempted) */
+};
+
+/* Count one of FIELD for the current thread. Needs <current.h>. */
+#define KUSAGE_COUNT(field) (curthread->t_usage.field++)
+
+/* Zero a usage record. */
+void kusage_init(struct kusage *ku);
+
+/* Add FROM into TO. */
+void kusage_add(struct kusage *to, const struct kusage *from);
+
+/* Convert to the userlevel form for getrusage. */
+void kusage_torusage(const struct kusage *ku, struct rusage *ru);
+
+
+#endif /* _RUSAGE_H_ */
@@ -75,9 +75,11 @@ void V(struct semaphore *);
 struct lock {
         char *lk_name;
         HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
+        LOCKSTAT(lk_lockstat);          /* Contention profiler hook. */
         struct wchan *lk_wchan;
         struct spinlock lk_lock;
         struct thread *volatile lk_holder;
+        struct cpu *volatile lk_holdercpu; /* where lk_holder got it */
 };
 
 struct lock *lock_create(const char *name);
@@ -133,6 +135,10 @@ void cv_destroy(struct cv *);
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
+ * cv_broadcast doesn't wake the sleepers directly: it moves them onto
+ * the lock's queue, so they get woken one by one as the lock is
+ * released rather than all at once to fight over it.
+ *
  * These operations must be atomic. You get to write them.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
@@ -140,4 +146,57 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, new readers wait
+ * behind it. To keep readers from starving in turn, when a writer
+ * releases the lock every reader that was already waiting at that
+ * point is let in before the next writer.
+ *
+ * The deadlock detector sees the write side like a lock. Readers
+ * are reported to it while they wait, but are not recorded as
+ * holders.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+struct rwlock {
+        char *rw_name;
+        HANGMAN_LOCKABLE(rw_hangman);   /* Deadlock detector hook. */
+        LOCKSTAT(rw_lockstat);          /* Contention profiler hook. */
+        struct wchan *rw_rdwchan;       /* Readers wait here */
+        struct wchan *rw_wrwchan;       /* Writers wait here */
+        struct spinlock rw_lock;
+        struct thread *rw_writer;       /* Thread holding write side */
+        unsigned rw_readers;            /* Number of readers inside */
+        unsigned rw_rdwaiting;          /* Number of readers waiting */
+        unsigned rw_wrwaiting;          /* Number of writers waiting */
+        unsigned rw_rdadmit;            /* Readers let in, not yet inside */
+        unsigned rw_rdgen;              /* Bumped on each reader batch */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading. Other readers may
+ *                           hold it at the same time.
+ *    rwlock_release_read  - Give up a read hold.
+ *    rwlock_acquire_write - Get the lock for writing. Nobody else, reader
+ *                           or writer, may hold it at the same time.
+ *    rwlock_release_write - Give up the write hold.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                           the lock for writing. (There is no way to
+ *                           ask about read holds.)
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
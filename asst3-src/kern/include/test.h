@@ -58,6 +58,13 @@ int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
 
+/* synchronization benchmarks */
+int lockbench(int, char **);
+int spinbench(int, char **);
+
+/* workqueue test */
+int wqtest(int, char **);
+
 /* semaphore unit tests */
 int semu1(int, char **);
 int semu2(int, char **);
@@ -39,6 +39,7 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include <rusage.h>
 
 struct cpu;
 
@@ -85,6 +86,15 @@ struct thread {
 	struct proc *t_proc;		/* Process thread belongs to */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
+	/*
+	 * Scheduler fields. t_priority is the run queue level (0 is
+	 * highest); t_quantum is the number of hardclocks the thread
+	 * may still run before it is demoted to the next level.
+	 */
+	unsigned t_priority;		/* Scheduler priority level */
+	unsigned t_quantum;		/* Hardclocks left in quantum */
+	unsigned t_readyclock;		/* c_hardclocks when last queued */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -99,6 +109,7 @@ struct thread {
 	 * rather than per-cpu or global?
 	 */
 	bool t_in_interrupt;		/* Are we in an interrupt? */
+	bool t_intr_fromuser;		/* ...that came from user mode? */
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
@@ -106,6 +117,9 @@ struct thread {
 	 * Public fields
 	 */
 
+	unsigned t_tid;			/* User thread id within t_proc */
+	struct kusage t_usage;		/* Resources used (see rusage.h) */
+
 	/* add more here as needed */
 };
 
@@ -125,6 +139,9 @@ void thread_bootstrap(void);
 /* Call late in system startup to get secondary CPUs running. */
 void thread_start_cpus(void);
 
+/* Number of CPUs in the system. */
+unsigned thread_numcpus(void);
+
 /* Call during panic to stop other threads in their tracks */
 void thread_panic(void);
 
@@ -159,10 +176,18 @@ __DEAD void thread_exit(void);
 void thread_yield(void);
 
 /*
- * Reshuffle the run queue. Called from the timer interrupt.
+ * Reshuffle the run queue. Called periodically from the timer
+ * interrupt; moves every ready thread back to the top priority level.
  */
 void schedule(void);
 
+/*
+ * Charge the current thread for one hardclock, and yield if its
+ * quantum has run out or a higher-priority thread is ready. Called
+ * from the timer interrupt.
+ */
+void thread_quantum_tick(void);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
@@ -58,6 +58,10 @@ uint32_t zero_frame;
 // type for the page table
 typedef int*** page_table_t;
 
+struct addrspace;
+struct vnode;
+struct fs;
+
 // function in unsw.c
 // frees the given frame, either decreasing its reference by 1, or freeing it completely
 void free_frame(uint32_t frame);
@@ -66,6 +70,10 @@ void free_frame(uint32_t frame);
 // increases the reference count of the frame by 1.
 void frame_add(uint32_t frame);
 
+// function in unsw.c
+// returns the reference count of the frame.
+uint32_t frame_refcount(uint32_t frame);
+
 // function in unsw.c
 // obtains a frame that is writeable from the given frame. 
 // If given frame is writeable, returns same frame. Otherwise, allocates a new frame, copies everything
@@ -92,9 +100,46 @@ int page_table_set(page_table_t page_table, int page, int frame);
 // returns -1 (PAGE_TABLE_UNUSED) if not found, otherwise returns the frame number
 int page_table_get(page_table_t page_table, int page);
 
+// maps the kernel page KPAGE (one page from alloc_kpages) at user address VADDR in AS.
+// the reference to the frame is handed over to the address space, which frees it in as_destroy.
+// the page must not be mapped yet. returns 0 on success and ENOMEM if the page table can't grow.
+int vm_mapkpage(struct addrspace *as, vaddr_t vaddr, vaddr_t kpage);
+
+// lends the frame behind the user page at VADDR in AS to the caller (e.g. a pipe), which gets
+// its own reference to it. the page becomes copy-on-write in AS, so later writes there don't
+// show through. returns the frame number, or -1 if the page isn't readable or isn't there yet.
+int vm_loanpage(struct addrspace *as, vaddr_t vaddr);
+
+// puts FRAME at user address VADDR in AS in place of whatever was there, taking over the
+// caller's reference to it. if the frame is shared, writes to it copy it first (COW).
+// returns EFAULT if VADDR isn't writeable, or ENOMEM if the page table can't grow; on
+// failure the caller still has its reference.
+int vm_givepage(struct addrspace *as, vaddr_t vaddr, uint32_t frame);
+
 /* Initialization function */
 void vm_bootstrap(void);
 
+// functions in textcache.c: the cache of read-only executable pages shared between
+// processes running the same program.
+void textcache_bootstrap(void);
+
+// maps at VADDR in AS the cached page holding the LEN bytes of V at OFFSET, placed at
+// VADDR's offset within the page, with zeros in the rest of the page. reads it in if
+// it isn't cached yet. the page at VADDR must not be mapped yet.
+int textcache_map(struct addrspace *as, struct vnode *v, off_t offset, vaddr_t vaddr, size_t len);
+
+// drops every cached page of V, e.g. because V is about to be removed. processes
+// already running keep the pages they have.
+void textcache_purge(struct vnode *v);
+
+// drops every cached page of every file on FS, e.g. before unmounting it.
+void textcache_purgefs(struct fs *fs);
+
+// V has been opened for writing: drop its cached pages and cache no more until
+// textcache_remwriter says the file is closed again.
+void textcache_addwriter(struct vnode *v);
+void textcache_remwriter(struct vnode *v);
+
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
 
@@ -105,5 +150,9 @@ void free_kpages(vaddr_t addr);
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+// invalidates vaddr (or TLBSHOOTDOWN_ALL) in the TLBs of the other cpus, if the current
+// process has other threads that could have loaded it. does not touch the local TLB.
+void vm_shootdown(vaddr_t vaddr);
+
 
 #endif /* _VM_H_ */
@@ -52,6 +52,8 @@ struct vnode {
 	int vn_refcount;                /* Reference count */
 	struct spinlock vn_countlock;   /* Lock for vn_refcount */
 
+	unsigned vn_writers;            /* Writable opens (under vn_countlock) */
+
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
 	void *vn_data;                  /* Filesystem-specific data */
@@ -67,14 +67,26 @@ bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
 void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
 /*
- * Wake up one thread, or all threads, sleeping on a wait channel.
- * The associated spinlock should be locked.
+ * Wake up one thread, up to N threads, or all threads, sleeping on a
+ * wait channel. The associated spinlock should be locked. wchan_wakeN
+ * returns how many threads it woke.
  *
  * The current implementation is FIFO but this is not promised by the
  * interface.
  */
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
+unsigned wchan_wakeN(struct wchan *wc, struct spinlock *lk, unsigned n);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Move every thread sleeping on FROM to TO without waking them (wait
+ * morphing). Both associated spinlocks must be locked. The threads
+ * still relock FROMLK when they eventually wake, so this is only for
+ * sleepers that will then release it and wait on TO's condition
+ * anyway. Returns the number of threads moved.
+ */
+unsigned wchan_moveall(struct wchan *from, struct spinlock *fromlk,
+		       struct wchan *to, struct spinlock *tolk);
+
 
 #endif /* _WCHAN_H_ */
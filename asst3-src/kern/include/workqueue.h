@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Work queues: kernel functions to be run soon, in thread context,
+ * by a pool of worker threads.
+ *
+ * This is how to get work out of an interrupt handler, or off the
+ * path of a system call, into a context that can sleep. Like with
+ * callouts, the caller provides the storage for the struct work, so
+ * queueing work never allocates memory and can be done from an
+ * interrupt handler or with spinlocks held.
+ *
+ * Each workqueue has one queue per cpu (or per worker thread, if
+ * there are fewer of those) so cpus queueing work don't all fight
+ * over one lock. Work is queued on the current cpu's queue and run
+ * in FIFO order per queue; there is no ordering between queues.
+ * Workers take work off their queue in batches.
+ *
+ * Functions:
+ *    work_init         - set up a work item that calls FUNC(DATA).
+ *    workqueue_create  - make a workqueue with NTHREADS worker threads.
+ *    workqueue_destroy - run everything still queued, then stop the
+ *                        workers and free the workqueue.
+ *    workqueue_enqueue - queue a work item. Returns false if it was
+ *                        already queued (and not yet started), in
+ *                        which case it will still only run once.
+ *    workqueue_flush   - wait until everything queued so far has run.
+ *
+ * A work item may be queued again as soon as its function has been
+ * called, including by the function itself. Work functions may sleep,
+ * but if they wait for other work on the same workqueue they can
+ * deadlock.
+ */
+
+#include <spinlock.h>
+
+struct work {
+	struct work *w_next;		/* link on queue */
+	void (*w_func)(void *);		/* function to call */
+	void *w_data;			/* argument for w_func */
+	volatile spinlock_data_t w_pending; /* set while queued */
+};
+
+struct workqueue;		/* Opaque. */
+
+void work_init(struct work *w, void (*func)(void *), void *data);
+
+struct workqueue *workqueue_create(const char *name, unsigned nthreads);
+void workqueue_destroy(struct workqueue *wq);
+bool workqueue_enqueue(struct workqueue *wq, struct work *w);
+void workqueue_flush(struct workqueue *wq);
+
+/* General-purpose workqueue, with one worker per cpu. */
+extern struct workqueue *system_wq;
+
+/* Create system_wq. Called from boot() once all cpus are up. */
+void workqueue_bootstrap(void);
+
+
+#endif /* _WORKQUEUE_H_ */
@@ -120,6 +120,48 @@ bitmap_alloc(struct bitmap *b, unsigned *index)
         return ENOSPC;
 }
 
+/*
+ * Next-fit version of bitmap_alloc: start looking at bit HINT instead
+ * of at the beginning, and wrap around. Callers that keep HINT just
+ * past the last bit they got avoid rescanning the busy part of the
+ * map on every allocation.
+ */
+int
+bitmap_alloc_next(struct bitmap *b, unsigned hint, unsigned *index)
+{
+        unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
+        unsigned startix, ix, i;
+        unsigned offset;
+
+        if (hint >= b->nbits) {
+                hint = 0;
+        }
+        startix = hint / BITS_PER_WORD;
+
+        /*
+         * Go round once, and then look at the first word again
+         * for the bits below the hint.
+         */
+        for (i=0; i<=maxix; i++) {
+                ix = (startix + i) % maxix;
+                if (b->v[ix]==WORD_ALLBITS) {
+                        continue;
+                }
+                offset = (i == 0) ? hint % BITS_PER_WORD : 0;
+                for (; offset < BITS_PER_WORD; offset++) {
+                        WORD_TYPE mask = ((WORD_TYPE)1) << offset;
+
+                        if ((b->v[ix] & mask)==0) {
+                                b->v[ix] |= mask;
+                                *index = (ix*BITS_PER_WORD)+offset;
+                                KASSERT(*index < b->nbits);
+                                return 0;
+                        }
+                }
+        }
+        return ENOSPC;
+}
+
 static
 inline
 void
@@ -47,6 +47,9 @@
 #include <vfs.h>
 #include <device.h>
 #include <pid.h>
+#include <futex.h>
+#include <lockstat.h>
+#include <workqueue.h>
 #include <syscall.h>
 #include <test.h>
 #include <version.h>
@@ -112,6 +115,7 @@ boot(void)
 	proc_bootstrap();
 	thread_bootstrap();
 	pid_bootstrap();
+	futex_bootstrap();
 	hardclock_bootstrap();
 	vfs_bootstrap();
 	kheap_nextgeneration();
@@ -124,6 +128,10 @@ boot(void)
 	/* Now do pseudo-devices. */
 	pseudoconfig();
 	kprintf("\n");
+#if OPT_LOCKSTAT
+	/* The clock is attached now, so locks can be timed. */
+	lockstat_bootstrap();
+#endif
 	kheap_nextgeneration();
 
 	/* Late phase of initialization. */
@@ -131,6 +139,7 @@ boot(void)
 	kprintf_bootstrap();
 	exec_bootstrap();
 	thread_start_cpus();
+	workqueue_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
@@ -43,6 +43,8 @@
 #include <vfs.h>
 #include <sfs.h>
 #include <pid.h>
+#include <lockstat.h>
+#include <ktrace.h>
 #include <syscall.h>
 #include <test.h>
 #include "opt-sfs.h"
@@ -459,6 +461,18 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+static
+int
+cmd_ps(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	proc_printall();
+
+	return 0;
+}
+
 static
 int
 cmd_kheapstats(int nargs, char **args)
@@ -500,6 +514,55 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_ktrace(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		result = ktrace_start();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		ktrace_stop();
+		result = 0;
+	}
+	else if (nargs == 3 && !strcmp(args[1], "dump")) {
+		result = ktrace_dump(args[2]);
+	}
+	else {
+		kprintf("Usage: ktrace on | off | dump file\n");
+		return EINVAL;
+	}
+
+	return result;
+}
+
+#if OPT_LOCKSTAT
+/* Number of lock classes shown by default */
+#define LOCKSTAT_TOP 20
+
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		lockstat_print(LOCKSTAT_TOP);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockstat_reset();
+	}
+	else if (nargs == 2 && atoi(args[1]) > 0) {
+		lockstat_print(atoi(args[1]));
+	}
+	else {
+		kprintf("Usage: lockstat [count | reset]\n");
+	}
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -576,6 +639,9 @@ static const char *testmenu[] = {
 	"[sy2] Lock test                     ",
 	"[sy3] CV test                       ",
 	"[sy4] CV test #2                    ",
+	"[sb1] Lock benchmark [threads]      ",
+	"[sb2] Spinlock benchmark [threads]  ",
+	"[wq1] Workqueue test                ",
 	"[semu1-22] Semaphore unit tests     ",
 	"[wt]  waitpid test                  ",
 	"[fs1] Filesystem test               ",
@@ -603,9 +669,14 @@ cmd_testmenu(int n, char **a)
 static const char *mainmenu[] = {
 	"[?o] Operations menu                ",
 	"[?t] Tests menu                     ",
+	"[ps] Processes and resource usage   ",
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+#if OPT_LOCKSTAT
+	"[lockstat] Lock contention stats    ",
+#endif
+	"[ktrace] Kernel event trace         ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -654,9 +725,14 @@ static struct {
 	{ "halt",	cmd_quit },
 
 	/* stats */
+	{ "ps",         cmd_ps },
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+#if OPT_LOCKSTAT
+	{ "lockstat",   cmd_lockstat },
+#endif
+	{ "ktrace",     cmd_ktrace },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -679,6 +755,9 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sb1",	lockbench },
+	{ "sb2",	spinbench },
+	{ "wq1",	wqtest },
 
 	/* semaphore unit tests */
 	{ "semu1",	semu1 },
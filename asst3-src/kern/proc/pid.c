@@ -36,12 +36,12 @@
 #include <kern/wait.h>
 #include <limits.h>
 #include <lib.h>
-#include <array.h>
-#include <clock.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <wchan.h>
 #include <thread.h>
 #include <proc.h>
 #include <current.h>
-#include <synch.h>
 #include <pid.h>
 
 /*
@@ -49,14 +49,27 @@
  *
  * If pi_ppid is INVALID_PID, the parent has gone away and will not be
  * waiting. If pi_ppid is INVALID_PID and pi_exited is true, the
- * structure can be freed.
+ * structure can be taken out of the table; it is freed once no thread
+ * in pid_wait is still looking at it (pi_waiters).
+ *
+ * Each pidinfo is on its parent's list of children (pi_children,
+ * linked through pi_nextsib/pi_prevsib) until the parent collects
+ * its exit status or disowns it.
  */
 struct pidinfo {
 	pid_t pi_pid;			// process id of this thread
 	pid_t pi_ppid;			// process id of parent thread
 	volatile bool pi_exited;	// true if thread has exited
 	int pi_exitstatus;		// status (only valid if exited)
-	struct cv *pi_cv;		// use to wait for thread exit
+	struct kusage pi_usage;		// usage incl. children (ditto)
+	struct spinlock pi_lock;	// protects the fields below
+	struct wchan *pi_wchan;		// use to wait for thread exit
+	unsigned pi_waiters;		// threads in pid_wait on this
+	bool pi_reaped;			// a waiter has claimed the status
+	bool pi_intable;		// still in pidinfo[]
+	struct pidinfo *pi_children;	// our children
+	struct pidinfo *pi_nextsib;	// next child of our parent
+	struct pidinfo **pi_prevsib;	// link pointing at us
 };
 
 
@@ -64,12 +77,25 @@ struct pidinfo {
  * Global pid and exit data.
  *
  * The process table is an el-cheapo hash table. It's indexed by
- * (pid % PROCS_MAX), and only allows one process per slot. If a
- * new pid allocation would cause a hash collision, we just don't
- * use that pid.
+ * (pid % PROCS_MAX), and only allows one process per slot. pidslots
+ * has a bit set for each slot in use; a new pid is found by looking
+ * for the next free slot after the last pid handed out (next fit)
+ * and taking the first pid at or after nextpid that hashes there.
+ *
+ * Locking: pidlock is a spinlock, and covers only the table itself
+ * (pidinfo[], pidslots, nextpid, nprocs). Everything about a
+ * particular process -- its exit status, pi_ppid, its waiters, and
+ * its list of children -- is under that process's pi_lock. Because
+ * parents find their children through their own list, pid_wait and
+ * exit never need pidlock except to take a dead process out of the
+ * table, and don't contend with forks elsewhere.
+ *
+ * Lock order: a parent's pi_lock, then a child's pi_lock, then
+ * pidlock.
  */
-static struct lock *pidlock;		// lock for global exit data
+static struct spinlock pidlock = SPINLOCK_INITIALIZER;
 static struct pidinfo *pidinfo[PROCS_MAX]; // actual pid info
+static struct bitmap *pidslots;		// pidinfo[] slots in use
 static pid_t nextpid;			// next candidate pid
 static int nprocs;			// number of allocated pids
 
@@ -84,23 +110,29 @@ pidinfo_create(pid_t pid, pid_t ppid)
 {
 	struct pidinfo *pi;
 
-	KASSERT(pid != INVALID_PID);
-
 	pi = kmalloc(sizeof(struct pidinfo));
 	if (pi==NULL) {
 		return NULL;
 	}
 
-	pi->pi_cv = cv_create("pidinfo cv");
-	if (pi->pi_cv == NULL) {
+	pi->pi_wchan = wchan_create("pidinfo");
+	if (pi->pi_wchan == NULL) {
 		kfree(pi);
 		return NULL;
 	}
+	spinlock_init(&pi->pi_lock);
 
 	pi->pi_pid = pid;
 	pi->pi_ppid = ppid;
 	pi->pi_exited = false;
 	pi->pi_exitstatus = 0xbeef;  /* Recognizably invalid value */
+	kusage_init(&pi->pi_usage);
+	pi->pi_waiters = 0;
+	pi->pi_reaped = false;
+	pi->pi_intable = false;
+	pi->pi_children = NULL;
+	pi->pi_nextsib = NULL;
+	pi->pi_prevsib = NULL;
 
 	return pi;
 }
@@ -114,10 +146,69 @@ pidinfo_destroy(struct pidinfo *pi)
 {
 	KASSERT(pi->pi_exited == true);
 	KASSERT(pi->pi_ppid == INVALID_PID);
-	cv_destroy(pi->pi_cv);
+	KASSERT(pi->pi_waiters == 0);
+	KASSERT(pi->pi_children == NULL);
+	KASSERT(pi->pi_prevsib == NULL);
+	spinlock_cleanup(&pi->pi_lock);
+	wchan_destroy(pi->pi_wchan);
 	kfree(pi);
 }
 
+/*
+ * Add CHILD to PARENT's list of children. PARENT must be locked.
+ */
+static
+void
+pi_addchild(struct pidinfo *parent, struct pidinfo *child)
+{
+	KASSERT(spinlock_do_i_hold(&parent->pi_lock));
+	KASSERT(child->pi_prevsib == NULL);
+
+	child->pi_nextsib = parent->pi_children;
+	if (child->pi_nextsib != NULL) {
+		child->pi_nextsib->pi_prevsib = &child->pi_nextsib;
+	}
+	child->pi_prevsib = &parent->pi_children;
+	parent->pi_children = child;
+}
+
+/*
+ * Take CHILD off its parent's list of children. The parent must be
+ * locked.
+ */
+static
+void
+pi_remchild(struct pidinfo *child)
+{
+	KASSERT(child->pi_prevsib != NULL);
+
+	*child->pi_prevsib = child->pi_nextsib;
+	if (child->pi_nextsib != NULL) {
+		child->pi_nextsib->pi_prevsib = child->pi_prevsib;
+	}
+	child->pi_nextsib = NULL;
+	child->pi_prevsib = NULL;
+}
+
+/*
+ * Find the child of PARENT with pid PID. PARENT must be locked.
+ */
+static
+struct pidinfo *
+pi_findchild(struct pidinfo *parent, pid_t pid)
+{
+	struct pidinfo *pi;
+
+	KASSERT(spinlock_do_i_hold(&parent->pi_lock));
+
+	for (pi = parent->pi_children; pi != NULL; pi = pi->pi_nextsib) {
+		if (pi->pi_pid == pid) {
+			return pi;
+		}
+	}
+	return NULL;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -128,9 +219,9 @@ pid_bootstrap(void)
 {
 	int i;
 
-	pidlock = lock_create("pidlock");
-	if (pidlock == NULL) {
-		panic("Out of memory creating pid lock\n");
+	pidslots = bitmap_create(PROCS_MAX);
+	if (pidslots == NULL) {
+		panic("Out of memory creating pid bitmap\n");
 	}
 
 	/* not really necessary - should start zeroed */
@@ -142,13 +233,18 @@ pid_bootstrap(void)
 	if (pidinfo[KERNEL_PID]==NULL) {
 		panic("Out of memory creating kernel pid data\n");
 	}
+	pidinfo[KERNEL_PID]->pi_intable = true;
+	bitmap_mark(pidslots, KERNEL_PID);
 
 	nextpid = PID_MIN;
 	nprocs = 1;
 }
 
 /*
- * pi_get: look up a pidinfo in the process table.
+ * pi_get: look up a pidinfo in the process table. pidlock must be
+ * held. The result is only good for as long as pidlock is held,
+ * unless the caller knows some other reason it can't go away (e.g.,
+ * it's the caller's own).
  */
 static
 struct pidinfo *
@@ -158,7 +254,7 @@ pi_get(pid_t pid)
 
 	KASSERT(pid>=0);
 	KASSERT(pid != INVALID_PID);
-	KASSERT(lock_do_i_hold(pidlock));
+	KASSERT(spinlock_do_i_hold(&pidlock));
 
 	pi = pidinfo[pid % PROCS_MAX];
 	if (pi==NULL) {
@@ -171,59 +267,99 @@ pi_get(pid_t pid)
 }
 
 /*
- * pi_put: insert a new pidinfo in the process table. The right slot
- * must be empty.
+ * pi_self: get the current process's pidinfo. It can't go away
+ * while we're running, so we can use it without pidlock.
  */
 static
-void
-pi_put(pid_t pid, struct pidinfo *pi)
+struct pidinfo *
+pi_self(void)
 {
-	KASSERT(lock_do_i_hold(pidlock));
+	struct pidinfo *pi;
 
-	KASSERT(pid != INVALID_PID);
+	KASSERT(curproc->p_pid != INVALID_PID);
 
-	KASSERT(pidinfo[pid % PROCS_MAX] == NULL);
-	pidinfo[pid % PROCS_MAX] = pi;
-	nprocs++;
+	spinlock_acquire(&pidlock);
+	pi = pi_get(curproc->p_pid);
+	spinlock_release(&pidlock);
+	KASSERT(pi != NULL);
+	return pi;
+}
+
+/*
+ * pi_exists: check whether PID is in the table at all. Only for
+ * deciding which error to return, since the answer can be stale
+ * immediately.
+ */
+static
+bool
+pi_exists(pid_t pid)
+{
+	bool ret;
+
+	spinlock_acquire(&pidlock);
+	ret = (pi_get(pid) != NULL);
+	spinlock_release(&pidlock);
+	return ret;
 }
 
 /*
  * pi_drop: remove a pidinfo structure from the process table and free
  * it. It should reflect a process that has already exited and been
- * waited for.
+ * waited for (or disowned), and be off its parent's list, so the
+ * caller has the only way to find it other than through the table.
+ *
+ * Other threads of the parent may still be in pid_wait holding a
+ * pointer to it (they lost the race to collect the status); in that
+ * case the last of them frees it instead.
  */
 static
 void
-pi_drop(pid_t pid)
+pi_drop(struct pidinfo *pi)
 {
-	struct pidinfo *pi;
+	unsigned slot;
+	bool destroy;
 
-	KASSERT(lock_do_i_hold(pidlock));
+	KASSERT(pi->pi_prevsib == NULL);
 
-	pi = pidinfo[pid % PROCS_MAX];
-	KASSERT(pi != NULL);
-	KASSERT(pi->pi_pid == pid);
+	slot = pi->pi_pid % PROCS_MAX;
 
-	pidinfo_destroy(pi);
-	pidinfo[pid % PROCS_MAX] = NULL;
+	spinlock_acquire(&pidlock);
+	KASSERT(pidinfo[slot] == pi);
+	pidinfo[slot] = NULL;
+	bitmap_unmark(pidslots, slot);
 	nprocs--;
+	spinlock_release(&pidlock);
+
+	spinlock_acquire(&pi->pi_lock);
+	pi->pi_intable = false;
+	destroy = (pi->pi_waiters == 0);
+	spinlock_release(&pi->pi_lock);
+
+	if (destroy) {
+		pidinfo_destroy(pi);
+	}
 }
 
 ////////////////////////////////////////////////////////////
 
 /*
- * Helper function for pid_alloc.
+ * The first pid at or after START (wrapping around from PID_MAX to
+ * PID_MIN) that lands in table slot SLOT.
  */
 static
-void
-inc_nextpid(void)
+pid_t
+pid_inslot(pid_t start, unsigned slot)
 {
-	KASSERT(lock_do_i_hold(pidlock));
+	pid_t pid;
 
-	nextpid++;
-	if (nextpid > PID_MAX) {
-		nextpid = PID_MIN;
+	pid = start + (slot + PROCS_MAX - start % PROCS_MAX) % PROCS_MAX;
+	if (pid > PID_MAX) {
+		pid = PID_MIN + (slot + PROCS_MAX - PID_MIN % PROCS_MAX)
+			% PROCS_MAX;
 	}
+	KASSERT(pid >= PID_MIN && pid <= PID_MAX);
+	KASSERT((unsigned)pid % PROCS_MAX == slot);
+	return pid;
 }
 
 /*
@@ -232,48 +368,49 @@ inc_nextpid(void)
 int
 pid_alloc(pid_t *retval)
 {
-	struct pidinfo *pi;
+	struct pidinfo *parent, *pi;
+	unsigned slot;
 	pid_t pid;
-	int count;
 
 	KASSERT(curproc->p_pid != INVALID_PID);
 
-	/* lock the table */
-	lock_acquire(pidlock);
+	parent = pi_self();
 
-	if (nprocs == PROCS_MAX) {
-		lock_release(pidlock);
-		return EAGAIN;
+	/* allocate first, so nothing below can fail for lack of memory */
+	pi = pidinfo_create(INVALID_PID, curproc->p_pid);
+	if (pi==NULL) {
+		return ENOMEM;
 	}
 
-	/*
-	 * The above test guarantees that this loop terminates, unless
-	 * our nprocs count is off. Even so, assert we aren't looping
-	 * forever.
-	 */
-	count = 0;
-	while (pidinfo[nextpid % PROCS_MAX] != NULL) {
-
-		/* avoid various boundary cases by allowing extra loops */
-		KASSERT(count < PROCS_MAX*2+5);
-		count++;
+	spinlock_acquire(&parent->pi_lock);
+	spinlock_acquire(&pidlock);
 
-		inc_nextpid();
+	if (nprocs == PROCS_MAX ||
+	    bitmap_alloc_next(pidslots, nextpid % PROCS_MAX, &slot)) {
+		spinlock_release(&pidlock);
+		spinlock_release(&parent->pi_lock);
+		pi->pi_exited = true;
+		pi->pi_ppid = INVALID_PID;
+		pidinfo_destroy(pi);
+		return EAGAIN;
 	}
 
-	pid = nextpid;
+	pid = pid_inslot(nextpid, slot);
+	KASSERT(pidinfo[slot] == NULL);
+	pi->pi_pid = pid;
+	pi->pi_intable = true;
+	pidinfo[slot] = pi;
+	nprocs++;
 
-	pi = pidinfo_create(pid, curproc->p_pid);
-	if (pi==NULL) {
-		lock_release(pidlock);
-		return ENOMEM;
+	nextpid = pid + 1;
+	if (nextpid > PID_MAX) {
+		nextpid = PID_MIN;
 	}
 
-	pi_put(pid, pi);
-
-	inc_nextpid();
+	spinlock_release(&pidlock);
 
-	lock_release(pidlock);
+	pi_addchild(parent, pi);
+	spinlock_release(&parent->pi_lock);
 
 	*retval = pid;
 	return 0;
@@ -286,25 +423,26 @@ pid_alloc(pid_t *retval)
 void
 pid_unalloc(pid_t theirpid)
 {
-	struct pidinfo *them;
+	struct pidinfo *us, *them;
 
 	KASSERT(theirpid >= PID_MIN && theirpid <= PID_MAX);
 
-	lock_acquire(pidlock);
+	us = pi_self();
 
-	them = pi_get(theirpid);
+	spinlock_acquire(&us->pi_lock);
+	them = pi_findchild(us, theirpid);
 	KASSERT(them != NULL);
 	KASSERT(them->pi_exited == false);
 	KASSERT(them->pi_ppid == curproc->p_pid);
+	pi_remchild(them);
+	spinlock_release(&us->pi_lock);
 
 	/* keep pidinfo_destroy from complaining */
 	them->pi_exitstatus = 0xdead;
 	them->pi_exited = true;
 	them->pi_ppid = INVALID_PID;
 
-	pi_drop(theirpid);
-
-	lock_release(pidlock);
+	pi_drop(them);
 }
 
 /*
@@ -314,71 +452,94 @@ pid_unalloc(pid_t theirpid)
 void
 pid_disown(pid_t theirpid)
 {
-	struct pidinfo *them;
+	struct pidinfo *us, *them;
+	bool dead;
 
 	KASSERT(theirpid >= PID_MIN && theirpid <= PID_MAX);
 
-	lock_acquire(pidlock);
+	us = pi_self();
 
-	them = pi_get(theirpid);
+	spinlock_acquire(&us->pi_lock);
+	them = pi_findchild(us, theirpid);
 	KASSERT(them != NULL);
-	KASSERT(them->pi_ppid==curproc->p_pid);
+	pi_remchild(them);
 
+	spinlock_acquire(&them->pi_lock);
+	KASSERT(them->pi_ppid==curproc->p_pid);
 	them->pi_ppid = INVALID_PID;
-	if (them->pi_exited) {
-		pi_drop(them->pi_pid);
-	}
+	dead = them->pi_exited;
+	spinlock_release(&them->pi_lock);
 
-	lock_release(pidlock);
+	spinlock_release(&us->pi_lock);
+
+	if (dead) {
+		pi_drop(them);
+	}
 }
 
 /*
- * pid_setexitstatus: Sets the exit status of this process. Must only
- * be called if the thread actually had a pid assigned. Wakes up any
- * waiters and disposes of the piddata if nobody else is still using it.
+ * pid_setexitstatus: Sets the exit status of process PID. Must only
+ * be called for a process that actually had a pid assigned, by the
+ * last thread leaving it. Wakes up any waiters and disposes of the
+ * piddata if nobody else is still using it.
  *
  * As far as the process is concerned, this releases its pid for
- * subsequent reuse; thus we set curproc->p_pid to INVALID_PID.
+ * subsequent reuse; the caller should set its p_pid to INVALID_PID.
+ * (The caller has usually already detached from the process, so this
+ * can't use curproc.)
  */
 void
-pid_setexitstatus(int status)
+pid_setexitstatus(pid_t pid, int status, const struct kusage *usage)
 {
-	struct pidinfo *us;
-	int i;
+	struct pidinfo *us, *kid, *dead;
+	bool orphan;
 
-	lock_acquire(pidlock);
-	KASSERT(curproc->p_pid != INVALID_PID);
+	KASSERT(pid != INVALID_PID);
 
-	/* First, disown all children */
-	for (i=0; i<PROCS_MAX; i++) {
-		if (pidinfo[i]==NULL) {
-			continue;
-		}
-		if (pidinfo[i]->pi_ppid == curproc->p_pid) {
-			pidinfo[i]->pi_ppid = INVALID_PID;
-			if (pidinfo[i]->pi_exited) {
-				pi_drop(pidinfo[i]->pi_pid);
-			}
+	spinlock_acquire(&pidlock);
+	us = pi_get(pid);
+	spinlock_release(&pidlock);
+	KASSERT(us != NULL);
+
+	spinlock_acquire(&us->pi_lock);
+
+	/*
+	 * First, disown all children. Ones that have already exited
+	 * are collected on the dead list (reusing the sibling links)
+	 * to be dropped once we've let go of the locks.
+	 */
+	dead = NULL;
+	while ((kid = us->pi_children) != NULL) {
+		pi_remchild(kid);
+		spinlock_acquire(&kid->pi_lock);
+		kid->pi_ppid = INVALID_PID;
+		if (kid->pi_exited) {
+			kid->pi_nextsib = dead;
+			dead = kid;
 		}
+		spinlock_release(&kid->pi_lock);
 	}
 
 	/* Now, wake up our parent */
-	us = pi_get(curproc->p_pid);
-	KASSERT(us != NULL);
-
 	us->pi_exitstatus = status;
+	us->pi_usage = *usage;
 	us->pi_exited = true;
+	orphan = (us->pi_ppid == INVALID_PID);
+	wchan_wakeall(us->pi_wchan, &us->pi_lock);
 
-	if (us->pi_ppid == INVALID_PID) {
-		/* no parent */
-		pi_drop(curproc->p_pid);
-	}
-	else {
-		cv_broadcast(us->pi_cv, pidlock);
+	spinlock_release(&us->pi_lock);
+
+	while (dead != NULL) {
+		kid = dead;
+		dead = kid->pi_nextsib;
+		kid->pi_nextsib = NULL;
+		pi_drop(kid);
 	}
 
-	curproc->p_pid = INVALID_PID;
-	lock_release(pidlock);
+	if (orphan) {
+		/* no parent */
+		pi_drop(us);
+	}
 }
 
 /*
@@ -392,7 +553,9 @@ pid_setexitstatus(int status)
 int
 pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 {
-	struct pidinfo *them;
+	struct pidinfo *us, *them;
+	struct kusage usage;
+	bool destroy;
 
 	KASSERT(curproc->p_pid != INVALID_PID);
 
@@ -415,37 +578,67 @@ pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 		return EINVAL;
 	}
 
-	lock_acquire(pidlock);
+	us = pi_self();
 
-	them = pi_get(theirpid);
-	if (them==NULL) {
-		lock_release(pidlock);
-		return ESRCH;
+	/*
+	 * Only allow waiting for own children, which are exactly the
+	 * ones on our list. We may be several threads, so register as
+	 * a waiter before letting go of our list; that keeps the
+	 * pidinfo from being freed under us if another of our threads
+	 * collects the status first.
+	 */
+	spinlock_acquire(&us->pi_lock);
+	them = pi_findchild(us, theirpid);
+	if (them == NULL) {
+		spinlock_release(&us->pi_lock);
+		return pi_exists(theirpid) ? EPERM : ESRCH;
 	}
-
-	KASSERT(them->pi_pid==theirpid);
-
-	/* Only allow waiting for own children. */
-	if (them->pi_ppid != curproc->p_pid) {
-		lock_release(pidlock);
-		return EPERM;
+	spinlock_acquire(&them->pi_lock);
+	them->pi_waiters++;
+	spinlock_release(&us->pi_lock);
+
+	if (them->pi_exited == false && flags == WNOHANG) {
+		them->pi_waiters--;
+		spinlock_release(&them->pi_lock);
+		KASSERT(ret != NULL);
+		*ret = 0;
+		return 0;
+	}
+	while (them->pi_exited == false && !curproc->p_exiting) {
+		wchan_sleep(them->pi_wchan, &them->pi_lock);
 	}
+	them->pi_waiters--;
 
+	/*
+	 * If another of our threads called _exit, give up so this
+	 * one can leave too (see pid_wakeall).
+	 */
 	if (them->pi_exited == false) {
-		if (flags == WNOHANG) {
-			lock_release(pidlock);
-			KASSERT(ret != NULL);
-			*ret = 0;
-			return 0;
+		spinlock_release(&them->pi_lock);
+		return EINTR;
+	}
+
+	/*
+	 * Only one waiter gets the status. The rest leave here
+	 * without touching anything else, so a crowd woken by the
+	 * exit doesn't all queue up on our lock just to find nothing
+	 * there. (The same goes if another thread disowned it while
+	 * we were waiting.)
+	 */
+	if (them->pi_reaped || them->pi_ppid != curproc->p_pid) {
+		destroy = (them->pi_waiters == 0 && !them->pi_intable);
+		spinlock_release(&them->pi_lock);
+		if (destroy) {
+			pidinfo_destroy(them);
 		}
-		/* don't need to loop on this */
-		cv_wait(them->pi_cv, pidlock);
-		KASSERT(them->pi_exited == true);
+		return ESRCH;
 	}
+	them->pi_reaped = true;
 
 	if (status != NULL) {
 		*status = them->pi_exitstatus;
 	}
+	usage = them->pi_usage;
 	if (ret != NULL) {
 		/*
 		 * In Unix you can wait for any of several possible
@@ -456,10 +649,39 @@ pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 		 */
 		*ret = theirpid;
 	}
+	spinlock_release(&them->pi_lock);
 
-	them->pi_ppid = 0;
-	pi_drop(them->pi_pid);
+	/* Take it off our list (in lock order) and get rid of it. */
+	spinlock_acquire(&us->pi_lock);
+	pi_remchild(them);
+	spinlock_acquire(&them->pi_lock);
+	them->pi_ppid = INVALID_PID;
+	spinlock_release(&them->pi_lock);
+	spinlock_release(&us->pi_lock);
+
+	pi_drop(them);
 
-	lock_release(pidlock);
+	proc_addchildusage(curproc, &usage);
 	return 0;
 }
+
+/*
+ * Wake any of our threads sleeping in pid_wait. Used when the process
+ * is exiting; the caller sets p_exiting first so they give up instead
+ * of going back to sleep.
+ */
+void
+pid_wakeall(void)
+{
+	struct pidinfo *us, *them;
+
+	us = pi_self();
+
+	spinlock_acquire(&us->pi_lock);
+	for (them = us->pi_children; them != NULL; them = them->pi_nextsib) {
+		spinlock_acquire(&them->pi_lock);
+		wchan_wakeall(them->pi_wchan, &them->pi_lock);
+		spinlock_release(&them->pi_lock);
+	}
+	spinlock_release(&us->pi_lock);
+}
@@ -38,26 +38,46 @@
  * things they point to. Rearrange this (and/or change it to be a
  * regular lock) as needed.
  *
- * Unless you're implementing multithreaded user processes, the only
- * process that will have more than one thread is the kernel process.
+ * User processes can have several threads (see thread_create). They
+ * share the address space and file table; the process goes away when
+ * the last of them leaves, in proc_threadexit.
+ *
+ * Every process except kproc is also on the allprocs array, so the
+ * kernel menu can list them. (kproc is made in proc_bootstrap, before
+ * there's a curthread to take allprocs_lock with; since it never goes
+ * away, proc_printall just lists it first.)
  */
 
+#define PROCINLINE
+
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/wait.h>
+#include <lib.h>
+#include <clock.h>
 #include <spl.h>
 #include <synch.h>
+#include <wchan.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <pid.h>
 #include <filetable.h>
+#include <futex.h>
+#include <pipe.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
+/*
+ * All processes, for proc_printall.
+ */
+static struct procarray allprocs;
+static struct lock *allprocs_lock;
+
 /*
  * Create a proc structure.
  */
@@ -66,6 +86,7 @@ struct proc *
 proc_create(const char *name)
 {
 	struct proc *proc;
+	int result;
 
 	proc = kmalloc(sizeof(*proc));
 	if (proc == NULL) {
@@ -83,6 +104,13 @@ proc_create(const char *name)
 		kfree(proc);
 		return NULL;
 	}
+	proc->p_uthreadwchan = wchan_create("p_uthreads");
+	if (proc->p_uthreadwchan == NULL) {
+		lock_destroy(proc->p_threadslock);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
 	threadarray_init(&proc->p_threads);
 
 	spinlock_init(&proc->p_lock);
@@ -95,6 +123,37 @@ proc_create(const char *name)
 	proc->p_cwd = NULL;
 	proc->p_filetable = NULL;
 
+	/* user threads */
+	proc->p_nuthreads = 0;
+	proc->p_tidsused = 0;
+	proc->p_tidsdone = 0;
+	proc->p_exiting = false;
+	proc->p_exitstatus = 0;
+
+	proc->p_vforkdone = NULL;
+
+	/* resource usage */
+	kusage_init(&proc->p_usage);
+	kusage_init(&proc->p_cusage);
+
+	if (kproc == NULL) {
+		/* this is kproc; see above */
+		return proc;
+	}
+
+	lock_acquire(allprocs_lock);
+	result = procarray_add(&allprocs, proc, NULL);
+	lock_release(allprocs_lock);
+	if (result) {
+		spinlock_cleanup(&proc->p_lock);
+		threadarray_cleanup(&proc->p_threads);
+		wchan_destroy(proc->p_uthreadwchan);
+		lock_destroy(proc->p_threadslock);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
+
 	return proc;
 }
 
@@ -107,6 +166,8 @@ proc_create(const char *name)
 void
 proc_destroy(struct proc *proc)
 {
+	unsigned num, i;
+
 	/*
 	 * You probably want to destroy and null out much of the
 	 * process (particularly the address space) at exit time if
@@ -118,6 +179,18 @@ proc_destroy(struct proc *proc)
 	KASSERT(proc != NULL);
 	KASSERT(proc != kproc);
 
+	/* Take it off the list first, so nobody can look at it any more. */
+	lock_acquire(allprocs_lock);
+	num = procarray_num(&allprocs);
+	for (i=0; i<num; i++) {
+		if (procarray_get(&allprocs, i) == proc) {
+			procarray_remove(&allprocs, i);
+			break;
+		}
+	}
+	KASSERT(i < num);
+	lock_release(allprocs_lock);
+
 	/*
 	 * We don't take p_lock in here because we must have the only
 	 * reference to this structure. (Otherwise it would be
@@ -185,6 +258,7 @@ proc_destroy(struct proc *proc)
 	KASSERT(proc->p_pid == INVALID_PID);
 	spinlock_cleanup(&proc->p_lock);
 	threadarray_cleanup(&proc->p_threads);
+	wchan_destroy(proc->p_uthreadwchan);
 	lock_destroy(proc->p_threadslock);
 
 	kfree(proc->p_name);
@@ -197,6 +271,12 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+	allprocs_lock = lock_create("allprocs");
+	if (allprocs_lock == NULL) {
+		panic("lock_create for allprocs failed\n");
+	}
+	procarray_init(&allprocs);
+
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
@@ -234,6 +314,10 @@ proc_create_runprogram(const char *name, struct proc **ret)
 
 	newproc->p_addrspace = NULL;
 
+	/* The thread runprogram forks into us is thread 0 */
+	newproc->p_nuthreads = 1;
+	newproc->p_tidsused = PROC_TIDBIT(0);
+
 	/* VFS fields */
 
 	/*
@@ -259,11 +343,15 @@ proc_create_runprogram(const char *name, struct proc **ret)
  * is not null. (If RET is null, what we're creating is a kernel-only
  * thread and it doesn't need an address space or file handles.)
  * However, the new thread always inherits its current working
- * directory from the caller. The new thread is given no address space
- * (the caller decides that).
+ * directory from the caller.
+ *
+ * The new process gets a copy of the caller's address space, or with
+ * VFORKDONE set, the caller's address space itself. The latter is for
+ * vfork: the caller must then not touch its address space until the
+ * child is done with it and V's VFORKDONE (see proc_vforkdone).
  */
 int
-proc_fork(struct proc **ret)
+proc_fork(struct semaphore *vforkdone, struct proc **ret)
 {
 	struct proc *newproc;
 	struct addrspace *as;
@@ -293,7 +381,11 @@ proc_fork(struct proc **ret)
 
 	/* VM fields */
 	as = proc_getas();
-	if (as != NULL) {
+	if (as != NULL && vforkdone != NULL) {
+		newproc->p_addrspace = as;
+		newproc->p_vforkdone = vforkdone;
+	}
+	else if (as != NULL) {
 		result = as_copy(as, &newproc->p_addrspace);
 		if (result) {
 			pid_unalloc(newproc->p_pid);
@@ -303,13 +395,23 @@ proc_fork(struct proc **ret)
 		}
 	}
 
+	/*
+	 * Only the calling thread is copied. It keeps its thread id,
+	 * since that says which stack slot it is running on.
+	 */
+	newproc->p_nuthreads = 1;
+	newproc->p_tidsused = PROC_TIDBIT(curthread->t_tid);
+
 	/* VFS fields */
 	tbl = curproc->p_filetable;
 	if (tbl != NULL) {
 		result = filetable_copy(tbl, &newproc->p_filetable);
 		if (result) {
-			as_destroy(newproc->p_addrspace);
+			if (newproc->p_vforkdone == NULL) {
+				as_destroy(newproc->p_addrspace);
+			}
 			newproc->p_addrspace = NULL;
+			newproc->p_vforkdone = NULL;
 			pid_unalloc(newproc->p_pid);
 			newproc->p_pid = INVALID_PID;
 			proc_destroy(newproc);
@@ -339,6 +441,11 @@ proc_fork(struct proc **ret)
 void
 proc_unfork(struct proc *newproc)
 {
+	if (newproc->p_vforkdone != NULL) {
+		/* not ours to destroy */
+		newproc->p_addrspace = NULL;
+		newproc->p_vforkdone = NULL;
+	}
 	pid_unalloc(newproc->p_pid);
 	newproc->p_pid = INVALID_PID;
 	proc_destroy(newproc);
@@ -346,32 +453,136 @@ proc_unfork(struct proc *newproc)
 
 /*
  * Make the current process exit.
+ *
+ * If there are other threads, they are told to leave (they notice on
+ * their way back to user mode; see mips_trap) and the last one out
+ * reports STATUS. The first exit status recorded wins. Any that are
+ * asleep somewhere that might never wake them on its own (futex_wait,
+ * waitpid, a pipe, the console) or only much later (nanosleep) are
+ * woken, and give up with EINTR when they see p_exiting.
  */
 void
 proc_exit(int status)
 {
 	struct proc *proc = curproc;
+	bool others;
 
 	/* The kernel isn't supposed to exit. */
 	KASSERT(proc != kproc);
 
-	/* Set exit status and wake up anyone waiting for us. */
-	pid_setexitstatus(status);
+	spinlock_acquire(&proc->p_lock);
+	if (!proc->p_exiting) {
+		proc->p_exiting = true;
+		proc->p_exitstatus = status;
+	}
+	others = proc->p_nuthreads > 1;
+	spinlock_release(&proc->p_lock);
+
+	if (others) {
+		/*
+		 * Get them moving. (If we're a vfork child, anyone
+		 * asleep in futex_wait is the parent's and nothing to
+		 * do with us.)
+		 */
+		if (proc->p_addrspace != NULL && proc->p_vforkdone == NULL) {
+			futex_wakeall(proc->p_addrspace);
+		}
+		pid_wakeall();
+		pipe_wakeall();
+		getch_wakeall();
+		clocknap_wakeall();
+	}
+
+	proc_threadexit(NULL);
+}
+
+/*
+ * Make the current thread leave its process. The last thread to
+ * leave makes the process exit: with the _exit status if someone
+ * called _exit, otherwise with status 0.
+ */
+void
+proc_threadexit(userptr_t retval)
+{
+	struct proc *proc = curproc;
+	unsigned tid = curthread->t_tid;
+	struct kusage usage;
+	bool last;
+	int status;
+
+	/* The kernel isn't supposed to exit. */
+	KASSERT(proc != kproc);
+	KASSERT(tid < PROC_MAXUTHREADS);
 
 	/* Detach from the process and attach to the kernel process. */
 	KASSERT(curthread->t_proc == proc);
 	proc_remthread(curthread);
 	proc_addthread(kproc, curthread);
 
-	/* There should be no threads left in the target process. */
-	KASSERT(threadarray_num(&proc->p_threads) == 0);
+	/*
+	 * Now check out. Once we drop p_lock we must not touch the
+	 * process again unless we were the last thread, because the
+	 * last thread destroys it.
+	 */
+	spinlock_acquire(&proc->p_lock);
+	KASSERT(proc->p_nuthreads > 0);
+	proc->p_nuthreads--;
+	last = (proc->p_nuthreads == 0);
+	proc->p_uthreadret[tid] = retval;
+	proc->p_tidsdone |= PROC_TIDBIT(tid);
+	wchan_wakeall(proc->p_uthreadwchan, &proc->p_lock);
+	status = proc->p_exiting ? proc->p_exitstatus : _MKWAIT_EXIT(0);
+	if (last) {
+		/* all our threads have folded their usage in by now */
+		usage = proc->p_usage;
+		kusage_add(&usage, &proc->p_cusage);
+	}
+	spinlock_release(&proc->p_lock);
+
+	if (last) {
+		/* Set exit status and wake up anyone waiting for us. */
+		pid_setexitstatus(proc->p_pid, status, &usage);
+		proc->p_pid = INVALID_PID;
+
+		/* There should be no threads left in the target process. */
+		KASSERT(threadarray_num(&proc->p_threads) == 0);
+
+		/*
+		 * We're no longer curproc, so proc_destroy won't
+		 * unload the address space from this cpu for us.
+		 */
+		as_deactivate();
 
-	/* Now we can destroy the process. */
-	proc_destroy(proc);
+		/* If we were vforked and never exec'd, let the parent go. */
+		if (proc->p_vforkdone != NULL) {
+			proc->p_addrspace = NULL;
+			proc_vforkdone(proc);
+		}
+
+		/* Now we can destroy the process. */
+		proc_destroy(proc);
+	}
 
 	thread_exit();
 }
 
+/*
+ * A vforked process is finished with its parent's address space: it
+ * has switched to a new one in execv, or has dropped it on the way
+ * out. The caller has already taken it out of p_addrspace. Wake the
+ * parent, which is waiting in sys_vfork.
+ */
+void
+proc_vforkdone(struct proc *proc)
+{
+	struct semaphore *sem;
+
+	sem = proc->p_vforkdone;
+	KASSERT(sem != NULL);
+	proc->p_vforkdone = NULL;
+	V(sem);
+}
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
@@ -428,6 +639,13 @@ proc_remthread(struct thread *t)
 	for (i=0; i<num; i++) {
 		if (threadarray_get(&proc->p_threads, i) == t) {
 			threadarray_remove(&proc->p_threads, i);
+
+			/* The process keeps what the thread used. */
+			spinlock_acquire(&proc->p_lock);
+			kusage_add(&proc->p_usage, &t->t_usage);
+			spinlock_release(&proc->p_lock);
+			kusage_init(&t->t_usage);
+
 			lock_release(proc->p_threadslock);
 			goto finish;
 		}
@@ -445,10 +663,10 @@ finish:
 /*
  * Fetch the address space of (the current) process.
  *
- * Caution: address spaces aren't refcounted. If you implement
- * multithreaded processes, make sure to set up a refcount scheme or
- * some other method to make this safe. Otherwise the returned address
- * space might disappear under you.
+ * Address spaces aren't refcounted. This is safe with multithreaded
+ * processes because the address space is only replaced by execv,
+ * which refuses to run while other threads exist, and only destroyed
+ * by the last thread out of the process.
  */
 struct addrspace *
 proc_getas(void)
@@ -484,3 +702,105 @@ proc_setas(struct addrspace *newas)
 	spinlock_release(&proc->p_lock);
 	return oldas;
 }
+
+/*
+ * Get the resource usage of PROC itself (the threads that have left
+ * plus the ones still there), or of the children it has collected.
+ */
+int
+proc_getusage(struct proc *proc, int who, struct kusage *ret)
+{
+	struct thread *t;
+	unsigned num, i;
+
+	switch (who) {
+	    case RUSAGE_SELF:
+		lock_acquire(proc->p_threadslock);
+		spinlock_acquire(&proc->p_lock);
+		*ret = proc->p_usage;
+		spinlock_release(&proc->p_lock);
+		num = threadarray_num(&proc->p_threads);
+		for (i=0; i<num; i++) {
+			t = threadarray_get(&proc->p_threads, i);
+			kusage_add(ret, &t->t_usage);
+		}
+		lock_release(proc->p_threadslock);
+		break;
+	    case RUSAGE_CHILDREN:
+		spinlock_acquire(&proc->p_lock);
+		*ret = proc->p_cusage;
+		spinlock_release(&proc->p_lock);
+		break;
+	    default:
+		return EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * Add the usage of a child PROC has collected with pid_wait.
+ */
+void
+proc_addchildusage(struct proc *proc, const struct kusage *ku)
+{
+	spinlock_acquire(&proc->p_lock);
+	kusage_add(&proc->p_cusage, ku);
+	spinlock_release(&proc->p_lock);
+}
+
+/*
+ * Print a time in hardclocks as seconds.
+ */
+static
+void
+proc_printticks(uint32_t ticks)
+{
+	kprintf(" %4u.%02u", ticks / HZ, (ticks % HZ) * 100 / HZ);
+}
+
+/*
+ * Print one line of proc_printall.
+ */
+static
+void
+proc_printone(struct proc *proc)
+{
+	struct kusage ku;
+	unsigned nthreads;
+
+	proc_getusage(proc, RUSAGE_SELF, &ku);
+
+	lock_acquire(proc->p_threadslock);
+	nthreads = threadarray_num(&proc->p_threads);
+	lock_release(proc->p_threadslock);
+
+	kprintf("%5d %3u", proc->p_pid, nthreads);
+	proc_printticks(ku.ku_uticks);
+	proc_printticks(ku.ku_sticks);
+	kprintf(" %5u %5u %5u %5u %5u %5u %5u %5u %s\n",
+		ku.ku_rfaults, ku.ku_wfaults, ku.ku_mfaults,
+		ku.ku_cowcopies, ku.ku_inblock, ku.ku_oublock,
+		ku.ku_nvcsw, ku.ku_nivcsw, proc->p_name);
+}
+
+/*
+ * List all processes with their resource usage.
+ */
+void
+proc_printall(void)
+{
+	unsigned num, i;
+
+	kprintf("  PID THR   UTIME   STIME  RFLT  WFLT  MFLT   COW"
+		" INBLK OUBLK  VCSW IVCSW NAME\n");
+
+	/* kproc isn't on allprocs */
+	proc_printone(kproc);
+
+	lock_acquire(allprocs_lock);
+	num = procarray_num(&allprocs);
+	for (i=0; i<num; i++) {
+		proc_printone(procarray_get(&allprocs, i));
+	}
+	lock_release(allprocs_lock);
+}
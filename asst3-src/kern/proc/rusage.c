@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Resource usage records. See <rusage.h>.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <rusage.h>
+
+void
+kusage_init(struct kusage *ku)
+{
+	bzero(ku, sizeof(*ku));
+}
+
+void
+kusage_add(struct kusage *to, const struct kusage *from)
+{
+	to->ku_uticks += from->ku_uticks;
+	to->ku_sticks += from->ku_sticks;
+	to->ku_rfaults += from->ku_rfaults;
+	to->ku_wfaults += from->ku_wfaults;
+	to->ku_mfaults += from->ku_mfaults;
+	to->ku_cowcopies += from->ku_cowcopies;
+	to->ku_inblock += from->ku_inblock;
+	to->ku_oublock += from->ku_oublock;
+	to->ku_nvcsw += from->ku_nvcsw;
+	to->ku_nivcsw += from->ku_nivcsw;
+}
+
+/*
+ * Turn a count of hardclocks into a timeval.
+ */
+static
+void
+ticks_totimeval(uint32_t ticks, struct timeval *tv)
+{
+	tv->tv_sec = ticks / HZ;
+	tv->tv_usec = (ticks % HZ) * (1000000 / HZ);
+}
+
+void
+kusage_torusage(const struct kusage *ku, struct rusage *ru)
+{
+	bzero(ru, sizeof(*ru));
+	ticks_totimeval(ku->ku_uticks, &ru->ru_utime);
+	ticks_totimeval(ku->ku_sticks, &ru->ru_stime);
+	/* Nothing is paged in from disk, so every fault is minor. */
+	ru->ru_minflt = ku->ku_rfaults + ku->ku_wfaults + ku->ku_mfaults;
+	ru->ru_majflt = 0;
+	ru->ru_inblock = ku->ku_inblock;
+	ru->ru_oublock = ku->ku_oublock;
+	ru->ru_nvcsw = ku->ku_nvcsw;
+	ru->ru_nivcsw = ku->ku_nivcsw;
+}
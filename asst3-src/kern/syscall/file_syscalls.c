@@ -37,6 +37,7 @@
 #include <kern/limits.h>
 #include <kern/seek.h>
 #include <kern/stat.h>
+#include <limits.h>
 #include <lib.h>
 #include <uio.h>
 #include <proc.h>
@@ -45,10 +46,15 @@
 #include <copyinout.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <vm.h>
 #include <openfile.h>
 #include <filetable.h>
+#include <pipe.h>
 #include <syscall.h>
 
+/* Most we'll move in one call: the return value is a signed int. */
+#define RW_MAXBYTES	((size_t)0x7fffffff)
+
 /*
  * open() - get the path with copyinstr, then use openfile_open and
  * filetable_place to do the real work.
@@ -105,20 +111,22 @@ sys_open(const_userptr_t upath, int flags, mode_t mode, int *retval)
 }
 
 /*
- * Common logic for read and write.
+ * Common logic for read, write, readv, and writev.
  *
- * Look up the fd, then use VOP_READ or VOP_WRITE.
+ * Look up the fd, then use VOP_READ or VOP_WRITE on the uio, which
+ * the caller has set up except for the offset. It may have any number
+ * of iovecs; the filesystems move data with uiomove, which walks
+ * them, so one VOP call handles the lot.
  */
 static
 int
-sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
-	      int badaccmode, ssize_t *retval)
+sys_readwrite_uio(int fd, struct uio *useruio, int badaccmode,
+		  ssize_t *retval)
 {
 	struct openfile *file;
 	bool locked;
 	off_t pos;
-	struct iovec iov;
-	struct uio useruio;
+	size_t size;
 	int result;
 
 	/* better be a valid file descriptor */
@@ -142,20 +150,21 @@ sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
 		goto fail;
 	}
 
-	/* set up a uio with the buffer, its size, and the current offset */
-	uio_uinit(&iov, &useruio, buf, size, pos, rw);
+	/* start at the current offset */
+	useruio->uio_offset = pos;
+	size = useruio->uio_resid;
 
 	/* do the read or write */
-	result = (rw == UIO_READ) ?
-		VOP_READ(file->of_vnode, &useruio) :
-		VOP_WRITE(file->of_vnode, &useruio);
+	result = (useruio->uio_rw == UIO_READ) ?
+		VOP_READ(file->of_vnode, useruio) :
+		VOP_WRITE(file->of_vnode, useruio);
 	if (result) {
 		goto fail;
 	}
 
 	if (locked) {
 		/* set the offset to the updated offset in the uio */
-		file->of_offset = useruio.uio_offset;
+		file->of_offset = useruio->uio_offset;
 		lock_release(file->of_offsetlock);
 	}
 
@@ -165,7 +174,7 @@ sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
 	 * The amount read (or written) is the original buffer size,
 	 * minus how much is left in it.
 	 */
-	*retval = size - useruio.uio_resid;
+	*retval = size - useruio->uio_resid;
 
 	return 0;
 
@@ -177,6 +186,78 @@ fail:
 	return result;
 }
 
+/*
+ * read and write: set up a uio with the buffer and its size.
+ */
+static
+int
+sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
+	      int badaccmode, ssize_t *retval)
+{
+	struct iovec iov;
+	struct uio useruio;
+
+	/* the offset gets filled in by sys_readwrite_uio */
+	uio_uinit(&iov, &useruio, buf, size, 0, rw);
+
+	return sys_readwrite_uio(fd, &useruio, badaccmode, retval);
+}
+
+/*
+ * readv and writev: copy in the iovec array and set up a uio with all
+ * of it, so that the whole transfer is one VOP call.
+ */
+static
+int
+sys_readwritev(int fd, const_userptr_t uiov, int iovcnt, enum uio_rw rw,
+	       int badaccmode, ssize_t *retval)
+{
+	struct iovec *iov;
+	struct uio useruio;
+	size_t total;
+	int i, result;
+
+	if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+		return EINVAL;
+	}
+
+	iov = kmalloc(iovcnt * sizeof(struct iovec));
+	if (iov == NULL) {
+		return ENOMEM;
+	}
+
+	result = copyin(uiov, iov, iovcnt * sizeof(struct iovec));
+	if (result) {
+		kfree(iov);
+		return result;
+	}
+
+	/*
+	 * The total has to fit in the (signed) return value. The
+	 * buffers themselves get checked as uiomove gets to them.
+	 */
+	total = 0;
+	for (i=0; i<iovcnt; i++) {
+		if (iov[i].iov_len > RW_MAXBYTES - total) {
+			kfree(iov);
+			return EINVAL;
+		}
+		total += iov[i].iov_len;
+	}
+
+	useruio.uio_iov = iov;
+	useruio.uio_iovcnt = iovcnt;
+	useruio.uio_offset = 0;
+	useruio.uio_resid = total;
+	useruio.uio_segflg = UIO_USERSPACE;
+	useruio.uio_rw = rw;
+	useruio.uio_space = proc_getas();
+
+	result = sys_readwrite_uio(fd, &useruio, badaccmode, retval);
+	kfree(iov);
+	return result;
+}
+
 /*
  * read() - use sys_readwrite
  */
@@ -195,6 +276,260 @@ sys_write(int fd, userptr_t buf, size_t size, int *retval)
 	return sys_readwrite(fd, buf, size, UIO_WRITE, O_RDONLY, retval);
 }
 
+/*
+ * readv() - use sys_readwritev
+ */
+int
+sys_readv(int fd, const_userptr_t iov, int iovcnt, int *retval)
+{
+	return sys_readwritev(fd, iov, iovcnt, UIO_READ, O_WRONLY, retval);
+}
+
+/*
+ * writev() - use sys_readwritev
+ */
+int
+sys_writev(int fd, const_userptr_t iov, int iovcnt, int *retval)
+{
+	return sys_readwritev(fd, iov, iovcnt, UIO_WRITE, O_RDONLY, retval);
+}
+
+/*
+ * Common logic for pread and pwrite.
+ *
+ * Like sys_readwrite, but the position comes from the caller and the
+ * seek position in the openfile is neither used nor changed; so we
+ * don't take of_offsetlock at all, and several processes or threads
+ * sharing one openfile can do I/O at different places in it at once.
+ */
+static
+int
+sys_preadwrite(int fd, userptr_t buf, size_t size, off_t pos,
+	       enum uio_rw rw, int badaccmode, ssize_t *retval)
+{
+	struct openfile *file;
+	struct iovec iov;
+	struct uio useruio;
+	int result;
+
+	result = filetable_get(curproc->p_filetable, fd, &file);
+	if (result) {
+		return result;
+	}
+
+	/* a position only makes sense for something we could seek on */
+	if (!VOP_ISSEEKABLE(file->of_vnode)) {
+		filetable_put(curproc->p_filetable, fd, file);
+		return ESPIPE;
+	}
+
+	if (pos < 0) {
+		filetable_put(curproc->p_filetable, fd, file);
+		return EINVAL;
+	}
+
+	if (file->of_accmode == badaccmode) {
+		filetable_put(curproc->p_filetable, fd, file);
+		return EBADF;
+	}
+
+	uio_uinit(&iov, &useruio, buf, size, pos, rw);
+
+	result = (rw == UIO_READ) ?
+		VOP_READ(file->of_vnode, &useruio) :
+		VOP_WRITE(file->of_vnode, &useruio);
+
+	filetable_put(curproc->p_filetable, fd, file);
+
+	if (result) {
+		return result;
+	}
+
+	*retval = size - useruio.uio_resid;
+	return 0;
+}
+
+/*
+ * pread() - use sys_preadwrite
+ */
+int
+sys_pread(int fd, userptr_t buf, size_t size, off_t pos, int *retval)
+{
+	return sys_preadwrite(fd, buf, size, pos, UIO_READ, O_WRONLY, retval);
+}
+
+/*
+ * pwrite() - use sys_preadwrite
+ */
+int
+sys_pwrite(int fd, userptr_t buf, size_t size, off_t pos, int *retval)
+{
+	return sys_preadwrite(fd, buf, size, pos, UIO_WRITE, O_RDONLY,
+			      retval);
+}
+
+/*
+ * Lock the seek position of FILE if it has one, and return it.
+ */
+static
+off_t
+copy_lockpos(struct openfile *file)
+{
+	if (!VOP_ISSEEKABLE(file->of_vnode)) {
+		return 0;
+	}
+	lock_acquire(file->of_offsetlock);
+	return file->of_offset;
+}
+
+/*
+ * Store POS as the seek position of FILE (if it has one) and unlock.
+ */
+static
+void
+copy_unlockpos(struct openfile *file, off_t pos)
+{
+	if (!VOP_ISSEEKABLE(file->of_vnode)) {
+		return;
+	}
+	file->of_offset = pos;
+	lock_release(file->of_offsetlock);
+}
+
+/*
+ * copy_file_range() - copy up to LEN bytes from INFD to OUTFD.
+ *
+ * This does what a read/write loop in userland would, using and
+ * updating the seek positions of both files, but the data goes
+ * through a kernel buffer and never crosses into userspace: one trap
+ * and one copy per chunk instead of two of each.
+ *
+ * Both seek positions are locked for the whole copy, like read and
+ * write lock theirs. To keep two copies in opposite directions from
+ * deadlocking, the locks are always taken in address order. Copying
+ * a file handle to itself isn't allowed.
+ *
+ * The input must be seekable (ESPIPE otherwise): if the output takes
+ * less than was read, the rest is left to be read again by backing
+ * the input position up, which can't be done to a pipe or device.
+ *
+ * Stops at EOF on the input. If something goes wrong after some data
+ * has been copied, returns the amount copied, like a short write; if
+ * the output takes nothing at all without saying why, that's EIO, so
+ * it can't be mistaken for EOF.
+ */
+int
+sys_copy_file_range(int infd, int outfd, size_t len, int *retval)
+{
+	struct openfile *infile, *outfile;
+	off_t inpos, outpos;
+	char *buf;
+	struct iovec iov;
+	struct uio ku;
+	size_t done, chunk, got, put;
+	int result;
+
+	if (len > RW_MAXBYTES) {
+		len = RW_MAXBYTES;
+	}
+
+	buf = kmalloc(PAGE_SIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	result = filetable_get(curproc->p_filetable, infd, &infile);
+	if (result) {
+		kfree(buf);
+		return result;
+	}
+	result = filetable_get(curproc->p_filetable, outfd, &outfile);
+	if (result) {
+		filetable_put(curproc->p_filetable, infd, infile);
+		kfree(buf);
+		return result;
+	}
+
+	if (infile->of_accmode == O_WRONLY ||
+	    outfile->of_accmode == O_RDONLY) {
+		result = EBADF;
+		goto out;
+	}
+	if (infile == outfile) {
+		result = EINVAL;
+		goto out;
+	}
+	if (!VOP_ISSEEKABLE(infile->of_vnode)) {
+		result = ESPIPE;
+		goto out;
+	}
+
+	if (infile < outfile) {
+		inpos = copy_lockpos(infile);
+		outpos = copy_lockpos(outfile);
+	}
+	else {
+		outpos = copy_lockpos(outfile);
+		inpos = copy_lockpos(infile);
+	}
+
+	done = 0;
+	while (done < len) {
+		chunk = len - done;
+		if (chunk > PAGE_SIZE) {
+			chunk = PAGE_SIZE;
+		}
+
+		uio_kinit(&iov, &ku, buf, chunk, inpos, UIO_READ);
+		result = VOP_READ(infile->of_vnode, &ku);
+		if (result) {
+			break;
+		}
+		got = chunk - ku.uio_resid;
+		if (got == 0) {
+			/* EOF */
+			break;
+		}
+		inpos = ku.uio_offset;
+
+		uio_kinit(&iov, &ku, buf, got, outpos, UIO_WRITE);
+		result = VOP_WRITE(outfile->of_vnode, &ku);
+		put = got - ku.uio_resid;
+		outpos = ku.uio_offset;
+		done += put;
+		if (put < got) {
+			/*
+			 * Short write (or an error part way). Back the
+			 * input up over what we didn't write so the
+			 * positions stay in step.
+			 */
+			inpos -= got - put;
+			if (put == 0 && result == 0) {
+				result = EIO;
+			}
+			break;
+		}
+		if (result) {
+			break;
+		}
+	}
+
+	copy_unlockpos(infile, inpos);
+	copy_unlockpos(outfile, outpos);
+
+	if (done > 0) {
+		/* report the partial copy; the error can come next time */
+		result = 0;
+	}
+	*retval = done;
+
+ out:
+	filetable_put(curproc->p_filetable, outfd, outfile);
+	filetable_put(curproc->p_filetable, infd, infile);
+	kfree(buf);
+	return result;
+}
+
 /*
  * close() - remove from the file table.
  */
@@ -203,6 +538,7 @@ sys_close(int fd)
 {
 	struct filetable *ft;
 	struct openfile *file;
+	int result;
 
 	ft = curproc->p_filetable;
 
@@ -211,8 +547,12 @@ sys_close(int fd)
 		return EBADF;
 	}
 
-	/* place null in the filetable and get the file previously there */
-	filetable_placeat(ft, NULL, fd, &file);
+	/*
+	 * place null in the filetable and get the file previously there
+	 * (placing null doesn't fail)
+	 */
+	result = filetable_placeat(ft, NULL, fd, &file);
+	KASSERT(result == 0);
 
 	if (file == NULL) {
 		/* oops, it wasn't open, that's an error */
@@ -321,7 +661,11 @@ sys_dup2(int oldfd, int newfd, int *retval)
 	filetable_put(ft, oldfd, oldfdfile);
 
 	/* place it */
-	filetable_placeat(ft, oldfdfile, newfd, &newfdfile);
+	result = filetable_placeat(ft, oldfdfile, newfd, &newfdfile);
+	if (result) {
+		openfile_decref(oldfdfile);
+		return result;
+	}
 
 	/* if there was a file already there, drop that reference */
 	if (newfdfile != NULL) {
@@ -333,6 +677,71 @@ sys_dup2(int oldfd, int newfd, int *retval)
 	return 0;
 }
 
+/*
+ * pipe() - make a pipe and put both ends in the file table.
+ */
+int
+sys_pipe(userptr_t fdsptr, int *retval)
+{
+	struct filetable *ft;
+	struct vnode *readvn, *writevn;
+	struct openfile *readfile, *writefile, *oldfile;
+	int fds[2];
+	int result;
+
+	ft = curproc->p_filetable;
+
+	result = pipe_create(&readvn, &writevn);
+	if (result) {
+		return result;
+	}
+
+	result = openfile_fromvnode(readvn, O_RDONLY, &readfile);
+	if (result) {
+		vfs_close(readvn);
+		vfs_close(writevn);
+		return result;
+	}
+	result = openfile_fromvnode(writevn, O_WRONLY, &writefile);
+	if (result) {
+		openfile_decref(readfile);
+		vfs_close(writevn);
+		return result;
+	}
+
+	result = filetable_place(ft, readfile, &fds[0]);
+	if (result) {
+		openfile_decref(readfile);
+		openfile_decref(writefile);
+		return result;
+	}
+	result = filetable_place(ft, writefile, &fds[1]);
+	if (result) {
+		openfile_decref(writefile);
+		goto fail;
+	}
+
+	result = copyout(fds, fdsptr, sizeof(fds));
+	if (result) {
+		filetable_placeat(ft, NULL, fds[1], &oldfile);
+		if (oldfile != NULL) {
+			openfile_decref(oldfile);
+		}
+		goto fail;
+	}
+
+	*retval = 0;
+	return 0;
+
+ fail:
+	/* placing NULL doesn't fail */
+	filetable_placeat(ft, NULL, fds[0], &oldfile);
+	if (oldfile != NULL) {
+		openfile_decref(oldfile);
+	}
+	return result;
+}
+
 /*
  * chdir() - change directory. Send the path off to the vfs layer.
  */
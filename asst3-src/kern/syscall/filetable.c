@@ -34,18 +34,124 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <bitmap.h>
 #include <openfile.h>
 #include <filetable.h>
 
 
 /*
- * Construct a filetable.
+ * Allocate the slot array and bitmap for a table of SIZE slots.
+ */
+static
+int
+filetable_alloc(unsigned size, struct openfile ***slots_ret,
+		struct bitmap **inuse_ret)
+{
+	struct openfile **slots;
+	struct bitmap *inuse;
+	unsigned fd;
+
+	KASSERT(size % 8 == 0);
+	KASSERT(size <= OPEN_MAX);
+
+	slots = kmalloc(size * sizeof(struct openfile *));
+	if (slots == NULL) {
+		return ENOMEM;
+	}
+	inuse = bitmap_create(size);
+	if (inuse == NULL) {
+		kfree(slots);
+		return ENOMEM;
+	}
+	for (fd = 0; fd < size; fd++) {
+		slots[fd] = NULL;
+	}
+
+	*slots_ret = slots;
+	*inuse_ret = inuse;
+	return 0;
+}
+
+/*
+ * Pick a table size that has room for slot FD.
+ */
+static
+unsigned
+filetable_sizefor(unsigned fd)
+{
+	unsigned size;
+
+	KASSERT(fd < OPEN_MAX);
+
+	size = FILETABLE_MINSIZE;
+	while (size <= fd) {
+		size *= 2;
+	}
+	return size < OPEN_MAX ? size : OPEN_MAX;
+}
+
+/*
+ * Make the table big enough to have slot FD.
+ *
+ * The new array is allocated without holding ft_lock; if someone else
+ * resized the table in the meantime we throw ours away and let the
+ * caller look again. Either way, the caller must recheck the size.
+ */
+static
+int
+filetable_grow(struct filetable *ft, unsigned fd)
+{
+	struct openfile **slots, **oldslots;
+	struct bitmap *inuse, *oldinuse;
+	unsigned size, oldsize;
+	int result;
+
+	spinlock_acquire(&ft->ft_lock);
+	oldsize = ft->ft_size;
+	spinlock_release(&ft->ft_lock);
+
+	if (fd < oldsize) {
+		return 0;
+	}
+
+	size = filetable_sizefor(fd);
+	result = filetable_alloc(size, &slots, &inuse);
+	if (result) {
+		return result;
+	}
+
+	spinlock_acquire(&ft->ft_lock);
+	if (ft->ft_size != oldsize) {
+		/* lost the race; use theirs */
+		spinlock_release(&ft->ft_lock);
+		kfree(slots);
+		bitmap_destroy(inuse);
+		return 0;
+	}
+	memcpy(slots, ft->ft_openfiles, oldsize * sizeof(struct openfile *));
+	/* both sizes are multiples of 8, so the bytes line up */
+	memcpy(bitmap_getdata(inuse), bitmap_getdata(ft->ft_inuse),
+	       oldsize / 8);
+	oldslots = ft->ft_openfiles;
+	oldinuse = ft->ft_inuse;
+	ft->ft_openfiles = slots;
+	ft->ft_inuse = inuse;
+	ft->ft_size = size;
+	spinlock_release(&ft->ft_lock);
+
+	kfree(oldslots);
+	bitmap_destroy(oldinuse);
+	return 0;
+}
+
+/*
+ * Construct a filetable of the given size.
  */
+static
 struct filetable *
-filetable_create(void)
+filetable_create_sized(unsigned size)
 {
 	struct filetable *ft;
-	int fd;
 
 	ft = kmalloc(sizeof(struct filetable));
 	if (ft == NULL) {
@@ -53,30 +159,47 @@ filetable_create(void)
 	}
 
 	/* the table starts empty */
-	for (fd = 0; fd < OPEN_MAX; fd++) {
-		ft->ft_openfiles[fd] = NULL;
+	if (filetable_alloc(size, &ft->ft_openfiles, &ft->ft_inuse)) {
+		kfree(ft);
+		return NULL;
 	}
+	ft->ft_size = size;
+	ft->ft_top = 0;
+
+	spinlock_init(&ft->ft_lock);
 
 	return ft;
 }
 
+/*
+ * Construct a filetable.
+ */
+struct filetable *
+filetable_create(void)
+{
+	return filetable_create_sized(FILETABLE_MINSIZE);
+}
+
 /*
  * Destroy a filetable.
  */
 void
 filetable_destroy(struct filetable *ft)
 {
-	int fd;
+	unsigned fd;
 
 	KASSERT(ft != NULL);
 
-	/* Close any open files. */
-	for (fd = 0; fd < OPEN_MAX; fd++) {
+	/* Close any open files. Nothing is open at or past ft_top. */
+	for (fd = 0; fd < ft->ft_top; fd++) {
 		if (ft->ft_openfiles[fd] != NULL) {
 			openfile_decref(ft->ft_openfiles[fd]);
 			ft->ft_openfiles[fd] = NULL;
 		}
 	}
+	spinlock_cleanup(&ft->ft_lock);
+	bitmap_destroy(ft->ft_inuse);
+	kfree(ft->ft_openfiles);
 	kfree(ft);
 }
 
@@ -94,13 +217,16 @@ filetable_destroy(struct filetable *ft)
  *
  * produce the intended output instead of having the second echo
  * command overwrite the first.
+ *
+ * The copy is only as big as it needs to be to hold the slots in use
+ * in the source, and only that range is looked at.
  */
 int
 filetable_copy(struct filetable *src, struct filetable **dest_ret)
 {
 	struct filetable *dest;
 	struct openfile *file;
-	int fd;
+	unsigned fd, top;
 
 	/* Copying the nonexistent table avoids special cases elsewhere */
 	if (src == NULL) {
@@ -108,19 +234,38 @@ filetable_copy(struct filetable *src, struct filetable **dest_ret)
 		return 0;
 	}
 
-	dest = filetable_create();
-	if (dest == NULL) {
-		return ENOMEM;
+	spinlock_acquire(&src->ft_lock);
+	top = src->ft_top;
+	spinlock_release(&src->ft_lock);
+
+	while (1) {
+		dest = filetable_create_sized(
+			top == 0 ? FILETABLE_MINSIZE : filetable_sizefor(top - 1));
+		if (dest == NULL) {
+			return ENOMEM;
+		}
+
+		spinlock_acquire(&src->ft_lock);
+		if (src->ft_top <= dest->ft_size) {
+			break;
+		}
+		/* another thread opened something further up; retry */
+		top = src->ft_top;
+		spinlock_release(&src->ft_lock);
+		filetable_destroy(dest);
 	}
 
 	/* share the entries */
-	for (fd = 0; fd < OPEN_MAX; fd++) {
+	for (fd = 0; fd < src->ft_top; fd++) {
 		file = src->ft_openfiles[fd];
 		if (file != NULL) {
 			openfile_incref(file);
+			bitmap_mark(dest->ft_inuse, fd);
 		}
 		dest->ft_openfiles[fd] = file;
 	}
+	dest->ft_top = src->ft_top;
+	spinlock_release(&src->ft_lock);
 
 	*dest_ret = dest;
 	return 0;
@@ -128,11 +273,13 @@ filetable_copy(struct filetable *src, struct filetable **dest_ret)
 
 /*
  * Check if a file handle is in range.
+ *
+ * This is the range of file handles the table can hold, not the
+ * range it currently has room for; the table grows as needed.
  */
 bool
 filetable_okfd(struct filetable *ft, int fd)
 {
-	/* We have a fixed-size table so we don't need to check the size */
 	(void)ft;
 
 	return (fd >= 0 && fd < OPEN_MAX);
@@ -145,6 +292,10 @@ filetable_okfd(struct filetable *ft, int fd)
  * This checks that the file handle is in range and fails rather than
  * returning a null openfile; it only yields files that are actually
  * open.
+ *
+ * The caller gets a reference to the openfile, so it stays valid
+ * even if another thread closes or dup2s over the file handle before
+ * the matching filetable_put.
  */
 int
 filetable_get(struct filetable *ft, int fd, struct openfile **ret)
@@ -155,36 +306,74 @@ filetable_get(struct filetable *ft, int fd, struct openfile **ret)
 		return EBADF;
 	}
 
+	spinlock_acquire(&ft->ft_lock);
+	if ((unsigned)fd >= ft->ft_top) {
+		spinlock_release(&ft->ft_lock);
+		return EBADF;
+	}
 	file = ft->ft_openfiles[fd];
 	if (file == NULL) {
+		spinlock_release(&ft->ft_lock);
 		return EBADF;
 	}
+	openfile_incref(file);
+	spinlock_release(&ft->ft_lock);
 
 	*ret = file;
 	return 0;
 }
 
 /*
- * Put a file handle back when done with it. This does not actually do
- * anything (other than crosscheck) but it's always good practice to
- * build things so when you take them out you put them back again
- * rather than dropping them on the floor. Then if you need to do
- * something at cleanup time you can put it in this function instead
- * of having to hunt for all the places to insert the new logic.
+ * Put a file handle back when done with it. This drops the reference
+ * taken by filetable_get; if the file handle was closed in the
+ * meantime, this may be the last reference and close the file.
  *
- * (For example, if you have multithreaded processes you will need to
- * insert additional lock and/or refcount manipulations here and in
- * filetable_get.)
- *
- * The openfile should be the one returned from filetable_get. If you
- * want to manipulate the table so the assertion's no longer true, get
- * your own reference to the openfile (with openfile_incref) and call
- * filetable_put before mucking about.
+ * The openfile should be the one returned from filetable_get. It is
+ * not necessarily still in the table at FD: another thread may have
+ * changed the slot. If you want to keep the openfile past the put,
+ * get your own reference to it with openfile_incref first.
  */
 void
 filetable_put(struct filetable *ft, int fd, struct openfile *file)
 {
-	KASSERT(ft->ft_openfiles[fd] == file);
+	(void)ft;
+	(void)fd;
+
+	openfile_decref(file);
+}
+
+/*
+ * Set slot FD to FILE, keeping the bitmap and ft_top in step.
+ * Returns the file previously there. Call with ft_lock held.
+ */
+static
+struct openfile *
+filetable_setslot(struct filetable *ft, unsigned fd, struct openfile *file)
+{
+	struct openfile *oldfile;
+
+	KASSERT(spinlock_do_i_hold(&ft->ft_lock));
+	KASSERT(fd < ft->ft_size);
+
+	oldfile = ft->ft_openfiles[fd];
+	ft->ft_openfiles[fd] = file;
+
+	if (file != NULL) {
+		if (oldfile == NULL) {
+			bitmap_mark(ft->ft_inuse, fd);
+		}
+		if (fd >= ft->ft_top) {
+			ft->ft_top = fd + 1;
+		}
+	}
+	else if (oldfile != NULL) {
+		bitmap_unmark(ft->ft_inuse, fd);
+		while (ft->ft_top > 0 &&
+		       ft->ft_openfiles[ft->ft_top - 1] == NULL) {
+			ft->ft_top--;
+		}
+	}
+	return oldfile;
 }
 
 /*
@@ -194,23 +383,42 @@ filetable_put(struct filetable *ft, int fd, struct openfile *file)
  * the behavior had to be defined explicitly in order to allow
  * manipulating stdin/stdout/stderr.)
  *
+ * If the table is full, it's grown (unless it's already at OPEN_MAX)
+ * and we look again.
+ *
  * Consumes a reference to the openfile object. (That reference is
  * placed in the table.)
  */
 int
 filetable_place(struct filetable *ft, struct openfile *file, int *fd_ret)
 {
-	int fd;
+	unsigned fd, size;
+	int result;
 
-	for (fd = 0; fd < OPEN_MAX; fd++) {
-		if (ft->ft_openfiles[fd] == NULL) {
+	while (1) {
+		spinlock_acquire(&ft->ft_lock);
+		if (bitmap_alloc(ft->ft_inuse, &fd) == 0) {
+			/* bitmap_alloc marked it for us */
+			KASSERT(ft->ft_openfiles[fd] == NULL);
 			ft->ft_openfiles[fd] = file;
+			if (fd >= ft->ft_top) {
+				ft->ft_top = fd + 1;
+			}
+			spinlock_release(&ft->ft_lock);
 			*fd_ret = fd;
 			return 0;
 		}
-	}
+		size = ft->ft_size;
+		spinlock_release(&ft->ft_lock);
 
-	return EMFILE;
+		if (size >= OPEN_MAX) {
+			return EMFILE;
+		}
+		result = filetable_grow(ft, size);
+		if (result) {
+			return result;
+		}
+	}
 }
 
 /*
@@ -219,19 +427,37 @@ filetable_place(struct filetable *ft, struct openfile *file, int *fd_ret)
  *
  * Consumes a reference to the passed-in openfile object; returns a
  * reference to the old openfile object (if not NULL); this should
- * generally be decref'd.
+ * generally be decref'd. On failure, the passed-in reference is not
+ * consumed.
  *
- * Doesn't fail.
- *
- * Note that you can use this to place NULL in the filetable, which is
- * potentially handy.
+ * Fails only if the table needs to grow and we can't get memory for
+ * it. Placing NULL (which is potentially handy) doesn't fail: if the
+ * slot is past the end of the table, there's nothing there already.
  */
-void
+int
 filetable_placeat(struct filetable *ft, struct openfile *newfile, int fd,
 		  struct openfile **oldfile_ret)
 {
+	int result;
+
 	KASSERT(filetable_okfd(ft, fd));
 
-	*oldfile_ret = ft->ft_openfiles[fd];
-	ft->ft_openfiles[fd] = newfile;
+	while (1) {
+		spinlock_acquire(&ft->ft_lock);
+		if ((unsigned)fd < ft->ft_size) {
+			*oldfile_ret = filetable_setslot(ft, fd, newfile);
+			spinlock_release(&ft->ft_lock);
+			return 0;
+		}
+		spinlock_release(&ft->ft_lock);
+
+		if (newfile == NULL) {
+			*oldfile_ret = NULL;
+			return 0;
+		}
+		result = filetable_grow(ft, fd);
+		if (result) {
+			return result;
+		}
+	}
 }
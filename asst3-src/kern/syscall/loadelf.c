@@ -57,6 +57,7 @@
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
+#include <vm.h>
 #include <vnode.h>
 #include <elf.h>
 
@@ -147,6 +148,63 @@ load_segment(struct addrspace *as, struct vnode *v,
 	return result;
 }
 
+#if !OPT_DUMBVM
+/*
+ * Load a read-only executable segment, as load_segment does, but map
+ * each page from the text cache instead of reading it into a page of
+ * our own, so every process running the program shares the frames.
+ *
+ * Pages past FILESIZE are left alone; they're zero-fill on demand
+ * like any other. A page some other segment has already loaded into
+ * (badly linked executables only) is read in privately instead.
+ */
+static
+int
+load_textsegment(struct addrspace *as, struct vnode *v,
+		 off_t offset, vaddr_t vaddr,
+		 size_t memsize, size_t filesize)
+{
+	vaddr_t va, end;
+	size_t len;
+	int result;
+
+	if (filesize > memsize) {
+		kprintf("ELF: warning: segment filesize > segment memsize\n");
+		filesize = memsize;
+	}
+
+	/* We don't go through uiomove, so check the addresses here. */
+	end = vaddr + filesize;
+	if (end < vaddr || end > USERSPACETOP) {
+		return EFAULT;
+	}
+
+	DEBUG(DB_EXEC, "ELF: Mapping %lu shared bytes at 0x%lx\n",
+	      (unsigned long) filesize, (unsigned long) vaddr);
+
+	for (va = vaddr; va < end; va += len) {
+		len = ((va & PAGE_FRAME) + PAGE_SIZE) - va;
+		if (len > end - va) {
+			len = end - va;
+		}
+
+		if (page_table_get(as->page_table, va / PAGE_SIZE)
+		    != PAGE_TABLE_UNUSED) {
+			result = load_segment(as, v, offset + (va - vaddr),
+					      va, len, len, 1);
+		}
+		else {
+			result = textcache_map(as, v, offset + (va - vaddr),
+					       va, len);
+		}
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+#endif
+
 /*
  * Load an ELF executable user program into the current address space.
  *
@@ -290,9 +348,22 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+#if !OPT_DUMBVM
+		if ((ph.p_flags & (PF_W | PF_X)) == PF_X) {
+			result = load_textsegment(as, v, ph.p_offset,
+						  ph.p_vaddr, ph.p_memsz,
+						  ph.p_filesz);
+		}
+		else {
+			result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
+					      ph.p_memsz, ph.p_filesz,
+					      ph.p_flags & PF_X);
+		}
+#else
 		result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
 				      ph.p_memsz, ph.p_filesz,
 				      ph.p_flags & PF_X);
+#endif
 		if (result) {
 			return result;
 		}
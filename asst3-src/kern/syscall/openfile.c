@@ -38,6 +38,8 @@
 #include <synch.h>
 #include <vfs.h>
 #include <openfile.h>
+#include <vm.h>
+#include "opt-dumbvm.h"
 
 /*
  * Constructor for struct openfile.
@@ -70,6 +72,7 @@ openfile_create(struct vnode *vn, int accmode)
 	file->of_accmode = accmode;
 	file->of_offset = 0;
 	file->of_refcount = 1;
+	file->of_writer = false;
 
 	return file;
 }
@@ -82,6 +85,12 @@ static
 void
 openfile_destroy(struct openfile *file)
 {
+#if !OPT_DUMBVM
+	if (file->of_writer) {
+		textcache_remwriter(file->of_vnode);
+	}
+#endif
+
 	/* balance vfs_open with vfs_close (not VOP_DECREF) */
 	vfs_close(file->of_vnode);
 
@@ -112,6 +121,34 @@ openfile_open(char *filename, int openflags, mode_t mode,
 		return ENOMEM;
 	}
 
+#if !OPT_DUMBVM
+	/* keep the text cache away from it while it can be written */
+	if (file->of_accmode != O_RDONLY) {
+		textcache_addwriter(vn);
+		file->of_writer = true;
+	}
+#endif
+
+	*ret = file;
+	return 0;
+}
+
+/*
+ * Wrap a vnode that didn't come from vfs_open (such as one end of a
+ * pipe) in an openfile object. On success this takes over the
+ * caller's reference to the vnode, which gets dropped with vfs_close
+ * like any other.
+ */
+int
+openfile_fromvnode(struct vnode *vn, int accmode, struct openfile **ret)
+{
+	struct openfile *file;
+
+	file = openfile_create(vn, accmode);
+	if (file == NULL) {
+		return ENOMEM;
+	}
+
 	*ret = file;
 	return 0;
 }
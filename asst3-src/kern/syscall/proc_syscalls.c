@@ -37,6 +37,7 @@
 #include <lib.h>
 #include <machine/trapframe.h>
 #include <clock.h>
+#include <synch.h>
 #include <thread.h>
 #include <proc.h>
 #include <current.h>
@@ -58,6 +59,25 @@ sys_getpid(pid_t *retval)
 	return 0;
 }
 
+/*
+ * sys_getrusage
+ * the process code keeps the counts; convert them for userland.
+ */
+int
+sys_getrusage(int who, userptr_t usage)
+{
+	struct kusage ku;
+	struct rusage ru;
+	int result;
+
+	result = proc_getusage(curproc, who, &ku);
+	if (result) {
+		return result;
+	}
+	kusage_torusage(&ku, &ru);
+	return copyout(&ru, usage, sizeof(ru));
+}
+
 /*
  * sys__exit()
  *
@@ -81,12 +101,13 @@ sys__exit(int status)
 
 static
 void
-fork_newthread(void *vtf, unsigned long junk)
+fork_newthread(void *vtf, unsigned long tid)
 {
 	struct trapframe mytf;
 	struct trapframe *ntf = vtf;
 
-	(void)junk;
+	/* Keep the thread id we were forked from; see proc_fork. */
+	curthread->t_tid = tid;
 
 	/*
 	 * Now copy the trapframe to our stack, so we can free the one
@@ -100,8 +121,12 @@ fork_newthread(void *vtf, unsigned long junk)
 	enter_forked_process(&mytf);
 }
 
+/*
+ * Common code for fork and vfork.
+ */
+static
 int
-sys_fork(struct trapframe *tf, pid_t *retval)
+dofork(struct trapframe *tf, struct semaphore *vforkdone, pid_t *retval)
 {
 	struct trapframe *ntf;
 	int result;
@@ -119,7 +144,7 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	}
 	*ntf = *tf;
 
-	result = proc_fork(&newproc);
+	result = proc_fork(vforkdone, &newproc);
 	if (result) {
 		kfree(ntf);
 		return result;
@@ -127,7 +152,7 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	*retval = newproc->p_pid;
 
 	result = thread_fork(curthread->t_name, newproc,
-			     fork_newthread, ntf, 0);
+			     fork_newthread, ntf, curthread->t_tid);
 	if (result) {
 		proc_unfork(newproc);
 		kfree(ntf);
@@ -137,6 +162,48 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	return 0;
 }
 
+int
+sys_fork(struct trapframe *tf, pid_t *retval)
+{
+	return dofork(tf, NULL, retval);
+}
+
+/*
+ * sys_vfork
+ *
+ * Like fork, except that the child runs in our address space rather
+ * than a copy of it, and we wait here until it gives it back by
+ * calling execv or exiting. So fork-then-exec costs the same however
+ * big the parent is. The usual vfork rules apply to the child: it
+ * mustn't return from the function that called vfork, or change
+ * anything the parent will look at afterwards.
+ *
+ * If we have other threads they would go on running in the address
+ * space the child is using, so in that case this is just fork.
+ */
+int
+sys_vfork(struct trapframe *tf, pid_t *retval)
+{
+	struct semaphore *done;
+	int result;
+
+	if (curproc->p_nuthreads > 1) {
+		return dofork(tf, NULL, retval);
+	}
+
+	done = sem_create("vfork", 0);
+	if (done == NULL) {
+		return ENOMEM;
+	}
+
+	result = dofork(tf, done, retval);
+	if (result == 0) {
+		P(done);
+	}
+	sem_destroy(done);
+	return result;
+}
+
 /*
  * sys_waitpid
  * just pass off the work to the pid code.
@@ -55,22 +55,52 @@
  *
  * This is an abstraction that holds an argv while it's being shuffled
  * through the kernel during exec.
+ *
+ * The argv is staged in whole pages, already laid out the way it will
+ * appear at the top of the new process's stack: the strings, padding
+ * to pointer alignment, then the argv array with its ending NULL.
+ * Once the new address space exists, the pages are mapped straight
+ * into its stack (see argbuf_install) instead of being copied out
+ * again, and the argv pointers, which until then hold offsets from
+ * the start of the staging area, are relocated to user addresses.
+ *
+ * The pages don't have to be contiguous in the kernel; a string may
+ * run from one page onto the next.
+ *
+ * The strings may total ARG_MAX bytes; as each is at least one byte
+ * long, that bounds the argv array too.
  */
+#define ARGBUF_MAXBYTES \
+	(ARG_MAX + sizeof(userptr_t) + (ARG_MAX + 1) * sizeof(userptr_t))
+#define ARGBUF_MAXPAGES DIVROUNDUP(ARGBUF_MAXBYTES, PAGE_SIZE)
+
 struct argbuf {
-	char *data;
-	size_t len;
-	size_t max;
+	vaddr_t pages[ARGBUF_MAXPAGES];	/* staged pages, or 0 once handed off */
+	unsigned npages;
+	unsigned reserved;	/* pages taken from the exec budget */
+	size_t len;		/* bytes staged so far */
+	size_t strlen;		/* bytes of strings (before the argv array) */
+	size_t argvoff;		/* offset of the argv array */
 	int nargs;
-	bool tooksem;
+	userptr_t uargv;	/* argv's user address, once installed */
 };
 
 /*
- * Throttle to limit the number of processes in exec at once. Or,
- * rather, the number trying to use large exec buffers at once. See
- * design notes for the rationale.
+ * Most of the staging area is taken from a memory budget, so that
+ * many execs can be in flight at once while their argvs together
+ * can't exhaust memory. The first page of each argv is free; an exec
+ * that needs more reserves enough for the largest possible argv in
+ * one go, waiting if need be, and gives back what it didn't use once
+ * the argv is complete. Because the only wait happens while holding
+ * nothing from the budget, execs can't deadlock against each other.
+ *
+ * The budget is a fraction of physical memory, but always at least
+ * enough for one maximum-size argv.
  */
-#define EXEC_BIGBUF_THROTTLE	1
-static struct semaphore *execthrottle;
+#define EXEC_BUDGET_FRACTION	16
+static struct lock *execbudget_lock;
+static struct cv *execbudget_cv;
+static unsigned execbudget;		/* pages available */
 
 /*
  * Set things up.
@@ -78,10 +108,50 @@ static struct semaphore *execthrottle;
 void
 exec_bootstrap(void)
 {
-	execthrottle = sem_create("exec", EXEC_BIGBUF_THROTTLE);
-	if (execthrottle == NULL) {
-		panic("Cannot create exec throttle semaphore\n");
+	execbudget_lock = lock_create("execbudget");
+	if (execbudget_lock == NULL) {
+		panic("Cannot create exec budget lock\n");
+	}
+	execbudget_cv = cv_create("execbudget");
+	if (execbudget_cv == NULL) {
+		panic("Cannot create exec budget cv\n");
+	}
+
+	execbudget = ram_getsize() / PAGE_SIZE / EXEC_BUDGET_FRACTION;
+	if (execbudget < ARGBUF_MAXPAGES - 1) {
+		execbudget = ARGBUF_MAXPAGES - 1;
+	}
+}
+
+/*
+ * Take NPAGES from the exec budget, waiting until they're available.
+ */
+static
+void
+execbudget_reserve(unsigned npages)
+{
+	lock_acquire(execbudget_lock);
+	while (execbudget < npages) {
+		cv_wait(execbudget_cv, execbudget_lock);
 	}
+	execbudget -= npages;
+	lock_release(execbudget_lock);
+}
+
+/*
+ * Give NPAGES back to the exec budget.
+ */
+static
+void
+execbudget_release(unsigned npages)
+{
+	if (npages == 0) {
+		return;
+	}
+	lock_acquire(execbudget_lock);
+	execbudget += npages;
+	cv_broadcast(execbudget_cv, execbudget_lock);
+	lock_release(execbudget_lock);
 }
 
 /*
@@ -91,45 +161,205 @@ static
 void
 argbuf_init(struct argbuf *buf)
 {
-	buf->data = NULL;
+	unsigned i;
+
+	for (i=0; i<ARGBUF_MAXPAGES; i++) {
+		buf->pages[i] = 0;
+	}
+	buf->npages = 0;
+	buf->reserved = 0;
 	buf->len = 0;
-	buf->max = 0;
+	buf->strlen = 0;
+	buf->argvoff = 0;
 	buf->nargs = 0;
-	buf->tooksem = false;
+	buf->uargv = NULL;
 }
 
 /*
- * Clean up an argv buffer when done.
+ * Clean up an argv buffer when done. Pages that were handed to an
+ * address space belong to it now and aren't freed here.
  */
 static
 void
 argbuf_cleanup(struct argbuf *buf)
 {
-	if (buf->data != NULL) {
-		kfree(buf->data);
-		buf->data = NULL;
+	unsigned i;
+
+	for (i=0; i<buf->npages; i++) {
+		if (buf->pages[i] != 0) {
+			free_kpages(buf->pages[i]);
+			buf->pages[i] = 0;
+		}
 	}
+	buf->npages = 0;
 	buf->len = 0;
-	buf->max = 0;
+	buf->strlen = 0;
+	buf->argvoff = 0;
 	buf->nargs = 0;
-	if (buf->tooksem) {
-		V(execthrottle);
-		buf->tooksem = false;
-	}
+	buf->uargv = NULL;
+	execbudget_release(buf->reserved);
+	buf->reserved = 0;
 }
 
 /*
- * Allocate the memory for an argv buffer.
+ * Add another page to an argv buffer.
  */
 static
 int
-argbuf_allocate(struct argbuf *buf, size_t size)
+argbuf_grow(struct argbuf *buf)
 {
-	buf->data = kmalloc(size);
-	if (buf->data == NULL) {
+	vaddr_t page;
+
+	if (buf->npages == ARGBUF_MAXPAGES) {
+		return E2BIG;
+	}
+	if (buf->npages > 0 && buf->reserved == 0) {
+		execbudget_reserve(ARGBUF_MAXPAGES - 1);
+		buf->reserved = ARGBUF_MAXPAGES - 1;
+	}
+	KASSERT(buf->npages == 0 || buf->npages <= buf->reserved);
+
+	page = alloc_kpages(1);
+	if (page == 0) {
 		return ENOMEM;
 	}
-	buf->max = size;
+	buf->pages[buf->npages++] = page;
+	return 0;
+}
+
+/*
+ * Return the kernel address of offset OFFSET in the staging area.
+ */
+static
+char *
+argbuf_ptr(struct argbuf *buf, size_t offset)
+{
+	KASSERT(offset / PAGE_SIZE < buf->npages);
+	return (char *)buf->pages[offset / PAGE_SIZE] + offset % PAGE_SIZE;
+}
+
+/*
+ * Append LEN bytes from kernel memory.
+ */
+static
+int
+argbuf_append(struct argbuf *buf, const void *data, size_t len)
+{
+	const char *src = data;
+	size_t amt;
+	int result;
+
+	while (len > 0) {
+		if (buf->len == buf->npages * PAGE_SIZE) {
+			result = argbuf_grow(buf);
+			if (result) {
+				return result;
+			}
+		}
+		amt = PAGE_SIZE - buf->len % PAGE_SIZE;
+		if (amt > len) {
+			amt = len;
+		}
+		memcpy(argbuf_ptr(buf, buf->len), src, amt);
+		buf->len += amt;
+		src += amt;
+		len -= amt;
+	}
+	return 0;
+}
+
+/*
+ * Append an argument string from user space, page by page. Strings
+ * may total at most ARG_MAX bytes.
+ */
+static
+int
+argbuf_appendstr(struct argbuf *buf, userptr_t ustr)
+{
+	size_t amt, got;
+	int result;
+
+	while (1) {
+		if (buf->len >= ARG_MAX) {
+			return E2BIG;
+		}
+		if (buf->len == buf->npages * PAGE_SIZE) {
+			result = argbuf_grow(buf);
+			if (result) {
+				return result;
+			}
+		}
+
+		amt = PAGE_SIZE - buf->len % PAGE_SIZE;
+		if (amt > ARG_MAX - buf->len) {
+			amt = ARG_MAX - buf->len;
+		}
+		result = copyinstr(ustr, argbuf_ptr(buf, buf->len), amt, &got);
+		if (result == 0) {
+			/* got includes the \0 */
+			buf->len += got;
+			return 0;
+		}
+		if (result != ENAMETOOLONG) {
+			return result;
+		}
+
+		/* filled the rest of the page; carry on in the next one */
+		buf->len += amt;
+		ustr += amt;
+	}
+}
+
+/*
+ * Finish an argv buffer once all the strings are in: pad to pointer
+ * alignment and lay down the argv array, holding the offset of each
+ * string for now. Then give back any budget we didn't need.
+ */
+static
+int
+argbuf_finish(struct argbuf *buf)
+{
+	const char *s;
+	userptr_t thisarg;
+	size_t pos, pad;
+	int i, result;
+
+	buf->strlen = buf->len;
+	pad = ROUNDUP(buf->len, sizeof(userptr_t)) - buf->len;
+	thisarg = NULL;
+	result = argbuf_append(buf, &thisarg, pad);
+	if (result) {
+		return result;
+	}
+	buf->argvoff = buf->len;
+
+	pos = 0;
+	for (i=0; i<buf->nargs; i++) {
+		thisarg = (userptr_t)pos;
+		result = argbuf_append(buf, &thisarg, sizeof(thisarg));
+		if (result) {
+			return result;
+		}
+
+		/* skip over the string, which may cross pages */
+		do {
+			s = argbuf_ptr(buf, pos++);
+		} while (*s != '\0');
+	}
+	/* Should have come out even... */
+	KASSERT(pos == buf->strlen);
+
+	/* Add the NULL. */
+	thisarg = NULL;
+	result = argbuf_append(buf, &thisarg, sizeof(thisarg));
+	if (result) {
+		return result;
+	}
+
+	if (buf->reserved > 0) {
+		execbudget_release(buf->reserved - (buf->npages - 1));
+		buf->reserved = buf->npages - 1;
+	}
 	return 0;
 }
 
@@ -147,27 +377,27 @@ argbuf_fromkernel(struct argbuf *buf, const char *progname)
 	int result;
 
 	len = strlen(progname) + 1;
+	if (len > ARG_MAX) {
+		return E2BIG;
+	}
 
-	result = argbuf_allocate(buf, len);
+	result = argbuf_append(buf, progname, len);
 	if (result) {
 		return result;
 	}
-	strcpy(buf->data, progname);
-	buf->len = len;
 	buf->nargs = 1;
 
-	return 0;
+	return argbuf_finish(buf);
 }
 
 /*
- * Copy an argv array into kernel space, using an argvdata buffer.
+ * Get an argv from user space.
  */
 static
 int
-argbuf_copyin(struct argbuf *buf, userptr_t uargv)
+argbuf_fromuser(struct argbuf *buf, userptr_t uargv)
 {
 	userptr_t thisarg;
-	size_t thisarglen;
 	int result;
 
 	/* loop through the argv, grabbing each arg string */
@@ -188,146 +418,70 @@ argbuf_copyin(struct argbuf *buf, userptr_t uargv)
 		}
 
 		/* Use the pointer to fetch the argument string. */
-		result = copyinstr(thisarg, buf->data + buf->len,
-				   buf->max - buf->len, &thisarglen);
-		if (result == ENAMETOOLONG) {
-			return E2BIG;
-		}
-		else if (result) {
+		result = argbuf_appendstr(buf, thisarg);
+		if (result) {
 			return result;
 		}
 
-		/* Move ahead. Note: thisarglen includes the \0. */
-		buf->len += thisarglen;
 		uargv += sizeof(userptr_t);
 		buf->nargs++;
 	}
 
-	return 0;
+	return argbuf_finish(buf);
 }
 
 /*
- * Get an argv from user space.
- */
-static
-int
-argbuf_fromuser(struct argbuf *buf, userptr_t uargv)
-{
-	int result;
-
-	/* try with a small buffer */
-	result = argbuf_allocate(buf, PAGE_SIZE);
-	if (result) {
-		return result;
-	}
-
-	/* do the copyin */
-	result = argbuf_copyin(buf, uargv);
-	if (result == E2BIG) {
-		/*
-		 * Try again with the full-size buffer. Just start
-		 * over instead of trying to keep the page we already
-		 * did; this is a bit inefficient but it's not that
-		 * important.
-		 */
-		argbuf_cleanup(buf);
-		argbuf_init(buf);
-
-		/* Wait on the semaphore, to throttle this allocation */
-		P(execthrottle);
-		buf->tooksem = true;
-
-		result = argbuf_allocate(buf, ARG_MAX);
-		if (result) {
-			return result;
-		}
-
-		result = argbuf_copyin(buf, uargv);
-	}
-	return result;
-}
-
-/*
- * Copy an argv out of kernel space to user space.
+ * Map a finished argv buffer into the stack of the address space AS,
+ * directly below the initial stack pointer, and move the stack
+ * pointer down past it.
  *
  * Note: ustackp is an in/out argument.
  */
 static
 int
-argbuf_copyout(struct argbuf *buf, vaddr_t *ustackp,
-	       int *argc_ret, userptr_t *uargv_ret)
+argbuf_install(struct argbuf *buf, struct addrspace *as, vaddr_t *ustackp)
 {
-	vaddr_t ustack;
-	userptr_t ustringbase, uargvbase, uargv_i;
-	userptr_t thisarg;
-	size_t thisarglen;
-	size_t pos;
-	int result;
-
-	/* Begin the stack at the passed in top. */
-	ustack = *ustackp;
+	vaddr_t base;
+	userptr_t *argvslot;
+	unsigned i;
+	int j, result;
+
+	KASSERT((*ustackp & PAGE_FRAME) == *ustackp);
+	KASSERT(buf->npages > 0);
+	base = *ustackp - buf->npages * PAGE_SIZE;
+
+	/* Turn the string offsets into user addresses. */
+	for (j=0; j<buf->nargs; j++) {
+		argvslot = (userptr_t *)argbuf_ptr(buf,
+				buf->argvoff + j * sizeof(userptr_t));
+		*argvslot = (userptr_t)(base + (vaddr_t)*argvslot);
+	}
 
 	/*
-	 * Allocate space.
-	 *
-	 * buf->pos is the amount of space used by the strings; put that
-	 * first, then align the stack, then make space for the argv
-	 * pointers. Allow an extra slot for the ending NULL.
+	 * Hand the pages over. If this fails part way, the ones
+	 * already mapped go away with the address space.
 	 */
-
-	ustack -= buf->len;
-	ustack -= (ustack & (sizeof(void *) - 1));
-	ustringbase = (userptr_t)ustack;
-
-	ustack -= (buf->nargs + 1) * sizeof(userptr_t);
-	uargvbase = (userptr_t)ustack;
-
-	/* Now copy the data out. */
-	pos = 0;
-	uargv_i = uargvbase;
-	while (pos < buf->len) {
-		/* The user address of the string will be ustringbase + pos. */
-		thisarg = ustringbase + pos;
-
-		/* Place it in the argv array. */
-		result = copyout(&thisarg, uargv_i, sizeof(thisarg));
-		if (result) {
-			return result;
-		}
-
-		/* Push out the string. */
-		result = copyoutstr(buf->data + pos, thisarg,
-				    buf->len - pos, &thisarglen);
+	for (i=0; i<buf->npages; i++) {
+		result = vm_mapkpage(as, base + i * PAGE_SIZE, buf->pages[i]);
 		if (result) {
 			return result;
 		}
-
-		/* thisarglen includes the \0 */
-		pos += thisarglen;
-		uargv_i += sizeof(thisarg);
+		buf->pages[i] = 0;
 	}
-	/* Should have come out even... */
-	KASSERT(pos == buf->len);
 
-	/* Add the NULL. */
-	thisarg = NULL;
-	result = copyout(&thisarg, uargv_i, sizeof(userptr_t));
-	if (result) {
-		return result;
-	}
-
-	*ustackp = ustack;
-	*argc_ret = buf->nargs;
-	*uargv_ret = uargvbase;
+	*ustackp = base;
+	buf->uargv = (userptr_t)(base + buf->argvoff);
 	return 0;
 }
 
 /*
- * Common code for execv and runprogram: loading the executable.
+ * Common code for execv and runprogram: loading the executable, and
+ * putting the argv in BUF on its stack.
  */
 static
 int
-loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
+loadexec(char *path, struct argbuf *buf,
+	 vaddr_t *entrypoint, vaddr_t *stackptr)
 {
 	struct addrspace *newvm, *oldvm;
 	struct vnode *v;
@@ -385,13 +539,27 @@ loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
 		return result;
         }
 
+	/* Put the argv on the stack */
+	result = argbuf_install(buf, newvm, stackptr);
+	if (result) {
+		proc_setas(oldvm);
+		as_activate();
+		as_destroy(newvm);
+		kfree(newname);
+		return result;
+	}
+
 	/*
-	 * Wipe out old address space.
+	 * Wipe out old address space, or if it was borrowed from our
+	 * vfork parent, give it back.
 	 *
 	 * Note: once this is done, execv() must not fail, because there's
 	 * nothing left for it to return an error to.
 	 */
-	if (oldvm) {
+	if (curproc->p_vforkdone != NULL) {
+		proc_vforkdone(curproc);
+	}
+	else if (oldvm) {
 		as_destroy(oldvm);
 	}
 
@@ -402,6 +570,18 @@ loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
 	kfree(curthread->t_name);
 	curthread->t_name = newname;
 
+	/*
+	 * We're the only thread, and we'll be running on the stack
+	 * as_define_stack made, which is slot 0. Forget any exited
+	 * threads nobody joined; their stacks are gone.
+	 */
+	spinlock_acquire(&curproc->p_lock);
+	KASSERT(curproc->p_nuthreads == 1);
+	curthread->t_tid = 0;
+	curproc->p_tidsused = PROC_TIDBIT(0);
+	curproc->p_tidsdone = 0;
+	spinlock_release(&curproc->p_lock);
+
 	return 0;
 }
 
@@ -431,7 +611,11 @@ placed_open(const char *path, int openflags, int fd)
 	}
 
 	/* place the file in the filetable in the right slot */
-	filetable_placeat(curproc->p_filetable, newfile, fd, &oldfile);
+	result = filetable_placeat(curproc->p_filetable, newfile, fd, &oldfile);
+	if (result) {
+		openfile_decref(newfile);
+		return result;
+	}
 
 	/* the table should previously have been empty */
 	KASSERT(oldfile == NULL);
@@ -519,19 +703,18 @@ runprogram(char *progname)
 	}
 
 	/* Load the executable. Note: must not fail after this succeeds. */
-	result = loadexec(progname, &entrypoint, &stackptr);
+	result = loadexec(progname, &kargv, &entrypoint, &stackptr);
 	if (result) {
 		argbuf_cleanup(&kargv);
 		return result;
 	}
 
-	result = argbuf_copyout(&kargv, &stackptr, &argc, &uargv);
-	if (result) {
-		/* If copyout fails, *we* messed up, so panic */
-		panic("execv: copyout_args failed: %s\n", strerror(result));
-	}
-
-	/* free the space */
+	/*
+	 * The argv pages belong to the new address space now; this
+	 * just gives back their share of the exec budget.
+	 */
+	argc = kargv.nargs;
+	uargv = kargv.uargv;
 	argbuf_cleanup(&kargv);
 
 	/* Warp to user mode. */
@@ -546,10 +729,9 @@ runprogram(char *progname)
  * execv.
  *
  * 1. Copy in the program name.
- * 2. Copy in the argv with copyin_args.
- * 3. Load the executable.
- * 4. Copy the argv out again with copyout_args.
- * 5. Warp to usermode.
+ * 2. Stage the argv in pages with argbuf_fromuser.
+ * 3. Load the executable, mapping the argv pages into its stack.
+ * 4. Warp to usermode.
  */
 int
 sys_execv(userptr_t prog, userptr_t uargv)
@@ -560,6 +742,15 @@ sys_execv(userptr_t prog, userptr_t uargv)
 	int argc;
 	int result;
 
+	/*
+	 * Other threads would have the address space replaced under
+	 * them. (Only a live thread can make more threads, so if we
+	 * are the only one this can't change under us.)
+	 */
+	if (curproc->p_nuthreads > 1) {
+		return EBUSY;
+	}
+
 	path = kmalloc(PATH_MAX);
 	if (!path) {
 		return ENOMEM;
@@ -584,7 +775,7 @@ sys_execv(userptr_t prog, userptr_t uargv)
 	}
 
 	/* Load the executable. Note: must not fail after this succeeds. */
-	result = loadexec(path, &entrypoint, &stackptr);
+	result = loadexec(path, &kargv, &entrypoint, &stackptr);
 	if (result) {
 		argbuf_cleanup(&kargv);
 		kfree(path);
@@ -594,14 +785,12 @@ sys_execv(userptr_t prog, userptr_t uargv)
 	/* don't need this any more */
 	kfree(path);
 
-	/* Send the argv strings to the process. */
-	result = argbuf_copyout(&kargv, &stackptr, &argc, &uargv);
-	if (result) {
-		/* if copyout fails, *we* messed up, so panic */
-		panic("execv: copyout_args failed: %s\n", strerror(result));
-	}
-
-	/* free the argv buffer space */
+	/*
+	 * The argv pages belong to the new address space now; this
+	 * just gives back their share of the exec budget.
+	 */
+	argc = kargv.nargs;
+	uargv = kargv.uargv;
 	argbuf_cleanup(&kargv);
 
 	/* Warp to user mode. */
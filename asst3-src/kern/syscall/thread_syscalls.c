@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * User thread syscalls.
+ *
+ * Threads of a process share its address space and file table. Each
+ * has a thread id (t_tid) that doubles as the index of its user stack
+ * slot; ids are handed out lowest-first and are reused only after
+ * thread_join has collected the old thread.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/futex.h>
+#include <lib.h>
+#include <machine/trapframe.h>
+#include <wchan.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <futex.h>
+#include <syscall.h>
+
+/*
+ * What a new thread needs to get to user mode. The trapframe is the
+ * creator's, for the registers we don't set explicitly (gp, status).
+ */
+struct uthread_start {
+	struct trapframe us_tf;
+	userptr_t us_entry;
+	userptr_t us_func;
+	userptr_t us_arg;
+	vaddr_t us_stack;
+};
+
+/*
+ * The new thread begins here.
+ */
+static
+void
+uthread_newthread(void *vus, unsigned long tid)
+{
+	struct uthread_start *us = vus;
+	struct trapframe mytf;
+	userptr_t func, arg;
+	vaddr_t entry, stack;
+
+	curthread->t_tid = tid;
+
+	/* Copy everything to our stack, as in fork_newthread. */
+	mytf = us->us_tf;
+	entry = (vaddr_t)us->us_entry;
+	func = us->us_func;
+	arg = us->us_arg;
+	stack = us->us_stack;
+	kfree(us);
+
+	enter_new_thread(&mytf, func, arg, stack, entry);
+}
+
+/*
+ * sys___thread_create
+ *
+ * Start a new thread at ENTRY, called as entry(func, arg). (libc's
+ * thread_create passes a trampoline that calls func(arg) and then
+ * thread_exit.) Returns the new thread id.
+ */
+int
+sys___thread_create(struct trapframe *tf, userptr_t entry, userptr_t func,
+		    userptr_t arg, int *retval)
+{
+	struct proc *proc = curproc;
+	struct uthread_start *us;
+	unsigned tid;
+	int result;
+
+	us = kmalloc(sizeof(*us));
+	if (us == NULL) {
+		return ENOMEM;
+	}
+	us->us_tf = *tf;
+	us->us_entry = entry;
+	us->us_func = func;
+	us->us_arg = arg;
+
+	/* Claim a thread id. */
+	spinlock_acquire(&proc->p_lock);
+	if (proc->p_exiting) {
+		/* No point; we're about to be torn down anyway. */
+		spinlock_release(&proc->p_lock);
+		kfree(us);
+		return EINTR;
+	}
+	for (tid = 0; tid < PROC_MAXUTHREADS; tid++) {
+		if ((proc->p_tidsused & PROC_TIDBIT(tid)) == 0) {
+			break;
+		}
+	}
+	if (tid == PROC_MAXUTHREADS) {
+		spinlock_release(&proc->p_lock);
+		kfree(us);
+		return EAGAIN;
+	}
+	proc->p_tidsused |= PROC_TIDBIT(tid);
+	proc->p_nuthreads++;
+	spinlock_release(&proc->p_lock);
+
+	result = as_define_threadstack(proc_getas(), tid, &us->us_stack);
+	if (result) {
+		goto fail;
+	}
+
+	result = thread_fork(curthread->t_name, proc,
+			     uthread_newthread, us, tid);
+	if (result) {
+		goto fail;
+	}
+
+	*retval = tid;
+	return 0;
+
+ fail:
+	spinlock_acquire(&proc->p_lock);
+	proc->p_tidsused &= ~PROC_TIDBIT(tid);
+	proc->p_nuthreads--;
+	spinlock_release(&proc->p_lock);
+	kfree(us);
+	return result;
+}
+
+/*
+ * sys_thread_exit
+ *
+ * Leave the process; RETVAL is handed to whoever joins us. The last
+ * thread to leave ends the process (see proc_threadexit).
+ */
+__DEAD
+void
+sys_thread_exit(userptr_t retval)
+{
+	proc_threadexit(retval);
+}
+
+/*
+ * sys_thread_join
+ *
+ * Wait for thread TID to exit and collect its thread_exit value.
+ * Only one joiner gets it; the id is then free for reuse.
+ */
+int
+sys_thread_join(int tid, userptr_t retvalp)
+{
+	struct proc *proc = curproc;
+	userptr_t ret = NULL;
+	int result;
+
+	if (tid < 0 || tid >= PROC_MAXUTHREADS) {
+		return ESRCH;
+	}
+	if ((unsigned)tid == curthread->t_tid) {
+		/* Would wait forever */
+		return EINVAL;
+	}
+
+	spinlock_acquire(&proc->p_lock);
+	while (1) {
+		if ((proc->p_tidsused & PROC_TIDBIT(tid)) == 0) {
+			/* never existed, or someone else joined it */
+			result = ESRCH;
+			break;
+		}
+		if (proc->p_tidsdone & PROC_TIDBIT(tid)) {
+			ret = proc->p_uthreadret[tid];
+			proc->p_tidsused &= ~PROC_TIDBIT(tid);
+			proc->p_tidsdone &= ~PROC_TIDBIT(tid);
+			result = 0;
+			break;
+		}
+		if (proc->p_exiting) {
+			/* We'll be leaving on the way out of the syscall. */
+			result = EINTR;
+			break;
+		}
+		wchan_sleep(proc->p_uthreadwchan, &proc->p_lock);
+	}
+	spinlock_release(&proc->p_lock);
+
+	if (result == 0 && retvalp != NULL) {
+		result = copyout(&ret, retvalp, sizeof(ret));
+	}
+	return result;
+}
+
+/*
+ * sys_futex
+ *
+ * See <kern/futex.h> for the operations and futex.c for the wait
+ * table.
+ */
+int
+sys_futex(userptr_t uaddr, int op, int val, int *retval)
+{
+	struct addrspace *as = proc_getas();
+	unsigned nwoken;
+	int result;
+
+	switch (op) {
+	    case FUTEX_WAIT:
+		return futex_wait(as, uaddr, val);
+	    case FUTEX_WAKE:
+		if (val < 0) {
+			return EINVAL;
+		}
+		result = futex_wake(as, uaddr, val, &nwoken);
+		if (result) {
+			return result;
+		}
+		*retval = nwoken;
+		return 0;
+	}
+	return EINVAL;
+}
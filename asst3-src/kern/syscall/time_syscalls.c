@@ -28,7 +28,9 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <clock.h>
+#include <callout.h>
 #include <copyinout.h>
 #include <syscall.h>
 
@@ -56,3 +58,47 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * nanosleep: sleep for the requested time, rounded up to whole
+ * hardclocks. We have no signals; the only interruption is another
+ * thread of the process calling _exit, in which case we fail with
+ * EINTR and report the time left. Otherwise that's zero.
+ */
+int
+sys_nanosleep(const_userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec ts, start, now, rem;
+	int result, napresult;
+
+	result = copyin(user_req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	gettime(&start);
+	napresult = clocknap_intr(callout_timespec_to_ticks(&ts));
+
+	rem.tv_sec = 0;
+	rem.tv_nsec = 0;
+	if (napresult) {
+		/* rem = ts - (now - start), if that's positive */
+		gettime(&now);
+		timespec_sub(&now, &start, &now);
+		if (now.tv_sec < ts.tv_sec ||
+		    (now.tv_sec == ts.tv_sec && now.tv_nsec < ts.tv_nsec)) {
+			timespec_sub(&ts, &now, &rem);
+		}
+	}
+
+	if (user_rem != NULL) {
+		result = copyout(&rem, user_rem, sizeof(rem));
+		if (result) {
+			return result;
+		}
+	}
+	return napresult;
+}
@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
 #include <test.h>
@@ -101,6 +102,25 @@ bitmaptest(int nargs, char **args)
 		KASSERT(data[i]==0);
 	}
 
+	/* Next fit: free some bits and check they come back in order */
+	for (i=7; i<TESTSIZE; i+=10) {
+		bitmap_unmark(b, i);
+	}
+	KASSERT(bitmap_alloc_next(b, 300, &x)==0);
+	KASSERT(x == 307);
+	KASSERT(bitmap_alloc_next(b, x+1, &x)==0);
+	KASSERT(x == 317);
+	for (i=327; i<TESTSIZE; i+=10) {
+		KASSERT(bitmap_alloc_next(b, x+1, &x)==0);
+		KASSERT(x == (unsigned)i);
+	}
+	/* wraps around to the bits below the hint */
+	for (i=7; i<300; i+=10) {
+		KASSERT(bitmap_alloc_next(b, x+1, &x)==0);
+		KASSERT(x == (unsigned)i);
+	}
+	KASSERT(bitmap_alloc_next(b, x+1, &x)==ENOSPC);
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
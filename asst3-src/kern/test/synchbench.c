@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Synchronization benchmarks.
+ *
+ * Unlike the tests in synchtest.c these don't check much; they
+ * measure how fast the primitives go under contention.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <qspinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define BENCH_MAXTHREADS	32
+#define LOCKBENCH_ITERS		20000
+#define SPINBENCH_ITERS		50000
+
+static struct semaphore *benchstartsem;
+static struct semaphore *benchdonesem;
+static struct lock *benchlock;
+static volatile unsigned long benchcounter;
+
+static
+void
+benchinit(void)
+{
+	if (benchstartsem == NULL) {
+		benchstartsem = sem_create("benchstart", 0);
+		if (benchstartsem == NULL) {
+			panic("synchbench: sem_create failed\n");
+		}
+	}
+	if (benchdonesem == NULL) {
+		benchdonesem = sem_create("benchdone", 0);
+		if (benchdonesem == NULL) {
+			panic("synchbench: sem_create failed\n");
+		}
+	}
+	if (benchlock == NULL) {
+		benchlock = lock_create("benchlock");
+		if (benchlock == NULL) {
+			panic("synchbench: lock_create failed\n");
+		}
+	}
+}
+
+/*
+ * Get the thread count from the command line.
+ */
+static
+int
+benchthreads(int nargs, char **args, unsigned *ret)
+{
+	int n;
+
+	if (nargs > 2) {
+		kprintf("Usage: %s [threads]\n", args[0]);
+		return EINVAL;
+	}
+	n = (nargs == 2) ? atoi(args[1]) : 4;
+	if (n < 1 || n > BENCH_MAXTHREADS) {
+		kprintf("%s: thread count must be 1-%d\n", args[0],
+			BENCH_MAXTHREADS);
+		return EINVAL;
+	}
+	*ret = n;
+	return 0;
+}
+
+/*
+ * Fork NTHREADS copies of FUNC, start them all at once, and wait for
+ * them to finish. Returns the elapsed time in nanoseconds.
+ */
+static
+uint64_t
+benchrun(const char *name, unsigned nthreads,
+	 void (*func)(void *, unsigned long))
+{
+	struct timespec start, end, diff;
+	unsigned i;
+	int result;
+
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork(name, NULL, func, NULL, i);
+		if (result) {
+			panic("%s: thread_fork failed: %s\n", name,
+			      strerror(result));
+		}
+	}
+
+	gettime(&start);
+	for (i=0; i<nthreads; i++) {
+		V(benchstartsem);
+	}
+	for (i=0; i<nthreads; i++) {
+		P(benchdonesem);
+	}
+	gettime(&end);
+
+	timespec_sub(&end, &start, &diff);
+	return (uint64_t)diff.tv_sec * 1000000000 + diff.tv_nsec;
+}
+
+/*
+ * Print OPS operations in NSECS nanoseconds as a rate.
+ */
+static
+void
+benchreport(const char *what, uint64_t ops, uint64_t nsecs)
+{
+	if (nsecs == 0) {
+		nsecs = 1;
+	}
+	kprintf("%llu %s in %llu.%09llu seconds: %llu per second\n",
+		(unsigned long long)ops, what,
+		(unsigned long long)(nsecs / 1000000000),
+		(unsigned long long)(nsecs % 1000000000),
+		(unsigned long long)(ops * 1000000000 / nsecs));
+}
+
+////////////////////////////////////////////////////////////
+// lock benchmark
+
+/*
+ * Each thread acquires and releases the lock over and over, with a
+ * critical section only a few instructions long. This is the case
+ * the adaptive spinning in lock_acquire is meant for.
+ */
+static
+void
+lockbenchthread(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+	(void)num;
+
+	P(benchstartsem);
+	for (i=0; i<LOCKBENCH_ITERS; i++) {
+		lock_acquire(benchlock);
+		benchcounter++;
+		lock_release(benchlock);
+	}
+	V(benchdonesem);
+}
+
+int
+lockbench(int nargs, char **args)
+{
+	unsigned nthreads;
+	uint64_t nsecs;
+	int result;
+
+	result = benchthreads(nargs, args, &nthreads);
+	if (result) {
+		return result;
+	}
+
+	benchinit();
+	benchcounter = 0;
+	kprintf("Lock benchmark: %u threads, %u acquisitions each\n",
+		nthreads, LOCKBENCH_ITERS);
+
+	nsecs = benchrun("lockbench", nthreads, lockbenchthread);
+
+	if (benchcounter != (unsigned long)nthreads * LOCKBENCH_ITERS) {
+		kprintf("lockbench: counter is %lu, expected %lu\n",
+			benchcounter,
+			(unsigned long)nthreads * LOCKBENCH_ITERS);
+		kprintf("Test failed\n");
+		return 0;
+	}
+	benchreport("lock acquisitions",
+		    (uint64_t)nthreads * LOCKBENCH_ITERS, nsecs);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// spinlock benchmark
+
+/*
+ * Same idea as the lock benchmark, but comparing plain spinlocks with
+ * queued spinlocks. The difference only shows with several cpus
+ * actually contending, so run this with the cpu count in sys161.conf
+ * set to 2, 4, and 8 in turn, with (at least) that many threads.
+ */
+
+static struct spinlock benchspinlock = SPINLOCK_INITIALIZER;
+static struct qspinlock benchqspinlock = QSPINLOCK_INITIALIZER;
+
+static
+void
+spinbenchthread(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+	(void)num;
+
+	P(benchstartsem);
+	for (i=0; i<SPINBENCH_ITERS; i++) {
+		spinlock_acquire(&benchspinlock);
+		benchcounter++;
+		spinlock_release(&benchspinlock);
+	}
+	V(benchdonesem);
+}
+
+static
+void
+qspinbenchthread(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+	(void)num;
+
+	P(benchstartsem);
+	for (i=0; i<SPINBENCH_ITERS; i++) {
+		qspinlock_acquire(&benchqspinlock);
+		benchcounter++;
+		qspinlock_release(&benchqspinlock);
+	}
+	V(benchdonesem);
+}
+
+int
+spinbench(int nargs, char **args)
+{
+	unsigned nthreads;
+	uint64_t nsecs;
+	int result;
+
+	result = benchthreads(nargs, args, &nthreads);
+	if (result) {
+		return result;
+	}
+
+	benchinit();
+	kprintf("Spinlock benchmark: %u threads, %u acquisitions each\n",
+		nthreads, SPINBENCH_ITERS);
+
+	benchcounter = 0;
+	nsecs = benchrun("spinbench", nthreads, spinbenchthread);
+	KASSERT(benchcounter == (unsigned long)nthreads * SPINBENCH_ITERS);
+	kprintf("spinlock:  ");
+	benchreport("acquisitions",
+		    (uint64_t)nthreads * SPINBENCH_ITERS, nsecs);
+
+	benchcounter = 0;
+	nsecs = benchrun("qspinbench", nthreads, qspinbenchthread);
+	KASSERT(benchcounter == (unsigned long)nthreads * SPINBENCH_ITERS);
+	kprintf("qspinlock: ");
+	benchreport("acquisitions",
+		    (uint64_t)nthreads * SPINBENCH_ITERS, nsecs);
+
+	return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Workqueue test.
+ *
+ * Several threads queue a batch of work items each; then we flush
+ * and check that every item ran exactly once. Then check that an
+ * item can requeue itself from its own function.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <workqueue.h>
+#include <test.h>
+
+#define WQTEST_WORKERS		4
+#define WQTEST_PRODUCERS	4
+#define WQTEST_ITEMS		128	/* per producer */
+#define WQTEST_REQUEUES		100
+
+static struct workqueue *wqtest_wq;
+static struct work wqtest_items[WQTEST_PRODUCERS * WQTEST_ITEMS];
+static unsigned wqtest_runs[WQTEST_PRODUCERS * WQTEST_ITEMS];
+static struct spinlock wqtest_lock = SPINLOCK_INITIALIZER;
+static struct semaphore *wqtest_donesem;
+
+static
+void
+wqtest_func(void *data)
+{
+	unsigned *runs = data;
+
+	spinlock_acquire(&wqtest_lock);
+	(*runs)++;
+	spinlock_release(&wqtest_lock);
+}
+
+static
+void
+wqtest_producer(void *unused, unsigned long num)
+{
+	unsigned i;
+
+	(void)unused;
+
+	for (i=num*WQTEST_ITEMS; i<(num+1)*WQTEST_ITEMS; i++) {
+		if (!workqueue_enqueue(wqtest_wq, &wqtest_items[i])) {
+			panic("wqtest: item %u was already queued\n", i);
+		}
+		if (i % 8 == 0) {
+			thread_yield();
+		}
+	}
+	V(wqtest_donesem);
+}
+
+static
+void
+wqtest_requeue(void *data)
+{
+	unsigned *runs = data;
+
+	if (++*runs < WQTEST_REQUEUES) {
+		if (!workqueue_enqueue(wqtest_wq, &wqtest_items[0])) {
+			panic("wqtest: requeue found item already queued\n");
+		}
+	}
+}
+
+int
+wqtest(int nargs, char **args)
+{
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting workqueue test...\n");
+
+	wqtest_wq = workqueue_create("wqtest", WQTEST_WORKERS);
+	if (wqtest_wq == NULL) {
+		panic("wqtest: workqueue_create failed\n");
+	}
+	wqtest_donesem = sem_create("wqtest", 0);
+	if (wqtest_donesem == NULL) {
+		panic("wqtest: sem_create failed\n");
+	}
+
+	for (i=0; i<WQTEST_PRODUCERS * WQTEST_ITEMS; i++) {
+		wqtest_runs[i] = 0;
+		work_init(&wqtest_items[i], wqtest_func, &wqtest_runs[i]);
+	}
+	for (i=0; i<WQTEST_PRODUCERS; i++) {
+		result = thread_fork("wqtest", NULL, wqtest_producer, NULL, i);
+		if (result) {
+			panic("wqtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<WQTEST_PRODUCERS; i++) {
+		P(wqtest_donesem);
+	}
+	workqueue_flush(wqtest_wq);
+
+	for (i=0; i<WQTEST_PRODUCERS * WQTEST_ITEMS; i++) {
+		if (wqtest_runs[i] != 1) {
+			panic("wqtest: item %u ran %u times\n",
+			      i, wqtest_runs[i]);
+		}
+	}
+	kprintf("wqtest: %u items ran once each\n", i);
+
+	/*
+	 * Requeueing. The flush can return between a run and the
+	 * requeue it does, so keep flushing until the count is done.
+	 */
+	wqtest_runs[0] = 0;
+	work_init(&wqtest_items[0], wqtest_requeue, &wqtest_runs[0]);
+	workqueue_enqueue(wqtest_wq, &wqtest_items[0]);
+	while (wqtest_runs[0] < WQTEST_REQUEUES) {
+		workqueue_flush(wqtest_wq);
+	}
+	workqueue_flush(wqtest_wq);
+	kprintf("wqtest: item requeued itself %u times\n", wqtest_runs[0]);
+
+	sem_destroy(wqtest_donesem);
+	workqueue_destroy(wqtest_wq);
+	wqtest_wq = NULL;
+
+	kprintf("Workqueue test done.\n");
+	return 0;
+}
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Hierarchical timer wheel.
+ *
+ * There are CW_LEVELS wheels of CW_SLOTS slots each. Level 0 has one
+ * slot per hardclock; each slot in level N covers CW_SLOTS times as
+ * many ticks as a slot in level N-1. A callout goes in the lowest
+ * level whose range covers how far in the future it expires, in the
+ * slot for its expiry time at that level's granularity. Arming and
+ * disarming are then just list insert and remove.
+ *
+ * On every tick we run whatever is in the current level 0 slot.
+ * Whenever the level N-1 index wraps around, the current slot of
+ * level N is "cascaded": everything in it is reinserted, which
+ * spreads it out across the lower levels. Callouts further in the
+ * future than the whole wheel covers are parked in the top level and
+ * reinserted each time around until they come into range.
+ *
+ * With 64 slots and 4 levels the wheel covers 2^24 ticks directly,
+ * which at HZ=100 is about 46 hours.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <callout.h>
+
+#define CW_BITS		6
+#define CW_SLOTS	(1 << CW_BITS)
+#define CW_MASK		(CW_SLOTS - 1)
+#define CW_LEVELS	4
+
+/* Number of ticks covered by levels 0 through LEVEL. */
+#define CW_RANGE(level)	((uint64_t)1 << (CW_BITS * ((level) + 1)))
+
+static struct spinlock callout_lock;
+static uint64_t callout_now;	/* ticks processed so far */
+static struct callout *callout_wheel[CW_LEVELS][CW_SLOTS];
+
+/*
+ * List operations. Each slot is a doubly linked list through co_next
+ * and co_prevp; co_prevp points at the previous callout's co_next,
+ * or at the slot itself, so removal needs no search.
+ */
+
+static
+void
+callout_link(struct callout **head, struct callout *co)
+{
+	co->co_next = *head;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = &co->co_next;
+	}
+	co->co_prevp = head;
+	*head = co;
+}
+
+static
+void
+callout_unlink(struct callout *co)
+{
+	*co->co_prevp = co->co_next;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = co->co_prevp;
+	}
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+}
+
+/*
+ * Put a callout in the right slot given the current time.
+ */
+static
+void
+callout_place(struct callout *co)
+{
+	uint64_t expires, delta;
+	unsigned level;
+
+	KASSERT(spinlock_do_i_hold(&callout_lock));
+
+	expires = co->co_expires;
+	if (expires < callout_now) {
+		/* Overdue (can happen when cascading); run it now. */
+		expires = callout_now;
+	}
+	delta = expires - callout_now;
+
+	for (level = 0; level < CW_LEVELS - 1; level++) {
+		if (delta < CW_RANGE(level)) {
+			break;
+		}
+	}
+	if (delta >= CW_RANGE(level)) {
+		/* Too far out; park it as far ahead as we can see. */
+		expires = callout_now + CW_RANGE(level) - 1;
+	}
+
+	callout_link(&callout_wheel[level][(expires >> (CW_BITS * level))
+					   & CW_MASK], co);
+}
+
+////////////////////////////////////////////////////////////
+
+void
+callout_bootstrap(void)
+{
+	unsigned i, j;
+
+	spinlock_init(&callout_lock);
+	callout_now = 0;
+	for (i=0; i<CW_LEVELS; i++) {
+		for (j=0; j<CW_SLOTS; j++) {
+			callout_wheel[i][j] = NULL;
+		}
+	}
+}
+
+void
+callout_init(struct callout *co, void (*func)(void *), void *data)
+{
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+	co->co_expires = 0;
+	co->co_func = func;
+	co->co_data = data;
+	co->co_pending = false;
+}
+
+void
+callout_reset(struct callout *co, unsigned ticks)
+{
+	spinlock_acquire(&callout_lock);
+	if (co->co_pending) {
+		callout_unlink(co);
+	}
+	/* Ticks from now; callout_now itself has already been run. */
+	co->co_expires = callout_now + ticks + 1;
+	co->co_pending = true;
+	callout_place(co);
+	spinlock_release(&callout_lock);
+}
+
+bool
+callout_stop(struct callout *co)
+{
+	bool wasarmed;
+
+	spinlock_acquire(&callout_lock);
+	wasarmed = co->co_pending;
+	if (wasarmed) {
+		callout_unlink(co);
+		co->co_pending = false;
+	}
+	spinlock_release(&callout_lock);
+	return wasarmed;
+}
+
+unsigned
+callout_timespec_to_ticks(const struct timespec *ts)
+{
+	const uint32_t nsecs_per_tick = 1000000000 / HZ;
+	uint64_t ticks;
+
+	KASSERT(ts->tv_sec >= 0);
+	KASSERT(ts->tv_nsec >= 0 && ts->tv_nsec < 1000000000);
+
+	ticks = (uint64_t)ts->tv_sec * HZ;
+	ticks += (ts->tv_nsec + nsecs_per_tick - 1) / nsecs_per_tick;
+	if (ticks > 0xffffffff) {
+		ticks = 0xffffffff;
+	}
+	return ticks;
+}
+
+/*
+ * Cascade the current slot of LEVEL down into the lower levels.
+ */
+static
+void
+callout_cascade(unsigned level)
+{
+	struct callout *list, *co;
+	unsigned slot;
+
+	slot = (callout_now >> (CW_BITS * level)) & CW_MASK;
+
+	/* Detach the whole slot first; things may land back in it. */
+	list = callout_wheel[level][slot];
+	callout_wheel[level][slot] = NULL;
+
+	while ((co = list) != NULL) {
+		list = co->co_next;
+		co->co_next = NULL;
+		co->co_prevp = NULL;
+		callout_place(co);
+	}
+}
+
+/*
+ * Advance the wheel by one tick and run whatever has expired.
+ */
+void
+callout_tick(void)
+{
+	struct callout *expired, *co;
+	void (*func)(void *);
+	void *data;
+	unsigned level;
+
+	spinlock_acquire(&callout_lock);
+	callout_now++;
+
+	/*
+	 * Cascade from the top down, so anything that moves into a
+	 * lower slot that is also due for cascading gets moved again.
+	 */
+	for (level = CW_LEVELS - 1; level > 0; level--) {
+		if ((callout_now & (CW_RANGE(level - 1) - 1)) == 0) {
+			callout_cascade(level);
+		}
+	}
+
+	/*
+	 * Move the current slot to a private list. It stays a proper
+	 * list (co_prevp of the first entry points at our local head)
+	 * so callout_stop still works on entries we haven't got to.
+	 */
+	expired = NULL;
+	co = callout_wheel[0][callout_now & CW_MASK];
+	if (co != NULL) {
+		callout_wheel[0][callout_now & CW_MASK] = NULL;
+		expired = co;
+		co->co_prevp = &expired;
+	}
+
+	while ((co = expired) != NULL) {
+		callout_unlink(co);
+		co->co_pending = false;
+		func = co->co_func;
+		data = co->co_data;
+
+		/*
+		 * Once the lock is released the callout may be rearmed,
+		 * cancelled, or freed, so don't touch it again.
+		 */
+		spinlock_release(&callout_lock);
+		func(data);
+		spinlock_acquire(&callout_lock);
+	}
+
+	spinlock_release(&callout_lock);
+}
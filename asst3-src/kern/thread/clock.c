@@ -28,19 +28,23 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <cpu.h>
 #include <wchan.h>
 #include <clock.h>
+#include <callout.h>
 #include <thread.h>
 #include <current.h>
+#include <proc.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * Callbacks scheduled for specific points in the future are handled
+ * by the callout code (callout.c), with hardclock resolution; the
+ * timer wheel is advanced from hardclock() on cpu 0. clocknap() below
+ * uses it to sleep for a given number of ticks.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -50,7 +54,7 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
+#define SCHEDULE_HARDCLOCKS	HZ	/* Reset priorities once a second. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
 /*
@@ -59,17 +63,44 @@
 static struct wchan *lbolt;
 static struct spinlock lbolt_lock;
 
+/*
+ * Threads in clocknap() sleep on one of a handful of wait channels,
+ * chosen by hashing the thread, and all share one spinlock. This
+ * avoids creating a wait channel per nap while keeping the number of
+ * threads woken up needlessly small.
+ */
+#define NUM_NAPCHANS	16
+static struct wchan *napchans[NUM_NAPCHANS];
+static struct spinlock nap_lock;
+
+struct nap {
+	struct wchan *n_wchan;
+	bool n_done;
+};
+
 /*
  * Setup.
  */
 void
 hardclock_bootstrap(void)
 {
+	unsigned i;
+
 	spinlock_init(&lbolt_lock);
 	lbolt = wchan_create("lbolt");
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+
+	spinlock_init(&nap_lock);
+	for (i=0; i<NUM_NAPCHANS; i++) {
+		napchans[i] = wchan_create("nap");
+		if (napchans[i] == NULL) {
+			panic("Couldn't create nap wait channels\n");
+		}
+	}
+
+	callout_bootstrap();
 }
 
 /*
@@ -96,14 +127,25 @@ hardclock(void)
 	 * Collect statistics here as desired.
 	 */
 
+	/* Charge the tick to whoever we interrupted. */
+	if (curthread->t_intr_fromuser) {
+		curthread->t_usage.ku_uticks++;
+	}
+	else if (!curcpu->c_isidle) {
+		curthread->t_usage.ku_sticks++;
+	}
+
 	curcpu->c_hardclocks++;
+	if (curcpu->c_number == 0) {
+		callout_tick();
+	}
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	thread_quantum_tick();
 }
 
 /*
@@ -119,3 +161,95 @@ clocksleep(int num_secs)
 	}
 	spinlock_release(&lbolt_lock);
 }
+
+/*
+ * Callout function for clocknap.
+ */
+static
+void
+clocknap_wakeup(void *data)
+{
+	struct nap *n = data;
+
+	spinlock_acquire(&nap_lock);
+	n->n_done = true;
+	wchan_wakeall(n->n_wchan, &nap_lock);
+	spinlock_release(&nap_lock);
+}
+
+/*
+ * Suspend execution for (at least) the given number of hardclocks.
+ * If INTR, give up early with EINTR if the current process is
+ * exiting (see clocknap_wakeall).
+ */
+static
+int
+clocknap_sub(unsigned ticks, bool intr)
+{
+	struct nap n;
+	struct callout co;
+	int result = 0;
+
+	if (ticks == 0) {
+		thread_yield();
+		return 0;
+	}
+
+	n.n_wchan = napchans[((uintptr_t)curthread / sizeof(struct thread))
+			     % NUM_NAPCHANS];
+	n.n_done = false;
+	callout_init(&co, clocknap_wakeup, &n);
+
+	/*
+	 * Arm the callout with nap_lock held so it can't fire before
+	 * we're on the wait channel. Both N and CO are on our stack,
+	 * which is safe because we don't return until the callout has
+	 * set n_done, and it doesn't touch either after that except
+	 * to release nap_lock.
+	 */
+	spinlock_acquire(&nap_lock);
+	callout_reset(&co, ticks - 1);
+	while (!n.n_done) {
+		if (intr && curproc->p_exiting) {
+			result = EINTR;
+			if (callout_stop(&co)) {
+				break;
+			}
+			/* too late; it's firing, so wait for it */
+			intr = false;
+			continue;
+		}
+		wchan_sleep(n.n_wchan, &nap_lock);
+	}
+	spinlock_release(&nap_lock);
+	return result;
+}
+
+void
+clocknap(unsigned ticks)
+{
+	clocknap_sub(ticks, false);
+}
+
+int
+clocknap_intr(unsigned ticks)
+{
+	return clocknap_sub(ticks, true);
+}
+
+/*
+ * Wake everyone in clocknap. Used when a process is exiting; the
+ * caller sets p_exiting first, so its threads in clocknap_intr give
+ * up and everyone else goes back to sleep.
+ */
+void
+clocknap_wakeall(void)
+{
+	unsigned i;
+
+	spinlock_acquire(&nap_lock);
+	for (i=0; i<NUM_NAPCHANS; i++) {
+		wchan_wakeall(napchans[i], &nap_lock);
+	}
+	spinlock_release(&nap_lock);
+}
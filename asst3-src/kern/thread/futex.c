@@ -0,0 +1,338 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Futexes.
+ *
+ * A futex is just a word of user memory; the kernel only gets
+ * involved when a thread has to sleep on one. Sleepers are kept in a
+ * hash table keyed on (address space, vaddr). Each bucket has a
+ * spinlock and a list of queues, one per address that currently has
+ * sleepers; each queue has its own wchan, so a wake only disturbs
+ * the threads waiting on that address.
+ *
+ * FUTEX_WAIT has to check the user's word and go to sleep without
+ * missing a FUTEX_WAKE in between. We can't copyin with a spinlock
+ * held (the page might need faulting in), so instead every wake bumps
+ * a per-bucket counter: the waiter samples the counter, reads the
+ * word, then rechecks the counter with the bucket locked before
+ * sleeping. If it changed, a wake may have been meant for us, and we
+ * return at once (futex callers must tolerate spurious wakeups).
+ * Otherwise any waker that changed the word after we read it has yet
+ * to take the bucket lock, and will find us asleep.
+ *
+ * Queues that run out of sleepers are kept on a per-bucket free list
+ * (up to FUTEX_QCACHE of them) so the common contended case doesn't
+ * have to allocate.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <futex.h>
+
+#define FUTEX_BUCKETS	64	/* must be a power of 2 */
+#define FUTEX_QCACHE	4	/* spare queues kept per bucket */
+
+struct futexq {
+	struct futexq *fq_next;
+	struct addrspace *fq_as;
+	vaddr_t fq_vaddr;
+	struct wchan *fq_wchan;
+	unsigned fq_refs;		/* threads using this queue */
+};
+
+struct futexbucket {
+	struct spinlock fb_lock;
+	unsigned fb_wakes;		/* bumped by every wake */
+	struct futexq *fb_queues;	/* queues with sleepers */
+	struct futexq *fb_free;		/* spare queues */
+	unsigned fb_nfree;
+};
+
+static struct futexbucket futextable[FUTEX_BUCKETS];
+
+/*
+ * Set up the table.
+ */
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_BUCKETS; i++) {
+		spinlock_init(&futextable[i].fb_lock);
+		futextable[i].fb_wakes = 0;
+		futextable[i].fb_queues = NULL;
+		futextable[i].fb_free = NULL;
+		futextable[i].fb_nfree = 0;
+	}
+}
+
+/*
+ * Pick the bucket for a key.
+ */
+static
+struct futexbucket *
+futex_bucket(struct addrspace *as, vaddr_t vaddr)
+{
+	uintptr_t h;
+
+	h = ((uintptr_t)as >> 4) ^ (vaddr >> 2);
+	h ^= h >> 11;
+	return &futextable[h & (FUTEX_BUCKETS - 1)];
+}
+
+/*
+ * Find the queue for a key. Bucket must be locked.
+ */
+static
+struct futexq *
+futex_findq(struct futexbucket *fb, struct addrspace *as, vaddr_t vaddr)
+{
+	struct futexq *fq;
+
+	KASSERT(spinlock_do_i_hold(&fb->fb_lock));
+
+	for (fq = fb->fb_queues; fq != NULL; fq = fq->fq_next) {
+		if (fq->fq_as == as && fq->fq_vaddr == vaddr) {
+			return fq;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Make a queue. Called without the bucket lock, since it allocates.
+ */
+static
+struct futexq *
+futexq_create(void)
+{
+	struct futexq *fq;
+
+	fq = kmalloc(sizeof(*fq));
+	if (fq == NULL) {
+		return NULL;
+	}
+	fq->fq_wchan = wchan_create("futex");
+	if (fq->fq_wchan == NULL) {
+		kfree(fq);
+		return NULL;
+	}
+	fq->fq_next = NULL;
+	fq->fq_as = NULL;
+	fq->fq_vaddr = 0;
+	fq->fq_refs = 0;
+	return fq;
+}
+
+static
+void
+futexq_destroy(struct futexq *fq)
+{
+	KASSERT(fq->fq_refs == 0);
+	wchan_destroy(fq->fq_wchan);
+	kfree(fq);
+}
+
+/*
+ * Drop a thread's use of a queue; retire the queue if it was the
+ * last. Bucket must be locked. Returns a queue for the caller to
+ * destroy once the lock is dropped, if the free list is full.
+ */
+static
+struct futexq *
+futexq_release(struct futexbucket *fb, struct futexq *fq)
+{
+	struct futexq **fqp;
+
+	KASSERT(spinlock_do_i_hold(&fb->fb_lock));
+	KASSERT(fq->fq_refs > 0);
+
+	fq->fq_refs--;
+	if (fq->fq_refs > 0) {
+		return NULL;
+	}
+	KASSERT(wchan_isempty(fq->fq_wchan, &fb->fb_lock));
+
+	for (fqp = &fb->fb_queues; *fqp != fq; fqp = &(*fqp)->fq_next) {
+		KASSERT(*fqp != NULL);
+	}
+	*fqp = fq->fq_next;
+
+	if (fb->fb_nfree < FUTEX_QCACHE) {
+		fq->fq_next = fb->fb_free;
+		fb->fb_free = fq;
+		fb->fb_nfree++;
+		return NULL;
+	}
+	return fq;
+}
+
+/*
+ * FUTEX_WAIT.
+ */
+int
+futex_wait(struct addrspace *as, userptr_t uaddr, int val)
+{
+	vaddr_t vaddr = (vaddr_t)uaddr;
+	struct futexbucket *fb;
+	struct futexq *fq, *spare = NULL, *dead;
+	unsigned wakes;
+	int cur;
+	int result;
+
+	if (vaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+	fb = futex_bucket(as, vaddr);
+
+	spinlock_acquire(&fb->fb_lock);
+	wakes = fb->fb_wakes;
+	spinlock_release(&fb->fb_lock);
+
+ again:
+	result = copyin(uaddr, &cur, sizeof(cur));
+	if (result) {
+		goto out;
+	}
+	if (cur != val) {
+		result = EAGAIN;
+		goto out;
+	}
+
+	spinlock_acquire(&fb->fb_lock);
+	if (fb->fb_wakes != wakes || curproc->p_exiting) {
+		/* someone may have been trying to wake us */
+		spinlock_release(&fb->fb_lock);
+		result = 0;
+		goto out;
+	}
+
+	fq = futex_findq(fb, as, vaddr);
+	if (fq == NULL) {
+		if (spare == NULL && fb->fb_free != NULL) {
+			spare = fb->fb_free;
+			fb->fb_free = spare->fq_next;
+			fb->fb_nfree--;
+		}
+		if (spare == NULL) {
+			/* Allocate one and start over. */
+			spinlock_release(&fb->fb_lock);
+			spare = futexq_create();
+			if (spare == NULL) {
+				return ENOMEM;
+			}
+			goto again;
+		}
+		fq = spare;
+		spare = NULL;
+		fq->fq_as = as;
+		fq->fq_vaddr = vaddr;
+		fq->fq_next = fb->fb_queues;
+		fb->fb_queues = fq;
+	}
+
+	fq->fq_refs++;
+	wchan_sleep(fq->fq_wchan, &fb->fb_lock);
+	dead = futexq_release(fb, fq);
+	spinlock_release(&fb->fb_lock);
+
+	if (dead != NULL) {
+		futexq_destroy(dead);
+	}
+	result = 0;
+
+ out:
+	if (spare != NULL) {
+		futexq_destroy(spare);
+	}
+	return result;
+}
+
+/*
+ * FUTEX_WAKE.
+ */
+int
+futex_wake(struct addrspace *as, userptr_t uaddr, unsigned n,
+	   unsigned *nwoken)
+{
+	vaddr_t vaddr = (vaddr_t)uaddr;
+	struct futexbucket *fb;
+	struct futexq *fq;
+	unsigned count = 0;
+
+	if (vaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+	fb = futex_bucket(as, vaddr);
+
+	spinlock_acquire(&fb->fb_lock);
+	fb->fb_wakes++;
+	fq = futex_findq(fb, as, vaddr);
+	if (fq != NULL) {
+		count = wchan_wakeN(fq->fq_wchan, &fb->fb_lock, n);
+	}
+	spinlock_release(&fb->fb_lock);
+
+	*nwoken = count;
+	return 0;
+}
+
+/*
+ * Wake everyone sleeping on a futex in AS. Used when the process is
+ * exiting, so its threads can leave; the caller sets p_exiting first
+ * so nobody goes back to sleep.
+ */
+void
+futex_wakeall(struct addrspace *as)
+{
+	struct futexbucket *fb;
+	struct futexq *fq;
+	unsigned i;
+
+	for (i=0; i<FUTEX_BUCKETS; i++) {
+		fb = &futextable[i];
+		spinlock_acquire(&fb->fb_lock);
+		for (fq = fb->fb_queues; fq != NULL; fq = fq->fq_next) {
+			if (fq->fq_as == as) {
+				fb->fb_wakes++;
+				wchan_wakeall(fq->fq_wchan, &fb->fb_lock);
+			}
+		}
+		spinlock_release(&fb->fb_lock);
+	}
+}
@@ -180,3 +180,33 @@ hangman_release(struct hangman_actor *a,
 
 	spinlock_release(&hangman_lock);
 }
+
+/*
+ * Note that a has stopped waiting for l without becoming its holder.
+ * This is for shared (reader) acquisition of rwlocks: any number of
+ * readers can be in at once, and we can only keep track of one
+ * holder per lockable, so readers are not recorded as holders. This
+ * means cycles through a read-held lock aren't detected, but ones
+ * where a reader waits for a writer still are.
+ */
+void
+hangman_waitdone(struct hangman_actor *a,
+		 struct hangman_lockable *l)
+{
+	if (l == &hangman_lock.splk_hangman) {
+		/* don't recurse */
+		return;
+	}
+
+	spinlock_acquire(&hangman_lock);
+
+	if (a->a_waiting != l) {
+		spinlock_release(&hangman_lock);
+		panic("hangman_waitdone: not waiting for lock %s (%p)\n",
+		      l->l_name, l);
+	}
+
+	a->a_waiting = NULL;
+
+	spinlock_release(&hangman_lock);
+}
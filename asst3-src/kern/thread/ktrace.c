@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel event tracing.
+ *
+ * Each cpu has a ring of KTRACE_RECORDS records. kt_head counts all
+ * records ever written to the ring; the next one goes in slot
+ * kt_head % KTRACE_RECORDS, overwriting the oldest once the ring has
+ * wrapped. Only the owning cpu writes its ring, with interrupts off,
+ * so no lock is needed.
+ *
+ * kt_busy is set while a record is being written, so that the dump
+ * code, after turning tracing off, can wait out any cpu that was in
+ * the middle of logging something.
+ *
+ * ktrace_start, ktrace_stop and ktrace_dump are meant to be called
+ * from the kernel menu and are not safe against each other.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <membar.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <ktrace.h>
+
+/* Records per cpu; must be a power of 2 */
+#define KTRACE_RECORDS	1024
+
+/* Most cpus we can trace */
+#define KTRACE_MAXCPUS	32
+
+struct ktrace_ring {
+	struct ktrace_record kt_records[KTRACE_RECORDS];
+	unsigned kt_head;		/* records written, ever */
+	volatile unsigned kt_busy;	/* nonzero while writing */
+};
+
+static struct ktrace_ring *ktrace_rings[KTRACE_MAXCPUS];
+static unsigned ktrace_ncpus;
+
+volatile bool ktrace_on;
+
+/*
+ * Log an event on the current cpu.
+ */
+void
+ktrace_event(unsigned event, uint32_t a0, uint32_t a1,
+	     uint32_t a2, uint32_t a3)
+{
+	struct ktrace_ring *ring;
+	struct ktrace_record *kr;
+	struct timespec ts;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return;
+	}
+
+	spl = splhigh();
+	if (curcpu->c_number >= ktrace_ncpus) {
+		/* cpu came up after tracing was started */
+		splx(spl);
+		return;
+	}
+	ring = ktrace_rings[curcpu->c_number];
+	ring->kt_busy = 1;
+	membar_store_store();
+	if (ktrace_on) {
+		gettime(&ts);
+		kr = &ring->kt_records[ring->kt_head & (KTRACE_RECORDS - 1)];
+		kr->kr_sec = ts.tv_sec;
+		kr->kr_nsec = ts.tv_nsec;
+		kr->kr_cpu = curcpu->c_number;
+		kr->kr_event = event;
+		kr->kr_thread = (uint32_t)curthread;
+		kr->kr_arg[0] = a0;
+		kr->kr_arg[1] = a1;
+		kr->kr_arg[2] = a2;
+		kr->kr_arg[3] = a3;
+		ring->kt_head++;
+	}
+	membar_store_store();
+	ring->kt_busy = 0;
+	splx(spl);
+}
+
+/*
+ * Turn tracing off and wait until no cpu is still writing a record.
+ */
+static
+void
+ktrace_quiesce(void)
+{
+	unsigned i;
+
+	ktrace_on = false;
+	membar_any_any();
+	for (i=0; i<ktrace_ncpus; i++) {
+		while (ktrace_rings[i]->kt_busy) {
+			/* spin */
+		}
+	}
+	membar_any_any();
+}
+
+int
+ktrace_start(void)
+{
+	unsigned i, ncpus;
+
+	ktrace_quiesce();
+
+	ncpus = thread_numcpus();
+	if (ncpus > KTRACE_MAXCPUS) {
+		ncpus = KTRACE_MAXCPUS;
+	}
+	for (i=ktrace_ncpus; i<ncpus; i++) {
+		ktrace_rings[i] = kmalloc(sizeof(struct ktrace_ring));
+		if (ktrace_rings[i] == NULL) {
+			return ENOMEM;
+		}
+		ktrace_rings[i]->kt_busy = 0;
+		/* publish the ring before counting it */
+		membar_store_store();
+		ktrace_ncpus = i + 1;
+	}
+
+	for (i=0; i<ktrace_ncpus; i++) {
+		ktrace_rings[i]->kt_head = 0;
+	}
+	membar_store_store();
+	ktrace_on = true;
+	return 0;
+}
+
+void
+ktrace_stop(void)
+{
+	ktrace_quiesce();
+}
+
+/*
+ * Write LEN bytes from BUF to VN at *POS.
+ */
+static
+int
+ktrace_write(struct vnode *vn, const void *buf, size_t len, off_t *pos)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, (void *)buf, len, *pos, UIO_WRITE);
+	result = VOP_WRITE(vn, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return ENOSPC;
+	}
+	*pos += len;
+	return 0;
+}
+
+int
+ktrace_dump(const char *path)
+{
+	struct ktrace_header kh;
+	struct ktrace_ring *ring;
+	struct vnode *vn;
+	char *pathcopy;
+	unsigned i, n, first;
+	off_t pos;
+	bool wason;
+	int result;
+
+	wason = ktrace_on;
+	ktrace_quiesce();
+
+	kh.kh_magic = KTRACE_MAGIC;
+	kh.kh_ncpus = ktrace_ncpus;
+	kh.kh_nrecords = 0;
+	kh.kh_dropped = 0;
+	for (i=0; i<ktrace_ncpus; i++) {
+		ring = ktrace_rings[i];
+		if (ring->kt_head > KTRACE_RECORDS) {
+			kh.kh_nrecords += KTRACE_RECORDS;
+			kh.kh_dropped += ring->kt_head - KTRACE_RECORDS;
+		}
+		else {
+			kh.kh_nrecords += ring->kt_head;
+		}
+	}
+
+	/* vfs_open destroys the string it's passed */
+	pathcopy = kstrdup(path);
+	if (pathcopy == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+	result = vfs_open(pathcopy, O_WRONLY|O_CREAT|O_TRUNC, 0664, &vn);
+	kfree(pathcopy);
+	if (result) {
+		goto out;
+	}
+
+	pos = 0;
+	result = ktrace_write(vn, &kh, sizeof(kh), &pos);
+	for (i=0; i<ktrace_ncpus && result == 0; i++) {
+		ring = ktrace_rings[i];
+
+		/* Oldest record first; the ring may have wrapped. */
+		if (ring->kt_head > KTRACE_RECORDS) {
+			first = ring->kt_head & (KTRACE_RECORDS - 1);
+			n = KTRACE_RECORDS - first;
+			result = ktrace_write(vn, &ring->kt_records[first],
+					      n * sizeof(ring->kt_records[0]),
+					      &pos);
+			if (result) {
+				break;
+			}
+			n = first;
+		}
+		else {
+			n = ring->kt_head;
+		}
+		result = ktrace_write(vn, &ring->kt_records[0],
+				      n * sizeof(ring->kt_records[0]), &pos);
+	}
+	vfs_close(vn);
+
+	if (result == 0) {
+		kprintf("ktrace: %u records written to %s (%u dropped)\n",
+			kh.kh_nrecords, path, kh.kh_dropped);
+	}
+
+ out:
+	if (wason) {
+		ktrace_on = true;
+	}
+	return result;
+}
@@ -0,0 +1,332 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock contention profiler.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <clock.h>
+#include <lockstat.h>
+
+/* Longest class name we keep (longer ones are truncated) */
+#define LOCKSTAT_NAMELEN	24
+
+/* Size of the class table; must be a power of 2 */
+#define LOCKSTAT_CLASSES	256
+
+/*
+ * Statistics for one class of locks.
+ */
+struct lockstat_class {
+	char lc_name[LOCKSTAT_NAMELEN];	/* Lock name; empty if slot unused */
+	const void *lc_site;		/* Acquire site, for spinlocks */
+	uint64_t lc_acquires;		/* Number of acquisitions */
+	uint64_t lc_contended;		/* Number that had to wait */
+	uint64_t lc_waitnsecs;		/* Total time spent waiting */
+	uint64_t lc_maxhold;		/* Longest hold time */
+};
+
+/*
+ * The class table, an open-addressed hash table. Classes are never
+ * removed (locks keep pointers to them), so once it fills up further
+ * classes get lumped together in lockstat_overflow.
+ *
+ * This is protected by a bare spinlock word rather than a struct
+ * spinlock, because struct spinlock calls back into us.
+ */
+static struct lockstat_class lockstat_classes[LOCKSTAT_CLASSES];
+static struct lockstat_class lockstat_overflow = { .lc_name = "(other)" };
+static volatile spinlock_data_t lockstat_tablelock =
+	SPINLOCK_DATA_INITIALIZER;
+
+/* Set once the clock can be read */
+static bool lockstat_ready;
+
+/*
+ * Lock and unlock the table.
+ */
+static
+int
+lockstat_lock(void)
+{
+	int s;
+
+	s = splhigh();
+	while (spinlock_data_get(&lockstat_tablelock) != 0 ||
+	       spinlock_data_testandset(&lockstat_tablelock) != 0) {
+		/* spin */
+	}
+	membar_store_any();
+	return s;
+}
+
+static
+void
+lockstat_unlock(int s)
+{
+	membar_any_store();
+	spinlock_data_set(&lockstat_tablelock, 0);
+	splx(s);
+}
+
+/*
+ * Find (or make) the class for NAME and SITE. Table must be locked.
+ */
+static
+struct lockstat_class *
+lockstat_getclass(const char *name, const void *site)
+{
+	char key[LOCKSTAT_NAMELEN];
+	struct lockstat_class *lc;
+	unsigned hash, i;
+
+	snprintf(key, sizeof(key), "%s", name);
+
+	hash = (uintptr_t)site >> 2;
+	for (i=0; key[i] != 0; i++) {
+		hash = hash*33 + (unsigned char)key[i];
+	}
+
+	for (i=0; i<LOCKSTAT_CLASSES; i++) {
+		lc = &lockstat_classes[(hash + i) & (LOCKSTAT_CLASSES - 1)];
+		if (lc->lc_name[0] == 0) {
+			strcpy(lc->lc_name, key);
+			lc->lc_site = site;
+			return lc;
+		}
+		if (lc->lc_site == site && !strcmp(lc->lc_name, key)) {
+			return lc;
+		}
+	}
+	return &lockstat_overflow;
+}
+
+/*
+ * Start timing. Called once the clock device has attached.
+ */
+void
+lockstat_bootstrap(void)
+{
+	lockstat_ready = true;
+}
+
+/*
+ * Set up the lockstat part of a lock. NAME is null for locks that
+ * are classed by acquire site instead.
+ */
+void
+lockstat_init(struct lockstat *ls, const char *name)
+{
+	int s;
+
+	ls->ls_class = NULL;
+	ls->ls_holdstart = 0;
+	if (name != NULL) {
+		s = lockstat_lock();
+		ls->ls_class = lockstat_getclass(name, NULL);
+		lockstat_unlock(s);
+	}
+}
+
+/*
+ * Read the clock, in nanoseconds.
+ */
+uint64_t
+lockstat_now(void)
+{
+	struct timespec ts;
+
+	if (!lockstat_ready) {
+		return 0;
+	}
+	gettime(&ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Count an acquisition of the lock LS. If NAME is not null, charge
+ * it to the class for NAME and SITE; otherwise to the lock's own
+ * class. WAITSTART is when we started waiting for the lock, or
+ * LOCKSTAT_NOWAIT if we didn't.
+ */
+void
+lockstat_acquire(struct lockstat *ls, const char *name, const void *site,
+		 uint64_t waitstart)
+{
+	struct lockstat_class *lc;
+	uint64_t now;
+	int s;
+
+	if (!lockstat_ready) {
+		return;
+	}
+	now = lockstat_now();
+
+	s = lockstat_lock();
+	if (name != NULL) {
+		ls->ls_class = lockstat_getclass(name, site);
+	}
+	lc = ls->ls_class;
+	if (lc != NULL) {
+		lc->lc_acquires++;
+		if (waitstart != LOCKSTAT_NOWAIT) {
+			lc->lc_contended++;
+			/* might have started waiting before we were ready */
+			if (waitstart != 0 && waitstart < now) {
+				lc->lc_waitnsecs += now - waitstart;
+			}
+		}
+	}
+	lockstat_unlock(s);
+
+	ls->ls_holdstart = now;
+}
+
+/*
+ * Count a release of the lock LS.
+ */
+void
+lockstat_release(struct lockstat *ls)
+{
+	struct lockstat_class *lc;
+	uint64_t hold;
+	int s;
+
+	lc = ls->ls_class;
+	if (lc == NULL || ls->ls_holdstart == 0) {
+		return;
+	}
+	hold = lockstat_now() - ls->ls_holdstart;
+	ls->ls_holdstart = 0;
+
+	s = lockstat_lock();
+	if (hold > lc->lc_maxhold) {
+		lc->lc_maxhold = hold;
+	}
+	lockstat_unlock(s);
+}
+
+/*
+ * Print the MAX classes with the most total wait time.
+ *
+ * Take a snapshot of the table first; we can't print with it locked,
+ * because printing takes locks.
+ */
+void
+lockstat_print(unsigned max)
+{
+	struct lockstat_class *snap, *lc, tmp;
+	char name[LOCKSTAT_NAMELEN + 16];
+	unsigned i, j, n, best;
+	int s;
+
+	snap = kmalloc((LOCKSTAT_CLASSES + 1) * sizeof(*snap));
+	if (snap == NULL) {
+		kprintf("lockstat: Out of memory\n");
+		return;
+	}
+
+	n = 0;
+	s = lockstat_lock();
+	for (i=0; i<LOCKSTAT_CLASSES; i++) {
+		if (lockstat_classes[i].lc_acquires > 0) {
+			snap[n++] = lockstat_classes[i];
+		}
+	}
+	if (lockstat_overflow.lc_acquires > 0) {
+		snap[n++] = lockstat_overflow;
+	}
+	lockstat_unlock(s);
+
+	if (max > n) {
+		max = n;
+	}
+
+	/* Partial selection sort: we only need the top MAX. */
+	for (i=0; i<max; i++) {
+		best = i;
+		for (j=i+1; j<n; j++) {
+			if (snap[j].lc_waitnsecs > snap[best].lc_waitnsecs ||
+			    (snap[j].lc_waitnsecs == snap[best].lc_waitnsecs &&
+			     snap[j].lc_contended > snap[best].lc_contended)) {
+				best = j;
+			}
+		}
+		tmp = snap[i];
+		snap[i] = snap[best];
+		snap[best] = tmp;
+	}
+
+	kprintf("lockstat: %u lock classes seen; top %u by wait time:\n",
+		n, max);
+	kprintf("%-32s %10s %10s %12s %12s\n", "lock", "acquires",
+		"contended", "wait(us)", "maxhold(us)");
+	for (i=0; i<max; i++) {
+		lc = &snap[i];
+		if (lc->lc_site != NULL) {
+			snprintf(name, sizeof(name), "%s@%p",
+				 lc->lc_name, lc->lc_site);
+		}
+		else {
+			snprintf(name, sizeof(name), "%s", lc->lc_name);
+		}
+		kprintf("%-32s %10llu %10llu %12llu %12llu\n", name,
+			lc->lc_acquires, lc->lc_contended,
+			lc->lc_waitnsecs / 1000, lc->lc_maxhold / 1000);
+	}
+
+	kfree(snap);
+}
+
+/*
+ * Zero all the counters. (Classes stay, since locks point to them.)
+ */
+void
+lockstat_reset(void)
+{
+	struct lockstat_class *lc;
+	unsigned i;
+	int s;
+
+	s = lockstat_lock();
+	for (i=0; i<=LOCKSTAT_CLASSES; i++) {
+		lc = (i < LOCKSTAT_CLASSES) ?
+			&lockstat_classes[i] : &lockstat_overflow;
+		lc->lc_acquires = 0;
+		lc->lc_contended = 0;
+		lc->lc_waitnsecs = 0;
+		lc->lc_maxhold = 0;
+	}
+	lockstat_unlock(s);
+}
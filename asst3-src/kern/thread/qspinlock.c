@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <qspinlock.h>
+#include <membar.h>
+#include <current.h>	/* for curcpu */
+
+/*
+ * Queued (MCS) spinlocks.
+ */
+
+/*
+ * Wait nodes for use before curcpu is set up. Only the boot cpu is
+ * running then, so one set is enough.
+ */
+static struct qspinlock_node qspinlock_bootnodes[QSPINLOCK_NODES];
+static unsigned qspinlock_bootnodes_used;
+
+/*
+ * Get a free wait node for this cpu. Interrupts must be off.
+ *
+ * We can't just index the node array by the number of locks held,
+ * because locks aren't always released in the reverse order they
+ * were taken; so keep a bitmap of nodes in use.
+ */
+static
+struct qspinlock_node *
+qspinlock_getnode(void)
+{
+	struct qspinlock_node *nodes;
+	unsigned *used;
+	unsigned i;
+
+	if (CURCPU_EXISTS()) {
+		nodes = curcpu->c_qnodes;
+		used = &curcpu->c_qnodes_used;
+	}
+	else {
+		nodes = qspinlock_bootnodes;
+		used = &qspinlock_bootnodes_used;
+	}
+
+	for (i=0; i<QSPINLOCK_NODES; i++) {
+		if ((*used & (1U << i)) == 0) {
+			*used |= 1U << i;
+			return &nodes[i];
+		}
+	}
+	panic("qspinlock: too many qspinlocks held at once\n");
+}
+
+/*
+ * Return a wait node. It must belong to the current cpu (or be a boot
+ * node), which it does because qspinlocks are held by cpus.
+ */
+static
+void
+qspinlock_putnode(struct qspinlock_node *node)
+{
+	struct qspinlock_node *nodes;
+	unsigned *used;
+	unsigned i;
+
+	if (node >= qspinlock_bootnodes &&
+	    node < qspinlock_bootnodes + QSPINLOCK_NODES) {
+		nodes = qspinlock_bootnodes;
+		used = &qspinlock_bootnodes_used;
+	}
+	else {
+		KASSERT(CURCPU_EXISTS());
+		nodes = curcpu->c_qnodes;
+		used = &curcpu->c_qnodes_used;
+	}
+
+	i = node - nodes;
+	KASSERT(i < QSPINLOCK_NODES);
+	KASSERT((*used & (1U << i)) != 0);
+	*used &= ~(1U << i);
+}
+
+/*
+ * Initialize qspinlock.
+ */
+void
+qspinlock_init(struct qspinlock *qsplk)
+{
+	qsplk->qsplk_tail = NULL;
+	qsplk->qsplk_node = NULL;
+	qsplk->qsplk_holder = NULL;
+	LOCKSTAT_INIT(&qsplk->qsplk_lockstat, NULL);
+	HANGMAN_LOCKABLEINIT(&qsplk->qsplk_hangman, "qspinlock");
+}
+
+/*
+ * Clean up qspinlock.
+ */
+void
+qspinlock_cleanup(struct qspinlock *qsplk)
+{
+	KASSERT(qsplk->qsplk_holder == NULL);
+	KASSERT(qsplk->qsplk_tail == NULL);
+}
+
+/*
+ * Get the lock.
+ *
+ * As with spinlocks, first disable interrupts. Then put our wait node
+ * on the end of the queue. If there was nobody ahead of us we have
+ * the lock; otherwise link ourselves in behind our predecessor and
+ * spin on our own node until it hands the lock over.
+ */
+void
+qspinlock_acquire(struct qspinlock *qsplk)
+{
+	struct cpu *mycpu;
+	struct qspinlock_node *node, *pred;
+	LOCKSTAT_WAITVAR(waitstart);
+
+	splraise(IPL_NONE, IPL_HIGH);
+
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		mycpu = curcpu->c_self;
+		if (qsplk->qsplk_holder == mycpu) {
+			panic("Deadlock on qspinlock %p\n", qsplk);
+		}
+		mycpu->c_spinlocks++;
+
+		HANGMAN_WAIT(&curcpu->c_hangman, &qsplk->qsplk_hangman);
+	}
+	else {
+		mycpu = NULL;
+	}
+
+	node = qspinlock_getnode();
+	node->qn_next = NULL;
+	node->qn_wait = 1;
+	membar_store_store();
+
+	pred = spinlock_ptr_swap((void *volatile *)&qsplk->qsplk_tail, node);
+	if (pred != NULL) {
+		LOCKSTAT_WAIT(waitstart);
+		pred->qn_next = node;
+		while (node->qn_wait) {
+			/* spin */
+		}
+	}
+
+	membar_any_any();
+	qsplk->qsplk_node = node;
+	qsplk->qsplk_holder = mycpu;
+
+	if (CURCPU_EXISTS()) {
+		HANGMAN_ACQUIRE(&curcpu->c_hangman, &qsplk->qsplk_hangman);
+		LOCKSTAT_SITEACQUIRE(&qsplk->qsplk_lockstat, "qspinlock",
+				     waitstart);
+	}
+}
+
+/*
+ * Release the lock.
+ *
+ * If nobody is queued behind us, swing the tail back to empty. If
+ * that fails, somebody has just swapped themselves in but hasn't
+ * linked themselves to our node yet; wait for that to happen. Then
+ * hand the lock to the next node.
+ */
+void
+qspinlock_release(struct qspinlock *qsplk)
+{
+	struct qspinlock_node *node, *next;
+
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		KASSERT(qsplk->qsplk_holder == curcpu->c_self);
+		KASSERT(curcpu->c_spinlocks > 0);
+		curcpu->c_spinlocks--;
+		HANGMAN_RELEASE(&curcpu->c_hangman, &qsplk->qsplk_hangman);
+		LOCKSTAT_RELEASE(&qsplk->qsplk_lockstat);
+	}
+
+	node = qsplk->qsplk_node;
+	KASSERT(node != NULL);
+	qsplk->qsplk_node = NULL;
+	qsplk->qsplk_holder = NULL;
+	membar_any_store();
+
+	next = node->qn_next;
+	if (next == NULL) {
+		if (spinlock_ptr_cas((void *volatile *)&qsplk->qsplk_tail,
+				     node, NULL)) {
+			goto done;
+		}
+		while ((next = node->qn_next) == NULL) {
+			/* spin */
+		}
+	}
+	next->qn_wait = 0;
+
+ done:
+	qspinlock_putnode(node);
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+/*
+ * Check if the current cpu holds the lock.
+ */
+bool
+qspinlock_do_i_hold(struct qspinlock *qsplk)
+{
+	if (!CURCPU_EXISTS()) {
+		return true;
+	}
+
+	/* Assume we can read qsplk_holder atomically enough for this */
+	return (qsplk->qsplk_holder == curcpu->c_self);
+}
@@ -52,6 +52,7 @@ spinlock_init(struct spinlock *splk)
 {
 	spinlock_data_set(&splk->splk_lock, 0);
 	splk->splk_holder = NULL;
+	LOCKSTAT_INIT(&splk->splk_lockstat, NULL);
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
 }
 
@@ -76,6 +77,7 @@ void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	LOCKSTAT_WAITVAR(waitstart);
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -105,9 +107,11 @@ spinlock_acquire(struct spinlock *splk)
 		 * we don't.
 		 */
 		if (spinlock_data_get(&splk->splk_lock) != 0) {
+			LOCKSTAT_WAIT(waitstart);
 			continue;
 		}
 		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
+			LOCKSTAT_WAIT(waitstart);
 			continue;
 		}
 		break;
@@ -118,6 +122,8 @@ spinlock_acquire(struct spinlock *splk)
 
 	if (CURCPU_EXISTS()) {
 		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
+		LOCKSTAT_SITEACQUIRE(&splk->splk_lockstat, "spinlock",
+				     waitstart);
 	}
 }
 
@@ -133,6 +139,7 @@ spinlock_release(struct spinlock *splk)
 		KASSERT(curcpu->c_spinlocks > 0);
 		curcpu->c_spinlocks--;
 		HANGMAN_RELEASE(&curcpu->c_hangman, &splk->splk_hangman);
+		LOCKSTAT_RELEASE(&splk->splk_lockstat);
 	}
 
 	splk->splk_holder = NULL;
@@ -36,10 +36,19 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
+#include <cpu.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
 
+/*
+ * Maximum number of times lock_acquire checks the lock while spinning
+ * before it gives up and sleeps. This should be a few times the cost
+ * of a typical short critical section; anything longer than a context
+ * switch or two is better off sleeping.
+ */
+#define LOCK_SPIN_MAX	500
+
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
@@ -155,6 +164,7 @@ lock_create(const char *name)
 	}
 
 	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
+	LOCKSTAT_INIT(&lock->lk_lockstat, lock->lk_name);
 
 	lock->lk_wchan = wchan_create(lock->lk_name);
 	if (lock->lk_wchan == NULL) {
@@ -164,6 +174,7 @@ lock_create(const char *name)
 	}
 	spinlock_init(&lock->lk_lock);
 	lock->lk_holder = NULL;
+	lock->lk_holdercpu = NULL;
 
 	return lock;
 }
@@ -181,9 +192,74 @@ lock_destroy(struct lock *lock)
 	kfree(lock);
 }
 
+/*
+ * Is HOLDER still running on THATCPU, the cpu it acquired the lock
+ * on? This is racy and only a hint. HOLDER may release the lock,
+ * exit, and be freed while we look, so it's only ever compared, never
+ * dereferenced; cpus are never freed. (If it has moved to another
+ * cpu since, we just stop spinning.)
+ */
+static
+bool
+lock_holder_oncpu(struct thread *holder, struct cpu *thatcpu)
+{
+	if (thatcpu == NULL || thatcpu == curcpu->c_self) {
+		return false;
+	}
+	return ((struct thread *volatile)thatcpu->c_curthread) == holder;
+}
+
+/*
+ * Adaptive spinning. Called from lock_acquire, with the lock's
+ * spinlock held, when the lock is busy. If the holder is running on
+ * another cpu, it will probably release the lock soon; in that case
+ * drop the spinlock and watch lk_holder for a while instead of going
+ * to sleep, which costs two context switches.
+ *
+ * Returns true if the lock was seen free (the caller should then
+ * look again instead of sleeping), false if the caller should sleep.
+ * Either way the spinlock is held again on return.
+ */
+static
+bool
+lock_spin(struct lock *lock)
+{
+	struct thread *holder;
+	struct cpu *thatcpu;
+	unsigned i;
+
+	holder = lock->lk_holder;
+	if (holder == NULL) {
+		return true;
+	}
+	thatcpu = lock->lk_holdercpu;
+	if (!lock_holder_oncpu(holder, thatcpu)) {
+		return false;
+	}
+
+	spinlock_release(&lock->lk_lock);
+	for (i=0; i<LOCK_SPIN_MAX; i++) {
+		if (lock->lk_holder != holder) {
+			break;
+		}
+		if (!lock_holder_oncpu(holder, thatcpu)) {
+			break;
+		}
+	}
+	spinlock_acquire(&lock->lk_lock);
+
+	/*
+	 * If the lock changed hands to somebody else still running
+	 * (or got freed) we'll come back here and spin again.
+	 */
+	return lock->lk_holder != holder;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
+	LOCKSTAT_WAITVAR(waitstart);
+
 	DEBUGASSERT(lock != NULL);
 	KASSERT(curthread->t_in_interrupt == false);
 
@@ -194,13 +270,19 @@ lock_acquire(struct lock *lock)
 
 	KASSERT(lock->lk_holder != curthread);
 	while (lock->lk_holder != NULL) {
+		LOCKSTAT_WAIT(waitstart);
+		if (lock_spin(lock)) {
+			continue;
+		}
 		/* As in the semaphore. */
 		wchan_sleep(lock->lk_wchan, &lock->lk_lock);
 	}
 	lock->lk_holder = curthread;
+	lock->lk_holdercpu = curcpu->c_self;
 
 	/* Call this (atomically) once the lock is acquired */
 	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+	LOCKSTAT_ACQUIRE(&lock->lk_lockstat, waitstart);
 
 	spinlock_release(&lock->lk_lock);
 }
@@ -214,10 +296,12 @@ lock_release(struct lock *lock)
 
 	KASSERT(lock->lk_holder == curthread);
 	lock->lk_holder = NULL;
+	lock->lk_holdercpu = NULL;
 	wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
 
 	/* Call this (atomically) when the lock is released */
 	HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
+	LOCKSTAT_RELEASE(&lock->lk_lockstat);
 
 	spinlock_release(&lock->lk_lock);
 }
@@ -307,11 +391,227 @@ cv_signal(struct cv *cv, struct lock *lock)
 	spinlock_release(&cv->cv_wchanlock);
 }
 
+/*
+ * Waking everyone on the CV while we hold the lock would only have
+ * them all run straight into lock_acquire and, all but one, go back
+ * to sleep on the lock. Instead move them onto the lock's wait
+ * channel (wait morphing): lock_release then wakes them one at a
+ * time. Each still goes through lock_acquire after waking, so this
+ * is invisible to cv_wait.
+ *
+ * The spinlock order cv_wchanlock -> lk_lock is the same one cv_wait
+ * uses.
+ */
 void
 cv_broadcast(struct cv *cv, struct lock *lock)
 {
-	(void)lock;
 	spinlock_acquire(&cv->cv_wchanlock);
-	wchan_wakeall(cv->cv_wchan, &cv->cv_wchanlock);
+	spinlock_acquire(&lock->lk_lock);
+	if (lock->lk_holder == curthread) {
+		wchan_moveall(cv->cv_wchan, &cv->cv_wchanlock,
+			      lock->lk_wchan, &lock->lk_lock);
+	}
+	else {
+		wchan_wakeall(cv->cv_wchan, &cv->cv_wchanlock);
+	}
+	spinlock_release(&lock->lk_lock);
 	spinlock_release(&cv->cv_wchanlock);
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rw_name = kstrdup(name);
+	if (rw->rw_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	HANGMAN_LOCKABLEINIT(&rw->rw_hangman, rw->rw_name);
+	LOCKSTAT_INIT(&rw->rw_lockstat, rw->rw_name);
+
+	rw->rw_rdwchan = wchan_create(rw->rw_name);
+	if (rw->rw_rdwchan == NULL) {
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+	rw->rw_wrwchan = wchan_create(rw->rw_name);
+	if (rw->rw_wrwchan == NULL) {
+		wchan_destroy(rw->rw_rdwchan);
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rw_lock);
+	rw->rw_writer = NULL;
+	rw->rw_readers = 0;
+	rw->rw_rdwaiting = 0;
+	rw->rw_wrwaiting = 0;
+	rw->rw_rdadmit = 0;
+	rw->rw_rdgen = 0;
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_rdwaiting == 0);
+	KASSERT(rw->rw_wrwaiting == 0);
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_wrwchan);
+	wchan_destroy(rw->rw_rdwchan);
+
+	kfree(rw->rw_name);
+	kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	unsigned gen;
+	LOCKSTAT_WAITVAR(waitstart);
+
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+
+	if (rw->rw_writer != NULL || rw->rw_wrwaiting > 0) {
+		HANGMAN_WAIT(&curthread->t_hangman, &rw->rw_hangman);
+		LOCKSTAT_WAIT(waitstart);
+
+		/*
+		 * Wait until there's no writer and either no writers
+		 * are waiting either, or a writer has released the
+		 * lock since we got here (which lets in our batch).
+		 */
+		gen = rw->rw_rdgen;
+		rw->rw_rdwaiting++;
+		while (rw->rw_writer != NULL ||
+		       (rw->rw_wrwaiting > 0 && rw->rw_rdgen == gen)) {
+			wchan_sleep(rw->rw_rdwchan, &rw->rw_lock);
+		}
+		rw->rw_rdwaiting--;
+		if (rw->rw_rdgen != gen) {
+			KASSERT(rw->rw_rdadmit > 0);
+			rw->rw_rdadmit--;
+		}
+
+		HANGMAN_WAITDONE(&curthread->t_hangman, &rw->rw_hangman);
+	}
+	rw->rw_readers++;
+	LOCKSTAT_ACQUIRE(&rw->rw_lockstat, waitstart);
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rw->rw_readers > 0);
+	rw->rw_readers--;
+	if (rw->rw_readers == 0 && rw->rw_rdadmit == 0 &&
+	    rw->rw_wrwaiting > 0) {
+		wchan_wakeone(rw->rw_wrwchan, &rw->rw_lock);
+	}
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	LOCKSTAT_WAITVAR(waitstart);
+
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+
+	/* Call this (atomically) before waiting for the lock */
+	HANGMAN_WAIT(&curthread->t_hangman, &rw->rw_hangman);
+
+	KASSERT(rw->rw_writer != curthread);
+	rw->rw_wrwaiting++;
+	while (rw->rw_writer != NULL || rw->rw_readers > 0 ||
+	       rw->rw_rdadmit > 0) {
+		LOCKSTAT_WAIT(waitstart);
+		wchan_sleep(rw->rw_wrwchan, &rw->rw_lock);
+	}
+	rw->rw_wrwaiting--;
+	rw->rw_writer = curthread;
+
+	/* Call this (atomically) once the lock is acquired */
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &rw->rw_hangman);
+	LOCKSTAT_ACQUIRE(&rw->rw_lockstat, waitstart);
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+
+	KASSERT(rw->rw_writer == curthread);
+	rw->rw_writer = NULL;
+
+	/*
+	 * If readers are waiting, let all of them in before the next
+	 * writer; otherwise pass the lock to the next writer.
+	 */
+	if (rw->rw_rdwaiting > 0) {
+		rw->rw_rdgen++;
+		rw->rw_rdadmit = rw->rw_rdwaiting;
+		wchan_wakeall(rw->rw_rdwchan, &rw->rw_lock);
+	}
+	else if (rw->rw_wrwaiting > 0) {
+		wchan_wakeone(rw->rw_wrwchan, &rw->rw_lock);
+	}
+
+	/* Call this (atomically) when the lock is released */
+	HANGMAN_RELEASE(&curthread->t_hangman, &rw->rw_hangman);
+	LOCKSTAT_RELEASE(&rw->rw_lockstat);
+
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	bool ret;
+
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	ret = (rw->rw_writer == curthread);
+	spinlock_release(&rw->rw_lock);
+
+	return ret;
+}
@@ -42,6 +42,7 @@
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <qspinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <threadlist.h>
@@ -53,11 +54,29 @@
 #include <mainbus.h>
 #include <vnode.h>
 #include <pid.h>
+#include <ktrace.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/* Length of the scheduling quantum, in hardclocks, at each level. */
+#define SCHED_QUANTUM(level)	(2U << (level))
+
+/*
+ * Work stealing tuning. An idle cpu only steals from a cpu that has
+ * at least STEAL_MIN_READY threads waiting, so the victim doesn't
+ * go idle in turn, and only takes a thread that has been waiting for
+ * at least STEAL_AFFINITY_HARDCLOCKS. A thread that was queued just
+ * now probably still has its working set in the victim's cache and
+ * will get to run there soon anyway.
+ */
+#define STEAL_MIN_READY			2
+#define STEAL_AFFINITY_HARDCLOCKS	1
+
+/* Max number of dead threads (with stacks) each cpu keeps for reuse. */
+#define THREAD_CACHE_MAX	8
+
 /* Wait channel. A wchan is protected by an associated, passed-in spinlock. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -111,6 +130,41 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Initialize the fields of a new thread, other than the name and the
+ * stack. This is shared by thread_create and thread_cache_get.
+ */
+static
+void
+thread_init(struct thread *thread)
+{
+	thread->t_wchan_name = "NEW";
+	thread->t_state = S_READY;
+
+	/* Thread subsystem fields */
+	thread_machdep_init(&thread->t_machdep);
+	threadlistnode_init(&thread->t_listnode, thread);
+	thread->t_context = NULL;
+	thread->t_cpu = NULL;
+	thread->t_proc = NULL;
+	thread->t_tid = 0;
+	kusage_init(&thread->t_usage);
+	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
+
+	/* New threads start out at the top priority level */
+	thread->t_priority = 0;
+	thread->t_quantum = SCHED_QUANTUM(0);
+	thread->t_readyclock = 0;
+
+	/* Interrupt state fields */
+	thread->t_in_interrupt = false;
+	thread->t_intr_fromuser = false;
+	thread->t_curspl = IPL_HIGH;
+	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
+
+	/* If you add to struct thread, be sure to initialize here */
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -133,24 +187,82 @@ thread_create(const char *name)
 		kfree(thread);
 		return NULL;
 	}
-	thread->t_wchan_name = "NEW";
-	thread->t_state = S_READY;
-
-	/* Thread subsystem fields */
-	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
 	thread->t_stack = NULL;
-	thread->t_context = NULL;
-	thread->t_cpu = NULL;
-	thread->t_proc = NULL;
-	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
+	thread_init(thread);
 
-	/* Interrupt state fields */
-	thread->t_in_interrupt = false;
-	thread->t_curspl = IPL_HIGH;
-	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
+	return thread;
+}
 
-	/* If you add to struct thread, be sure to initialize here */
+/*
+ * Per-cpu cache of dead threads, with their stacks, for thread_fork
+ * to reuse instead of allocating new ones.
+ *
+ * thread_destroy puts threads here after cleaning them up, up to
+ * THREAD_CACHE_MAX per cpu, and thread_fork takes them back out. The
+ * stack guard band is checked on the way in and rewritten by
+ * thread_fork on the way out, so overflows are still caught. Cached
+ * threads keep their name string too: most threads are forked with
+ * their parent's name, so a hit usually needs no allocation at all.
+ *
+ * The cache belongs to the cpu; it's only touched with interrupts
+ * off, so we can't be preempted and migrate in the middle.
+ */
+static
+bool
+thread_cache_put(struct thread *thread)
+{
+	struct cpu *c;
+	bool ret;
+	int spl;
+
+	KASSERT(thread->t_stack != NULL);
+	thread_checkstack(thread);
+
+	spl = splhigh();
+	c = curcpu->c_self;
+	ret = c->c_threadcache.tl_count < THREAD_CACHE_MAX;
+	if (ret) {
+		threadlistnode_init(&thread->t_listnode, thread);
+		threadlist_addhead(&c->c_threadcache, thread);
+	}
+	splx(spl);
+
+	return ret;
+}
+
+static
+struct thread *
+thread_cache_get(const char *name)
+{
+	struct thread *thread;
+	char *tname;
+	int spl;
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	splx(spl);
+
+	if (thread == NULL) {
+		return NULL;
+	}
+	threadlistnode_cleanup(&thread->t_listnode);
+	KASSERT(thread->t_stack != NULL);
+	KASSERT(thread->t_name != NULL);
+
+	if (strcmp(thread->t_name, name) != 0) {
+		tname = kstrdup(name);
+		if (tname == NULL) {
+			if (!thread_cache_put(thread)) {
+				kfree(thread->t_name);
+				kfree(thread->t_stack);
+				kfree(thread);
+			}
+			return NULL;
+		}
+		kfree(thread->t_name);
+		thread->t_name = tname;
+	}
+	thread_init(thread);
 
 	return thread;
 }
@@ -169,6 +281,7 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
@@ -180,12 +293,16 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_threadcache);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_qnodes_used = 0;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	for (i=0; i<SCHED_LEVELS; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	qspinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -277,16 +394,21 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
+	/* Keep it (and its stack and name) for reuse if we can. */
+	if (thread->t_stack != NULL) {
+		if (thread_cache_put(thread)) {
+			return;
+		}
+		kfree(thread->t_stack);
+	}
 	kfree(thread->t_name);
+	thread->t_name = NULL;
 	kfree(thread);
 }
 
@@ -317,6 +439,8 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -331,9 +455,13 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<SCHED_LEVELS; i++) {
+		curcpu->c_runqueue[i].tl_count = 0;
+		curcpu->c_runqueue[i].tl_head.tln_next =
+			&curcpu->c_runqueue[i].tl_tail;
+		curcpu->c_runqueue[i].tl_tail.tln_prev =
+			&curcpu->c_runqueue[i].tl_head;
+	}
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -445,6 +573,193 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Return the number of cpus.
+ */
+unsigned
+thread_numcpus(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+/*
+ * Run queue helpers. The run queue of a cpu is an array of thread
+ * lists, one per priority level; all of these must be called with
+ * the cpu's runqueue lock held.
+ */
+
+/* Put a thread on the tail of the list for its priority level. */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(qspinlock_do_i_hold(&c->c_runqueue_lock));
+	KASSERT(t->t_priority < SCHED_LEVELS);
+	t->t_readyclock = c->c_hardclocks;
+	threadlist_addtail(&c->c_runqueue[t->t_priority], t);
+}
+
+/* Take the first thread from the highest nonempty level. */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	KASSERT(qspinlock_do_i_hold(&c->c_runqueue_lock));
+	for (i=0; i<SCHED_LEVELS; i++) {
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/* Take the last thread from the lowest nonempty level. */
+static
+struct thread *
+runqueue_remtail(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	KASSERT(qspinlock_do_i_hold(&c->c_runqueue_lock));
+	for (i=SCHED_LEVELS; i-- > 0; ) {
+		t = threadlist_remtail(&c->c_runqueue[i]);
+		if (t != NULL) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/* Count the ready threads at all levels. */
+static
+unsigned
+runqueue_count(struct cpu *c)
+{
+	unsigned i, count;
+
+	KASSERT(qspinlock_do_i_hold(&c->c_runqueue_lock));
+	count = 0;
+	for (i=0; i<SCHED_LEVELS; i++) {
+		count += c->c_runqueue[i].tl_count;
+	}
+	return count;
+}
+
+/*
+ * Same, but without the lock. The answer may be stale by the time
+ * the caller looks at it, so it is only good for choosing which run
+ * queue is worth locking.
+ */
+static
+unsigned
+runqueue_peekcount(struct cpu *c)
+{
+	unsigned i, count;
+
+	count = 0;
+	for (i=0; i<SCHED_LEVELS; i++) {
+		count += ((volatile struct threadlist *)&c->c_runqueue[i])->tl_count;
+	}
+	return count;
+}
+
+/*
+ * Take a thread off another cpu's run queue for an idle cpu to run,
+ * or return NULL if there isn't one we should take. We only ever
+ * look at the very last thread (the tail of the lowest nonempty
+ * level), since that's the one the victim would run last.
+ */
+static
+struct thread *
+runqueue_steal(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	KASSERT(qspinlock_do_i_hold(&c->c_runqueue_lock));
+	if (runqueue_count(c) < STEAL_MIN_READY) {
+		return NULL;
+	}
+
+	for (i=SCHED_LEVELS; i-- > 0; ) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			break;
+		}
+	}
+	t = c->c_runqueue[i].tl_tail.tln_prev->tln_self;
+	KASSERT(t != NULL);
+
+	/*
+	 * Don't take the victim's curthread; see the comment in
+	 * thread_consider_migration. And don't take a thread that has
+	 * only just been queued, for cache affinity.
+	 */
+	if (t == c->c_curthread ||
+	    c->c_hardclocks - t->t_readyclock < STEAL_AFFINITY_HARDCLOCKS) {
+		return NULL;
+	}
+
+	threadlist_remove(&c->c_runqueue[i], t);
+	return t;
+}
+
+/*
+ * Work stealing.
+ *
+ * This is called from the idle loop in thread_switch when the
+ * current cpu's own run queue is empty, and again after every
+ * interrupt that wakes the cpu while it has nothing to do. Pick the
+ * most heavily loaded other cpu (by unlocked peeking, so we only
+ * have to take one other run queue lock) and pull a thread from the
+ * tail of its run queue. Returns NULL if nothing could be stolen.
+ *
+ * The caller must not hold its own runqueue lock; we never hold two
+ * runqueue locks at once.
+ */
+static
+struct thread *
+thread_steal(void)
+{
+	unsigned i, numcpus, count, best;
+	struct cpu *c, *victim;
+	struct thread *t;
+
+	KASSERT(!qspinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	numcpus = cpuarray_num(&allcpus);
+	victim = NULL;
+	best = STEAL_MIN_READY - 1;
+	/* Start with the next cpu so idle cpus don't all gang up on one */
+	for (i=1; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, (curcpu->c_number + i) % numcpus);
+		count = runqueue_peekcount(c);
+		if (count > best) {
+			best = count;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	qspinlock_acquire(&victim->c_runqueue_lock);
+	t = runqueue_steal(victim);
+	qspinlock_release(&victim->c_runqueue_lock);
+	if (t == NULL) {
+		return NULL;
+	}
+
+	t->t_cpu = curcpu->c_self;
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+	      t->t_name, victim->c_number, curcpu->c_number);
+	return t;
+}
+
 /*
  * Make a thread runnable.
  *
@@ -461,15 +776,15 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 
 	if (already_have_lock) {
 		/* The target thread's cpu should be already locked. */
-		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+		KASSERT(qspinlock_do_i_hold(&targetcpu->c_runqueue_lock));
 	}
 	else {
-		spinlock_acquire(&targetcpu->c_runqueue_lock);
+		qspinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 
 	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
 		/*
@@ -480,7 +795,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 
 	if (!already_have_lock) {
-		spinlock_release(&targetcpu->c_runqueue_lock);
+		qspinlock_release(&targetcpu->c_runqueue_lock);
 	}
 }
 
@@ -503,16 +818,20 @@ thread_fork(const char *name,
 	struct thread *newthread;
 	int result;
 
-	newthread = thread_create(name);
+	/* Reuse a dead thread and its stack if we have one handy */
+	newthread = thread_cache_get(name);
 	if (newthread == NULL) {
-		return ENOMEM;
-	}
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		/* Allocate a stack */
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
 	}
 	thread_checkstack_init(newthread);
 
@@ -588,11 +907,11 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	thread_checkstack(cur);
 
 	/* Lock the run queue. */
-	spinlock_acquire(&curcpu->c_runqueue_lock);
+	qspinlock_acquire(&curcpu->c_runqueue_lock);
 
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
-		spinlock_release(&curcpu->c_runqueue_lock);
+	if (newstate == S_READY && runqueue_count(curcpu) == 0) {
+		qspinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
 	}
@@ -624,6 +943,15 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	}
 	cur->t_state = newstate;
 
+	/* Being preempted shows up here as a yield from the hardclock. */
+	if (newstate == S_SLEEP ||
+	    (newstate == S_READY && !cur->t_in_interrupt)) {
+		cur->t_usage.ku_nvcsw++;
+	}
+	else if (newstate == S_READY) {
+		cur->t_usage.ku_nivcsw++;
+	}
+
 	/*
 	 * Get the next thread. While there isn't one, call cpu_idle().
 	 * curcpu->c_isidle must be true when cpu_idle is
@@ -644,15 +972,21 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu);
 		if (next == NULL) {
-			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
-			spinlock_acquire(&curcpu->c_runqueue_lock);
+			qspinlock_release(&curcpu->c_runqueue_lock);
+			next = thread_steal();
+			if (next == NULL) {
+				cpu_idle();
+			}
+			qspinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	KTRACE(KTRACE_SWITCH, next, newstate, cur->t_priority,
+	       next->t_priority);
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -718,7 +1052,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_state = S_RUN;
 
 	/* Unlock the run queue. */
-	spinlock_release(&curcpu->c_runqueue_lock);
+	qspinlock_release(&curcpu->c_runqueue_lock);
 
 	/* Activate our address space in the MMU. */
 	as_activate();
@@ -751,7 +1085,7 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	cur->t_state = S_RUN;
 
 	/* Release the runqueue lock acquired in thread_switch. */
-	spinlock_release(&curcpu->c_runqueue_lock);
+	qspinlock_release(&curcpu->c_runqueue_lock);
 
 	/* Activate our address space in the MMU. */
 	as_activate();
@@ -821,17 +1155,116 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multi-level feedback queue. Each cpu has SCHED_LEVELS
+ * run queues; the scheduler always picks the first thread from the
+ * highest-priority nonempty one, and threads within a level run
+ * round-robin. The rules are:
+ *
+ *    - New threads start at the top level.
+ *    - A thread that uses up its whole quantum (which doubles at
+ *      each level down) is demoted one level.
+ *    - A thread that is woken up from a wait channel (that is, it
+ *      gave up the cpu to wait for something instead of running)
+ *      moves up one level and gets a fresh quantum.
+ *    - A thread that is running is preempted at the next hardclock
+ *      if a thread of higher priority becomes ready.
+ *    - Periodically (schedule() below) everything is moved back to
+ *      the top level, so CPU-bound threads can't starve and threads
+ *      whose behavior changes get reclassified.
+ *
+ * The effect is that interactive jobs, which mostly sleep, stay near
+ * the top and get the cpu promptly when they wake up, while CPU hogs
+ * sink to the bottom and run with long quanta when nothing else wants
+ * to.
  */
 
+/*
+ * Credit a thread that was waiting rather than running. Called when
+ * it is taken off a wait channel, at which point nobody else can be
+ * looking at its scheduler fields.
+ */
+static
+void
+thread_wakeup_boost(struct thread *t)
+{
+	if (t->t_priority > 0) {
+		t->t_priority--;
+	}
+	t->t_quantum = SCHED_QUANTUM(t->t_priority);
+}
+
+/*
+ * Priority reset. This is called periodically from hardclock(); it
+ * moves every ready thread on the current cpu's run queue (and the
+ * current thread) back to the top level.
+ */
 void
 schedule(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct thread *t;
+	unsigned i;
+
+	qspinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=1; i<SCHED_LEVELS; i++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i])) != NULL) {
+			t->t_priority = 0;
+			t->t_quantum = SCHED_QUANTUM(0);
+			threadlist_addtail(&curcpu->c_runqueue[0], t);
+		}
+	}
+	qspinlock_release(&curcpu->c_runqueue_lock);
+
+	if (!curcpu->c_isidle) {
+		curthread->t_priority = 0;
+		curthread->t_quantum = SCHED_QUANTUM(0);
+	}
+}
+
+/*
+ * Quantum accounting. This is called on every hardclock.
+ *
+ * If the current thread has used up its quantum, demote it and yield.
+ * Otherwise keep running it, unless something of higher priority has
+ * become ready in the meantime.
+ */
+void
+thread_quantum_tick(void)
+{
+	struct thread *cur;
+	bool preempt;
+	unsigned i;
+
+	/* Nothing to charge if we interrupted the idle loop. */
+	if (curcpu->c_isidle) {
+		return;
+	}
+
+	cur = curthread;
+	KASSERT(cur->t_quantum > 0);
+
+	cur->t_quantum--;
+	if (cur->t_quantum == 0) {
+		if (cur->t_priority < SCHED_LEVELS - 1) {
+			cur->t_priority++;
+		}
+		cur->t_quantum = SCHED_QUANTUM(cur->t_priority);
+		thread_yield();
+		return;
+	}
+
+	preempt = false;
+	qspinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=0; i<cur->t_priority; i++) {
+		if (!threadlist_isempty(&curcpu->c_runqueue[i])) {
+			preempt = true;
+			break;
+		}
+	}
+	qspinlock_release(&curcpu->c_runqueue_lock);
+
+	if (preempt) {
+		thread_yield();
+	}
 }
 
 /*
@@ -854,22 +1287,26 @@ schedule(void)
 void
 thread_consider_migration(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
+	unsigned my_count, total_count, one_share, to_send, count;
 	unsigned i, numcpus;
 	struct cpu *c;
 	struct threadlist victims;
 	struct thread *t;
 
+	/*
+	 * The counts are only a snapshot (we don't lock everything at
+	 * once) so there's no point taking each cpu's runqueue lock in
+	 * turn just to read them.
+	 */
 	my_count = total_count = 0;
 	numcpus = cpuarray_num(&allcpus);
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		count = runqueue_peekcount(c);
+		total_count += count;
 		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+			my_count = count;
 		}
-		spinlock_release(&c->c_runqueue_lock);
 	}
 
 	one_share = DIVROUNDUP(total_count, numcpus);
@@ -879,20 +1316,20 @@ thread_consider_migration(void)
 
 	to_send = my_count - one_share;
 	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
+	qspinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
+		t = runqueue_remtail(curcpu);
 		threadlist_addhead(&victims, t);
 	}
-	spinlock_release(&curcpu->c_runqueue_lock);
+	qspinlock_release(&curcpu->c_runqueue_lock);
 
 	for (i=0; i < numcpus && to_send > 0; i++) {
 		c = cpuarray_get(&allcpus, i);
 		if (c == curcpu->c_self) {
 			continue;
 		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
+		qspinlock_acquire(&c->c_runqueue_lock);
+		while (runqueue_count(c) < one_share && to_send > 0) {
 			t = threadlist_remhead(&victims);
 			/*
 			 * Ordinarily, curthread will not appear on
@@ -923,7 +1360,7 @@ thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			runqueue_add(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -936,7 +1373,7 @@ thread_consider_migration(void)
 				ipi_send(c, IPI_UNIDLE);
 			}
 		}
-		spinlock_release(&c->c_runqueue_lock);
+		qspinlock_release(&c->c_runqueue_lock);
 	}
 
 	/*
@@ -945,11 +1382,11 @@ thread_consider_migration(void)
 	 * Don't panic; just put them back on our own run queue.
 	 */
 	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
+		qspinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			runqueue_add(curcpu, t);
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+		qspinlock_release(&curcpu->c_runqueue_lock);
 	}
 
 	KASSERT(threadlist_isempty(&victims));
@@ -1045,28 +1482,35 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 	 * in thread_switch.
 	 */
 
+	thread_wakeup_boost(target);
+	KTRACE(KTRACE_WAKEUP, target, target->t_cpu->c_number, 0, 0);
 	thread_make_runnable(target, false);
 }
 
 /*
- * Wake up all threads sleeping on a wait channel.
+ * Wake up to N threads sleeping on a wait channel. Returns the number
+ * actually woken.
  */
-void
-wchan_wakeall(struct wchan *wc, struct spinlock *lk)
+unsigned
+wchan_wakeN(struct wchan *wc, struct spinlock *lk, unsigned n)
 {
 	struct thread *target;
 	struct threadlist list;
+	unsigned count;
 
 	KASSERT(spinlock_do_i_hold(lk));
 
 	threadlist_init(&list);
 
 	/*
-	 * Grab all the threads from the channel, moving them to a
+	 * Grab the threads from the channel, moving them to a
 	 * private list.
 	 */
-	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
+	count = 0;
+	while (count < n &&
+	       (target = threadlist_remhead(&wc->wc_threads)) != NULL) {
 		threadlist_addtail(&list, target);
+		count++;
 	}
 
 	/*
@@ -1075,10 +1519,53 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
+		thread_wakeup_boost(target);
+		KTRACE(KTRACE_WAKEUP, target, target->t_cpu->c_number, 0, 0);
 		thread_make_runnable(target, false);
 	}
 
 	threadlist_cleanup(&list);
+
+	return count;
+}
+
+/*
+ * Wake up all threads sleeping on a wait channel.
+ */
+void
+wchan_wakeall(struct wchan *wc, struct spinlock *lk)
+{
+	wchan_wakeN(wc, lk, (unsigned)-1);
+}
+
+/*
+ * Move all the threads sleeping on FROM over to TO, without waking
+ * them. Both spinlocks must be held. Returns the number moved.
+ *
+ * The moved threads are woken later by whoever wakes TO, but they
+ * still return from wchan_sleep holding FROMLK, the lock they went
+ * to sleep with. So this only makes sense when every sleeper on FROM
+ * immediately drops FROMLK after waking and goes on to wait for
+ * whatever TO stands for, which is what cv_wait does with the lock.
+ */
+unsigned
+wchan_moveall(struct wchan *from, struct spinlock *fromlk,
+	      struct wchan *to, struct spinlock *tolk)
+{
+	struct thread *target;
+	unsigned count;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+	KASSERT(from != to);
+
+	count = 0;
+	while ((target = threadlist_remhead(&from->wc_threads)) != NULL) {
+		target->t_wchan_name = to->wc_name;
+		threadlist_addtail(&to->wc_threads, target);
+		count++;
+	}
+	return count;
 }
 
 /*
@@ -1167,6 +1654,43 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send a TLB shootdown IPI to all other CPUs, and wait until each of
+ * them has processed its queue of shootdowns. This is for VM code
+ * that is about to reuse or free the page behind a mapping that other
+ * threads of the same address space might have loaded.
+ *
+ * Interrupts must be on: another CPU may be doing the same thing at
+ * the same time and waiting for us.
+ */
+void
+ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping)
+{
+	unsigned i, n;
+	struct cpu *c;
+
+	KASSERT(curthread->t_curspl == 0);
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown(c, mapping);
+		}
+	}
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		do {
+			spinlock_acquire(&c->c_ipi_lock);
+			n = c->c_numshootdown;
+			spinlock_release(&c->c_ipi_lock);
+		} while (n > 0);
+	}
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
@@ -1187,12 +1711,12 @@ interprocessor_interrupt(void)
 	if (bits & (1U << IPI_OFFLINE)) {
 		/* offline request */
 		spinlock_release(&curcpu->c_ipi_lock);
-		spinlock_acquire(&curcpu->c_runqueue_lock);
+		qspinlock_acquire(&curcpu->c_runqueue_lock);
 		if (!curcpu->c_isidle) {
 			kprintf("cpu%d: offline: warning: not idle\n",
 				curcpu->c_number);
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+		qspinlock_release(&curcpu->c_runqueue_lock);
 		kprintf("cpu%d: offline.\n", curcpu->c_number);
 		cpu_halt();
 	}
@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Work queues.
+ *
+ * A workqueue is an array of queues, each with its own spinlock and
+ * its own share of the worker threads: worker I serves queue
+ * I % wq_nqueues, and work queued on cpu C goes in queue
+ * C % wq_nqueues. Workers never look at other queues, so a worker
+ * sleeping on its queue's wchan can't miss work.
+ *
+ * The queues are singly linked lists through the struct work, with a
+ * tail pointer for FIFO order. A worker takes up to WQ_BATCH items
+ * off the front at once and runs them without the lock; if anything
+ * is left it wakes another worker on the same queue to help.
+ *
+ * w_pending is a bare spinlock word so that a worker can clear it
+ * (after it is done with w_next) without taking the queue lock.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <wchan.h>
+#include <synch.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <workqueue.h>
+
+/* Max number of items a worker takes at once */
+#define WQ_BATCH	16
+
+struct wq_queue {
+	struct spinlock q_lock;
+	struct work *q_head;		/* first queued item */
+	struct work **q_tailp;		/* where to link the next item */
+	unsigned q_inflight;		/* items taken but not yet done */
+	bool q_dying;			/* workers should exit when empty */
+	struct wchan *q_workwchan;	/* idle workers sleep here */
+	struct wchan *q_flushwchan;	/* flushers sleep here */
+};
+
+struct workqueue {
+	char *wq_name;
+	struct wq_queue *wq_queues;
+	unsigned wq_nqueues;
+	unsigned wq_nthreads;		/* workers running */
+	struct semaphore *wq_exitsem;	/* V'd by each exiting worker */
+};
+
+struct workqueue *system_wq;
+
+////////////////////////////////////////////////////////////
+// queues
+
+static
+int
+wq_queue_init(struct wq_queue *q, const char *name)
+{
+	q->q_workwchan = wchan_create(name);
+	if (q->q_workwchan == NULL) {
+		return ENOMEM;
+	}
+	q->q_flushwchan = wchan_create(name);
+	if (q->q_flushwchan == NULL) {
+		wchan_destroy(q->q_workwchan);
+		return ENOMEM;
+	}
+	spinlock_init(&q->q_lock);
+	q->q_head = NULL;
+	q->q_tailp = &q->q_head;
+	q->q_inflight = 0;
+	q->q_dying = false;
+	return 0;
+}
+
+static
+void
+wq_queue_cleanup(struct wq_queue *q)
+{
+	KASSERT(q->q_head == NULL);
+	KASSERT(q->q_inflight == 0);
+	spinlock_cleanup(&q->q_lock);
+	wchan_destroy(q->q_flushwchan);
+	wchan_destroy(q->q_workwchan);
+}
+
+/*
+ * Take up to WQ_BATCH items off the front of Q. Q must be locked and
+ * nonempty. Returns the first; the last has w_next set to null.
+ */
+static
+struct work *
+wq_queue_take(struct wq_queue *q)
+{
+	struct work *batch, *w;
+	unsigned n;
+
+	batch = w = q->q_head;
+	KASSERT(batch != NULL);
+	for (n = 1; n < WQ_BATCH && w->w_next != NULL; n++) {
+		w = w->w_next;
+	}
+	q->q_head = w->w_next;
+	if (q->q_head == NULL) {
+		q->q_tailp = &q->q_head;
+	}
+	w->w_next = NULL;
+	q->q_inflight += n;
+	return batch;
+}
+
+////////////////////////////////////////////////////////////
+// workers
+
+static
+void
+wq_worker(void *vwq, unsigned long index)
+{
+	struct workqueue *wq = vwq;
+	struct wq_queue *q;
+	struct work *w, *next;
+	unsigned n;
+
+	q = &wq->wq_queues[index % wq->wq_nqueues];
+
+	spinlock_acquire(&q->q_lock);
+	while (1) {
+		if (q->q_head == NULL) {
+			if (q->q_dying) {
+				break;
+			}
+			wchan_sleep(q->q_workwchan, &q->q_lock);
+			continue;
+		}
+
+		w = wq_queue_take(q);
+		if (q->q_head != NULL) {
+			wchan_wakeone(q->q_workwchan, &q->q_lock);
+		}
+		spinlock_release(&q->q_lock);
+
+		for (n = 0; w != NULL; n++, w = next) {
+			next = w->w_next;
+			/* done with w_next; now it may be queued again */
+			membar_any_store();
+			spinlock_data_set(&w->w_pending, 0);
+			w->w_func(w->w_data);
+		}
+
+		spinlock_acquire(&q->q_lock);
+		KASSERT(q->q_inflight >= n);
+		q->q_inflight -= n;
+		if (q->q_head == NULL && q->q_inflight == 0) {
+			wchan_wakeall(q->q_flushwchan, &q->q_lock);
+		}
+	}
+	spinlock_release(&q->q_lock);
+
+	V(wq->wq_exitsem);
+}
+
+/*
+ * Tell all the workers to exit once their queues are empty, and wait
+ * for them.
+ */
+static
+void
+wq_stopworkers(struct workqueue *wq)
+{
+	struct wq_queue *q;
+	unsigned i;
+
+	for (i=0; i<wq->wq_nqueues; i++) {
+		q = &wq->wq_queues[i];
+		spinlock_acquire(&q->q_lock);
+		q->q_dying = true;
+		wchan_wakeall(q->q_workwchan, &q->q_lock);
+		spinlock_release(&q->q_lock);
+	}
+	for (i=0; i<wq->wq_nthreads; i++) {
+		P(wq->wq_exitsem);
+	}
+	wq->wq_nthreads = 0;
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+void
+work_init(struct work *w, void (*func)(void *), void *data)
+{
+	w->w_next = NULL;
+	w->w_func = func;
+	w->w_data = data;
+	spinlock_data_set(&w->w_pending, 0);
+}
+
+struct workqueue *
+workqueue_create(const char *name, unsigned nthreads)
+{
+	struct workqueue *wq;
+	char tname[32];
+	unsigned i;
+	int result;
+
+	KASSERT(nthreads > 0);
+
+	wq = kmalloc(sizeof(*wq));
+	if (wq == NULL) {
+		return NULL;
+	}
+	wq->wq_name = kstrdup(name);
+	if (wq->wq_name == NULL) {
+		goto fail_wq;
+	}
+	wq->wq_exitsem = sem_create(name, 0);
+	if (wq->wq_exitsem == NULL) {
+		goto fail_name;
+	}
+
+	wq->wq_nqueues = thread_numcpus();
+	if (wq->wq_nqueues > nthreads) {
+		wq->wq_nqueues = nthreads;
+	}
+	wq->wq_queues = kmalloc(wq->wq_nqueues * sizeof(wq->wq_queues[0]));
+	if (wq->wq_queues == NULL) {
+		goto fail_sem;
+	}
+	for (i=0; i<wq->wq_nqueues; i++) {
+		result = wq_queue_init(&wq->wq_queues[i], name);
+		if (result) {
+			while (i-- > 0) {
+				wq_queue_cleanup(&wq->wq_queues[i]);
+			}
+			goto fail_queues;
+		}
+	}
+
+	wq->wq_nthreads = 0;
+	for (i=0; i<nthreads; i++) {
+		snprintf(tname, sizeof(tname), "%s/%u", name, i);
+		result = thread_fork(tname, kproc, wq_worker, wq, i);
+		if (result) {
+			wq_stopworkers(wq);
+			goto fail_allqueues;
+		}
+		wq->wq_nthreads++;
+	}
+
+	return wq;
+
+ fail_allqueues:
+	for (i=0; i<wq->wq_nqueues; i++) {
+		wq_queue_cleanup(&wq->wq_queues[i]);
+	}
+ fail_queues:
+	kfree(wq->wq_queues);
+ fail_sem:
+	sem_destroy(wq->wq_exitsem);
+ fail_name:
+	kfree(wq->wq_name);
+ fail_wq:
+	kfree(wq);
+	return NULL;
+}
+
+void
+workqueue_destroy(struct workqueue *wq)
+{
+	unsigned i;
+
+	wq_stopworkers(wq);
+	for (i=0; i<wq->wq_nqueues; i++) {
+		wq_queue_cleanup(&wq->wq_queues[i]);
+	}
+	kfree(wq->wq_queues);
+	sem_destroy(wq->wq_exitsem);
+	kfree(wq->wq_name);
+	kfree(wq);
+}
+
+bool
+workqueue_enqueue(struct workqueue *wq, struct work *w)
+{
+	struct wq_queue *q;
+
+	if (spinlock_data_testandset(&w->w_pending) != 0) {
+		/* already queued */
+		return false;
+	}
+	membar_store_any();
+
+	q = &wq->wq_queues[curcpu->c_number % wq->wq_nqueues];
+
+	spinlock_acquire(&q->q_lock);
+	KASSERT(!q->q_dying);
+	w->w_next = NULL;
+	*q->q_tailp = w;
+	q->q_tailp = &w->w_next;
+	wchan_wakeone(q->q_workwchan, &q->q_lock);
+	spinlock_release(&q->q_lock);
+
+	return true;
+}
+
+void
+workqueue_flush(struct workqueue *wq)
+{
+	struct wq_queue *q;
+	unsigned i;
+
+	KASSERT(curthread->t_in_interrupt == false);
+
+	for (i=0; i<wq->wq_nqueues; i++) {
+		q = &wq->wq_queues[i];
+		spinlock_acquire(&q->q_lock);
+		while (q->q_head != NULL || q->q_inflight > 0) {
+			wchan_sleep(q->q_flushwchan, &q->q_lock);
+		}
+		spinlock_release(&q->q_lock);
+	}
+}
+
+void
+workqueue_bootstrap(void)
+{
+	system_wq = workqueue_create("system_wq", thread_numcpus());
+	if (system_wq == NULL) {
+		panic("workqueue_bootstrap: Out of memory\n");
+	}
+}
@@ -0,0 +1,685 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pipes.
+ *
+ * The buffer is a ring of PIPE_NPAGES pages. pp_head is where the
+ * next byte to read is, and pp_count says how many bytes there are;
+ * the writer appends at pp_head + pp_count. Only one thread reads at
+ * a time (pp_readlock) and only one writes (pp_writelock), so each
+ * side can move data in or out of its part of the ring without
+ * holding pp_lock, which it can't anyway because uiomove can fault;
+ * pp_lock is only held to look at or update the positions and to
+ * sleep on the wait channels. Because writers are serialized, every
+ * write is atomic with respect to other writes, not just ones of up
+ * to PIPE_BUF bytes.
+ *
+ * Big transfers between page-aligned buffers don't copy the data at
+ * all. When the write position is at the start of a page, the writer
+ * has a whole page of user memory to send, and that page is free in
+ * the ring, the writer's frame goes into the ring in place of the
+ * ring's own page (vm_loanpage makes it copy-on-write in the writer).
+ * Likewise, when the read position is at the start of a full page
+ * and the reader wants a whole page-aligned page, the frame is mapped
+ * into the reader (vm_givepage) and the ring gets a fresh page. So a
+ * page of data goes from writer to reader with no copying unless one
+ * of them writes to it afterwards.
+ *
+ * A page in the ring can therefore be shared with a process. Reading
+ * from it is fine; before the writer copies anything into a page it
+ * makes sure the ring has the only reference. It only starts on a
+ * page when the whole page is free, so there's never unread data in
+ * a page that has to be replaced.
+ *
+ * All pipes are on a list so that when a process exits, any of its
+ * other threads asleep in a pipe can be woken to notice (pipe_wakeall).
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <synch.h>
+#include <stat.h>
+#include <uio.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <pipe.h>
+#include "opt-dumbvm.h"
+
+#define PIPE_NPAGES	4
+#define PIPE_SIZE	(PIPE_NPAGES * PAGE_SIZE)
+
+struct pipe {
+	struct vnode pp_readvn;		/* read end */
+	struct vnode pp_writevn;	/* write end */
+
+	struct lock *pp_readlock;	/* one reader at a time */
+	struct lock *pp_writelock;	/* one writer at a time */
+
+	struct spinlock pp_lock;	/* protects the rest */
+	struct wchan *pp_readwchan;	/* reader waits here for data */
+	struct wchan *pp_writewchan;	/* writer waits here for space */
+	unsigned pp_head;		/* offset of next byte to read */
+	unsigned pp_count;		/* bytes in the ring */
+	bool pp_readclosed;		/* read end is gone */
+	bool pp_writeclosed;		/* write end is gone */
+
+	vaddr_t pp_pages[PIPE_NPAGES];	/* the ring (kernel addresses) */
+
+	struct pipe *pp_next;		/* on allpipes */
+	struct pipe **pp_prev;		/* pointer to us on allpipes */
+};
+
+/* All pipes, for pipe_wakeall; allpipes_lock comes before pp_lock. */
+static struct spinlock allpipes_lock = SPINLOCK_INITIALIZER;
+static struct pipe *allpipes;
+
+static const struct vnode_ops pipe_vnode_ops;
+
+////////////////////////////////////////////////////////////
+// ring pages
+
+/*
+ * Drop the ring's reference to a page. With the real VM system, pages
+ * can be shared with user processes, so go through the frame table's
+ * reference count.
+ */
+static
+void
+pipe_freepage(vaddr_t page)
+{
+#if OPT_DUMBVM
+	free_kpages(page);
+#else
+	free_frame(KVADDR_TO_PADDR(page) / PAGE_SIZE);
+#endif
+}
+
+#if !OPT_DUMBVM
+
+/*
+ * Make sure no process shares ring page SLOT, so the writer can copy
+ * into it. The slot must be empty.
+ */
+static
+int
+pipe_ownpage(struct pipe *pp, unsigned slot)
+{
+	vaddr_t page;
+
+	if (frame_refcount(KVADDR_TO_PADDR(pp->pp_pages[slot]) / PAGE_SIZE)
+	    == 1) {
+		return 0;
+	}
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return ENOMEM;
+	}
+	pipe_freepage(pp->pp_pages[slot]);
+	pp->pp_pages[slot] = page;
+	return 0;
+}
+
+/*
+ * Check if the next PAGE_SIZE bytes of UIO are one whole page of the
+ * current process's memory. If so, return its address.
+ */
+static
+bool
+pipe_uiopage(struct uio *uio, vaddr_t *addr_ret)
+{
+	vaddr_t addr;
+
+	if (uio->uio_segflg != UIO_USERSPACE || uio->uio_resid < PAGE_SIZE) {
+		return false;
+	}
+
+	/* uiomove skips empty iovecs when it gets to them; do it now */
+	while (uio->uio_iov->iov_len == 0 && uio->uio_iovcnt > 1) {
+		uio->uio_iov++;
+		uio->uio_iovcnt--;
+	}
+
+	addr = (vaddr_t)uio->uio_iov->iov_ubase;
+	if (uio->uio_iov->iov_len < PAGE_SIZE || (addr & PAGE_FRAME) != addr) {
+		return false;
+	}
+	*addr_ret = addr;
+	return true;
+}
+
+/*
+ * Account for a page moved without uiomove.
+ */
+static
+void
+pipe_uioskip(struct uio *uio)
+{
+	uio->uio_iov->iov_ubase += PAGE_SIZE;
+	uio->uio_iov->iov_len -= PAGE_SIZE;
+	uio->uio_resid -= PAGE_SIZE;
+	uio->uio_offset += PAGE_SIZE;
+}
+
+/*
+ * Writer fast path: put the user's page in ring slot SLOT instead of
+ * copying it. Returns false if we can't.
+ */
+static
+bool
+pipe_loanin(struct pipe *pp, unsigned slot, struct uio *uio)
+{
+	vaddr_t addr;
+	int frame;
+
+	if (!pipe_uiopage(uio, &addr)) {
+		return false;
+	}
+	frame = vm_loanpage(proc_getas(), addr);
+	if (frame < 0) {
+		return false;
+	}
+	pipe_freepage(pp->pp_pages[slot]);
+	pp->pp_pages[slot] = PADDR_TO_KVADDR((paddr_t)frame * PAGE_SIZE);
+	pipe_uioskip(uio);
+	return true;
+}
+
+/*
+ * Reader fast path: map the page in ring slot SLOT into the reader
+ * instead of copying it, and give the ring a fresh page. Returns
+ * false if we can't.
+ */
+static
+bool
+pipe_giveout(struct pipe *pp, unsigned slot, struct uio *uio)
+{
+	vaddr_t addr, page;
+
+	if (!pipe_uiopage(uio, &addr)) {
+		return false;
+	}
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return false;
+	}
+	if (vm_givepage(proc_getas(), addr,
+			KVADDR_TO_PADDR(pp->pp_pages[slot]) / PAGE_SIZE)) {
+		free_kpages(page);
+		return false;
+	}
+	pp->pp_pages[slot] = page;
+	pipe_uioskip(uio);
+	return true;
+}
+
+#endif /* !OPT_DUMBVM */
+
+////////////////////////////////////////////////////////////
+// vnode ops
+
+/*
+ * Called when the last reference to one end goes away. Let the other
+ * end know; when both are gone, so is the pipe.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *pp = v->vn_data;
+	bool destroy;
+	unsigned i;
+
+	/*
+	 * Clean up the vnode first: once this end is marked closed,
+	 * the other end's reclaim may free the pipe (V included) at
+	 * any moment.
+	 */
+	vnode_cleanup(v);
+
+	spinlock_acquire(&pp->pp_lock);
+	if (v == &pp->pp_readvn) {
+		pp->pp_readclosed = true;
+		wchan_wakeall(pp->pp_writewchan, &pp->pp_lock);
+	}
+	else {
+		KASSERT(v == &pp->pp_writevn);
+		pp->pp_writeclosed = true;
+		wchan_wakeall(pp->pp_readwchan, &pp->pp_lock);
+	}
+	destroy = pp->pp_readclosed && pp->pp_writeclosed;
+	spinlock_release(&pp->pp_lock);
+
+	if (destroy) {
+		spinlock_acquire(&allpipes_lock);
+		if (pp->pp_next != NULL) {
+			pp->pp_next->pp_prev = pp->pp_prev;
+		}
+		*pp->pp_prev = pp->pp_next;
+		spinlock_release(&allpipes_lock);
+
+		for (i=0; i<PIPE_NPAGES; i++) {
+			pipe_freepage(pp->pp_pages[i]);
+		}
+		wchan_destroy(pp->pp_readwchan);
+		wchan_destroy(pp->pp_writewchan);
+		spinlock_cleanup(&pp->pp_lock);
+		lock_destroy(pp->pp_readlock);
+		lock_destroy(pp->pp_writelock);
+		kfree(pp);
+	}
+	return 0;
+}
+
+/*
+ * Read. Wait until there's something to read or the write end has
+ * gone away (EOF), then take as much as there is, up to what was
+ * asked for.
+ */
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *pp = v->vn_data;
+	unsigned head, avail, slot, off, len;
+	size_t origresid;
+	int result = 0;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+	if (v != &pp->pp_readvn) {
+		return EBADF;
+	}
+
+	origresid = uio->uio_resid;
+	if (origresid == 0) {
+		return 0;
+	}
+
+	lock_acquire(pp->pp_readlock);
+	spinlock_acquire(&pp->pp_lock);
+	while (pp->pp_count == 0 && !pp->pp_writeclosed) {
+		if (curproc->p_exiting) {
+			/* another thread called _exit; see pipe_wakeall */
+			spinlock_release(&pp->pp_lock);
+			lock_release(pp->pp_readlock);
+			return EINTR;
+		}
+		wchan_sleep(pp->pp_readwchan, &pp->pp_lock);
+	}
+	head = pp->pp_head;
+	avail = pp->pp_count;
+	spinlock_release(&pp->pp_lock);
+
+	while (avail > 0 && uio->uio_resid > 0) {
+		slot = head / PAGE_SIZE;
+		off = head % PAGE_SIZE;
+
+#if !OPT_DUMBVM
+		if (off == 0 && avail >= PAGE_SIZE &&
+		    pipe_giveout(pp, slot, uio)) {
+			len = PAGE_SIZE;
+			goto consumed;
+		}
+#endif
+
+		len = PAGE_SIZE - off;
+		if (len > avail) {
+			len = avail;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove((char *)pp->pp_pages[slot] + off, len, uio);
+		if (result) {
+			break;
+		}
+
+#if !OPT_DUMBVM
+	consumed:
+#endif
+		head = (head + len) % PIPE_SIZE;
+
+		spinlock_acquire(&pp->pp_lock);
+		pp->pp_head = head;
+		pp->pp_count -= len;
+		avail = pp->pp_count;
+		wchan_wakeone(pp->pp_writewchan, &pp->pp_lock);
+		spinlock_release(&pp->pp_lock);
+	}
+
+	lock_release(pp->pp_readlock);
+
+	/* if we got some, report that; the error can come next time */
+	return uio->uio_resid < origresid ? 0 : result;
+}
+
+/*
+ * Write. Put everything in the pipe, waiting for space as needed,
+ * unless the read end goes away, in which case fail with EPIPE (or
+ * stop short, if some of it went in).
+ */
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *pp = v->vn_data;
+	unsigned tail = 0, space = 0, slot, off, len;
+	size_t origresid;
+	int result = 0;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+	if (v != &pp->pp_writevn) {
+		return EBADF;
+	}
+
+	origresid = uio->uio_resid;
+
+	lock_acquire(pp->pp_writelock);
+	while (uio->uio_resid > 0) {
+		/*
+		 * Wait for space. Only start on a page once all of it
+		 * is free; see above.
+		 */
+		spinlock_acquire(&pp->pp_lock);
+		while (1) {
+			if (pp->pp_readclosed || curproc->p_exiting) {
+				break;
+			}
+			tail = (pp->pp_head + pp->pp_count) % PIPE_SIZE;
+			space = PIPE_SIZE - pp->pp_count;
+			if (space >= PAGE_SIZE ||
+			    (space > 0 && tail % PAGE_SIZE != 0)) {
+				break;
+			}
+			wchan_sleep(pp->pp_writewchan, &pp->pp_lock);
+		}
+		if (pp->pp_readclosed) {
+			spinlock_release(&pp->pp_lock);
+			result = EPIPE;
+			break;
+		}
+		if (curproc->p_exiting) {
+			spinlock_release(&pp->pp_lock);
+			result = EINTR;
+			break;
+		}
+		spinlock_release(&pp->pp_lock);
+
+		slot = tail / PAGE_SIZE;
+		off = tail % PAGE_SIZE;
+
+#if !OPT_DUMBVM
+		if (off == 0) {
+			if (pipe_loanin(pp, slot, uio)) {
+				len = PAGE_SIZE;
+				goto filled;
+			}
+			result = pipe_ownpage(pp, slot);
+			if (result) {
+				break;
+			}
+		}
+#endif
+
+		len = PAGE_SIZE - off;
+		if (len > space) {
+			len = space;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove((char *)pp->pp_pages[slot] + off, len, uio);
+		if (result) {
+			break;
+		}
+
+#if !OPT_DUMBVM
+	filled:
+#endif
+		spinlock_acquire(&pp->pp_lock);
+		pp->pp_count += len;
+		wchan_wakeone(pp->pp_readwchan, &pp->pp_lock);
+		spinlock_release(&pp->pp_lock);
+	}
+	lock_release(pp->pp_writelock);
+
+	return uio->uio_resid < origresid ? 0 : result;
+}
+
+static
+int
+pipe_eachopen(struct vnode *v, int flags)
+{
+	/* pipes aren't opened by name */
+	(void)v;
+	(void)flags;
+	return EINVAL;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *pp = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+
+	statbuf->st_mode = S_IFIFO | 0600;
+	statbuf->st_nlink = 1;
+	statbuf->st_blksize = PAGE_SIZE;
+
+	spinlock_acquire(&pp->pp_lock);
+	statbuf->st_size = pp->pp_count;
+	spinlock_release(&pp->pp_lock);
+
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+bool
+pipe_isseekable(struct vnode *v)
+{
+	(void)v;
+	return false;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return EINVAL;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+static const struct vnode_ops pipe_vnode_ops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = pipe_eachopen,
+	.vop_reclaim = pipe_reclaim,
+	.vop_read = pipe_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_write = pipe_write,
+	.vop_ioctl = pipe_ioctl,
+	.vop_stat = pipe_stat,
+	.vop_gettype = pipe_gettype,
+	.vop_isseekable = pipe_isseekable,
+	.vop_fsync = pipe_fsync,
+	.vop_mmap = vopfail_mmap_nosys,
+	.vop_truncate = pipe_truncate,
+	.vop_namefile = vopfail_uio_inval,
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+////////////////////////////////////////////////////////////
+// creation
+
+/*
+ * Create a pipe.
+ */
+int
+pipe_create(struct vnode **readvn_ret, struct vnode **writevn_ret)
+{
+	struct pipe *pp;
+	unsigned i;
+
+	pp = kmalloc(sizeof(*pp));
+	if (pp == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<PIPE_NPAGES; i++) {
+		pp->pp_pages[i] = 0;
+	}
+
+	pp->pp_readlock = lock_create("pipe read");
+	if (pp->pp_readlock == NULL) {
+		goto fail_pp;
+	}
+	pp->pp_writelock = lock_create("pipe write");
+	if (pp->pp_writelock == NULL) {
+		goto fail_readlock;
+	}
+	pp->pp_readwchan = wchan_create("pipe read");
+	if (pp->pp_readwchan == NULL) {
+		goto fail_writelock;
+	}
+	pp->pp_writewchan = wchan_create("pipe write");
+	if (pp->pp_writewchan == NULL) {
+		goto fail_readwchan;
+	}
+	for (i=0; i<PIPE_NPAGES; i++) {
+		pp->pp_pages[i] = alloc_kpages(1);
+		if (pp->pp_pages[i] == 0) {
+			goto fail_pages;
+		}
+	}
+
+	spinlock_init(&pp->pp_lock);
+	pp->pp_head = 0;
+	pp->pp_count = 0;
+	pp->pp_readclosed = false;
+	pp->pp_writeclosed = false;
+
+	vnode_init(&pp->pp_readvn, &pipe_vnode_ops, NULL, pp);
+	vnode_init(&pp->pp_writevn, &pipe_vnode_ops, NULL, pp);
+
+	spinlock_acquire(&allpipes_lock);
+	pp->pp_next = allpipes;
+	if (allpipes != NULL) {
+		allpipes->pp_prev = &pp->pp_next;
+	}
+	pp->pp_prev = &allpipes;
+	allpipes = pp;
+	spinlock_release(&allpipes_lock);
+
+	*readvn_ret = &pp->pp_readvn;
+	*writevn_ret = &pp->pp_writevn;
+	return 0;
+
+ fail_pages:
+	for (i=0; i<PIPE_NPAGES; i++) {
+		if (pp->pp_pages[i] != 0) {
+			free_kpages(pp->pp_pages[i]);
+		}
+	}
+	wchan_destroy(pp->pp_writewchan);
+ fail_readwchan:
+	wchan_destroy(pp->pp_readwchan);
+ fail_writelock:
+	lock_destroy(pp->pp_writelock);
+ fail_readlock:
+	lock_destroy(pp->pp_readlock);
+ fail_pp:
+	kfree(pp);
+	return ENOMEM;
+}
+
+/*
+ * Wake everyone asleep in any pipe. Used when a process is exiting,
+ * so its other threads can leave; the caller sets p_exiting first so
+ * they give up instead of going back to sleep. Threads of other
+ * processes just look around and go back to sleep.
+ */
+void
+pipe_wakeall(void)
+{
+	struct pipe *pp;
+
+	spinlock_acquire(&allpipes_lock);
+	for (pp = allpipes; pp != NULL; pp = pp->pp_next) {
+		spinlock_acquire(&pp->pp_lock);
+		wchan_wakeall(pp->pp_readwchan, &pp->pp_lock);
+		wchan_wakeall(pp->pp_writewchan, &pp->pp_lock);
+		spinlock_release(&pp->pp_lock);
+	}
+	spinlock_release(&allpipes_lock);
+}
@@ -38,6 +38,8 @@
 #include <lib.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <vm.h>
+#include "opt-dumbvm.h"
 
 
 /* Does most of the work for open(). */
@@ -132,6 +134,24 @@ vfs_close(struct vnode *vn)
 	VOP_DECREF(vn);
 }
 
+#if !OPT_DUMBVM
+/*
+ * NAME in DIR is about to be unlinked. Drop any of its pages the text
+ * cache has, whose references would otherwise keep the file around.
+ */
+static
+void
+vfs_purgetext(struct vnode *dir, char *name)
+{
+	struct vnode *vn;
+
+	if (VOP_LOOKUP(dir, name, &vn) == 0) {
+		textcache_purge(vn);
+		VOP_DECREF(vn);
+	}
+}
+#endif
+
 /* Does most of the work for remove(). */
 int
 vfs_remove(char *path)
@@ -145,6 +165,10 @@ vfs_remove(char *path)
 		return result;
 	}
 
+#if !OPT_DUMBVM
+	vfs_purgetext(dir, name);
+#endif
+
 	result = VOP_REMOVE(dir, name);
 	VOP_DECREF(dir);
 
@@ -178,6 +202,11 @@ vfs_rename(char *oldpath, char *newpath)
 		return EXDEV;
 	}
 
+#if !OPT_DUMBVM
+	/* in case this replaces something */
+	vfs_purgetext(newdir, newname);
+#endif
+
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
 
 	VOP_DECREF(newdir);
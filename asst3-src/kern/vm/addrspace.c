@@ -32,6 +32,7 @@
 #include <lib.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <synch.h>
 #include <current.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
@@ -119,8 +120,15 @@ as_create(void)
 		return NULL;
 	}
 
+	as->as_lock = lock_create("as_lock");
+	if (as->as_lock == NULL){
+		kfree(as);
+		return NULL;
+	}
+
 	as->page_table = page_table_init();
 	if (as->page_table == NULL){
+		lock_destroy(as->as_lock);
 		kfree(as);
 		return NULL;
 	}
@@ -132,6 +140,7 @@ as_create(void)
 	as->asr = kmalloc(sizeof(struct as_regions));
 	if (as->asr == NULL){
 		kfree(as->page_table);
+		lock_destroy(as->as_lock);
 		kfree(as);
 		return NULL;
 	}
@@ -159,13 +168,32 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		return ENOMEM;
 	}
 
+	newas->as_lock = lock_create("as_lock");
+	if (newas->as_lock == NULL){
+		kfree(newas);
+		return ENOMEM;
+	}
+
+	// other threads of the process may be faulting pages in while we copy
+	lock_acquire(old->as_lock);
+
 	newas->page_table = page_table_copy(old->page_table);
 	if (newas->page_table == NULL){
+		lock_release(old->as_lock);
+		lock_destroy(newas->as_lock);
+		kfree(newas);
 		return ENOMEM;
 	}
 
 	int code = 0;
 	newas->asr = as_region_copy(old->asr, &code);
+
+	// the frames are now shared copy-on-write, so no tlb may keep a writeable entry for them
+	vm_shootdown(TLBSHOOTDOWN_ALL);
+	as_activate();
+
+	lock_release(old->as_lock);
+
 	if (code){
 		as_destroy(newas);
 		return ENOMEM;
@@ -182,6 +210,7 @@ as_destroy(struct addrspace *as)
 
 	as_region_free(as->asr);
 
+	lock_destroy(as->as_lock);
 	kfree(as);
 }
 
@@ -319,8 +348,40 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int as_define_threadstack(struct addrspace *as, unsigned slot, vaddr_t *stackptr){
+	vaddr_t top = USERSTACK - slot * (STACK_PAGES + 1) * PAGE_SIZE;
+	vaddr_t base = top - STACK_PAGES * PAGE_SIZE;
+	int err = 0;
+
+	lock_acquire(as->as_lock);
+
+	// a previous thread in this slot (or as_define_stack, for slot 0) may have defined it already
+	struct as_regions *cur = as->asr;
+	while (cur != NULL && !(cur->start == base && cur->end == top)){
+		cur = cur->next;
+	}
+	if (cur == NULL){
+		err = as_define_region(as, base, STACK_PAGES * PAGE_SIZE, 4, 2, 0);
+	}
+
+	lock_release(as->as_lock);
+
+	// the only way to fail is to run into the heap (or ENOMEM)
+	if (err == EFAULT){
+		err = ENOMEM;
+	}
+	if (err){
+		return err;
+	}
+	*stackptr = top;
+	return 0;
+}
+
 int sys_sbrk(int a0, int *retval){
-	struct as_regions *hr = proc_getas()->asr;
+	struct addrspace *as = proc_getas();
+
+	lock_acquire(as->as_lock);
+	struct as_regions *hr = as->asr;
 	while(hr->region_type != REGION_HEAP){
 		// there should be a heap region?
 		KASSERT(hr != NULL);
@@ -331,12 +392,15 @@ int sys_sbrk(int a0, int *retval){
 	KASSERT(hr->next != NULL);
 	*retval = -1;
 	if (hr->end + a0 < hr->start || a0 % PAGE_SIZE != 0){
+		lock_release(as->as_lock);
 		return EINVAL;
 	}
 	if (hr->end + a0 > hr->next->start){
+		lock_release(as->as_lock);
 		return ENOMEM;
 	}
 	*retval = hr->end;
 	hr->end = hr->end + a0;
+	lock_release(as->as_lock);
 	return 0;
 }
\ No newline at end of file
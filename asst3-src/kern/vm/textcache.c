@@ -0,0 +1,386 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Shared text pages.
+ *
+ * Read-only, executable segments are the same in every process
+ * running a given program, so rather than reading them into private
+ * pages on every exec, load_elf maps them from this cache. Entries
+ * are keyed on the vnode and the part of the file a page holds (file
+ * offset, where in the page it starts, and how many bytes), so a page
+ * that a segment only partly covers is only ever shared with the same
+ * segment of the same file. The frame is refcounted through the frame
+ * table: the cache holds one reference and every address space that
+ * maps it holds another, so exiting processes just drop theirs with
+ * free_frame as usual.
+ *
+ * Each cached entry also holds a reference to its vnode, so the key
+ * stays unique. That reference would keep a removed file (and its
+ * disk space) around and its filesystem from being unmounted, so
+ * vfs_remove and vfs_rename drop a file's entries before unlinking
+ * it and vfs_unmount drops the whole filesystem's. Entries also go
+ * away when the cache grows past textcache_maxpages and the page is
+ * mapped by nobody else.
+ *
+ * Nothing is cached for a file while it's open for writing: opening
+ * a file to write counts it in vn_writers and drops its entries
+ * (textcache_addwriter), and a miss on a file with writers gets a
+ * private page instead. So a write through a file handle opened
+ * before the file was cached can't leave stale text behind.
+ *
+ * The disk read on a miss is done without textcache_lock held; two
+ * execs that miss on the same page at once just race to insert it,
+ * and the loser uses the winner's page.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <vm.h>
+
+#define TEXTCACHE_NBUCKETS	64
+
+/* idle cached pages are limited to 1/TEXTCACHE_FRACTION of memory */
+#define TEXTCACHE_FRACTION	8
+
+struct textpage {
+	struct vnode *tp_vnode;
+	off_t tp_offset;		/* file offset of the page's data */
+	unsigned tp_pageoff;		/* where the data starts in the page */
+	size_t tp_len;			/* bytes of data; the rest is zero */
+	uint32_t tp_frame;
+	struct textpage *tp_next;
+};
+
+static struct lock *textcache_lock;
+static struct textpage *textcache_buckets[TEXTCACHE_NBUCKETS];
+static unsigned textcache_npages;
+static unsigned textcache_maxpages;
+static unsigned textcache_hand;		/* next bucket to evict from */
+
+void
+textcache_bootstrap(void)
+{
+	unsigned i;
+
+	textcache_lock = lock_create("textcache");
+	if (textcache_lock == NULL) {
+		panic("textcache_bootstrap: Out of memory\n");
+	}
+	for (i=0; i<TEXTCACHE_NBUCKETS; i++) {
+		textcache_buckets[i] = NULL;
+	}
+	textcache_npages = 0;
+	textcache_maxpages = ram_getsize() / PAGE_SIZE / TEXTCACHE_FRACTION;
+	textcache_hand = 0;
+}
+
+/*
+ * Note that V is open for writing, and drop its cached pages.
+ */
+void
+textcache_addwriter(struct vnode *v)
+{
+	spinlock_acquire(&v->vn_countlock);
+	v->vn_writers++;
+	spinlock_release(&v->vn_countlock);
+
+	/* Running copies of the program keep their text; new ones reload it. */
+	textcache_purge(v);
+}
+
+/*
+ * Undo textcache_addwriter when the file is closed.
+ */
+void
+textcache_remwriter(struct vnode *v)
+{
+	spinlock_acquire(&v->vn_countlock);
+	KASSERT(v->vn_writers > 0);
+	v->vn_writers--;
+	spinlock_release(&v->vn_countlock);
+}
+
+static
+unsigned
+textcache_hash(struct vnode *v, off_t offset)
+{
+	uintptr_t x;
+
+	x = (uintptr_t)v >> 4;
+	x ^= (uintptr_t)(offset / PAGE_SIZE) * 31;
+	return x % TEXTCACHE_NBUCKETS;
+}
+
+/*
+ * Look up a page. Call with textcache_lock held.
+ */
+static
+struct textpage *
+textcache_find(struct vnode *v, off_t offset, unsigned pageoff, size_t len)
+{
+	struct textpage *tp;
+
+	for (tp = textcache_buckets[textcache_hash(v, offset)];
+	     tp != NULL; tp = tp->tp_next) {
+		if (tp->tp_vnode == v && tp->tp_offset == offset &&
+		    tp->tp_pageoff == pageoff && tp->tp_len == len) {
+			return tp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Unlink one page that no process has mapped, if there is one. Call
+ * with textcache_lock held; the caller destroys the page afterwards,
+ * without the lock.
+ */
+static
+struct textpage *
+textcache_evictone(void)
+{
+	struct textpage **tpp, *tp;
+	unsigned i;
+
+	for (i=0; i<TEXTCACHE_NBUCKETS; i++) {
+		tpp = &textcache_buckets[textcache_hand];
+		textcache_hand = (textcache_hand + 1) % TEXTCACHE_NBUCKETS;
+		for (; *tpp != NULL; tpp = &(*tpp)->tp_next) {
+			tp = *tpp;
+			/* only our reference left */
+			if (frame_refcount(tp->tp_frame) == 1) {
+				*tpp = tp->tp_next;
+				textcache_npages--;
+				return tp;
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Destroy an unlinked page, dropping the cache's references.
+ */
+static
+void
+textpage_destroy(struct textpage *tp)
+{
+	free_frame(tp->tp_frame);
+	VOP_DECREF(tp->tp_vnode);
+	kfree(tp);
+}
+
+/*
+ * Read a page in and enter it in the cache, unless someone beat us to
+ * it. Either way, returns the frame with a reference added for the
+ * caller.
+ */
+static
+int
+textcache_fill(struct vnode *v, off_t offset, unsigned pageoff, size_t len,
+	       uint32_t *ret)
+{
+	struct textpage *tp, *found, *victim;
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t kpage;
+	unsigned bucket;
+	bool writers;
+	int result;
+
+	kpage = alloc_kpages(1);
+	if (kpage == 0) {
+		return ENOMEM;
+	}
+	bzero((void *)kpage, PAGE_SIZE);
+
+	uio_kinit(&iov, &ku, (char *)kpage + pageoff, len, offset, UIO_READ);
+	result = VOP_READ(v, &ku);
+	if (result) {
+		free_kpages(kpage);
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		/* short read; problem with executable? */
+		free_kpages(kpage);
+		return ENOEXEC;
+	}
+
+	tp = kmalloc(sizeof(*tp));
+	if (tp == NULL) {
+		free_kpages(kpage);
+		return ENOMEM;
+	}
+	tp->tp_vnode = v;
+	tp->tp_offset = offset;
+	tp->tp_pageoff = pageoff;
+	tp->tp_len = len;
+	tp->tp_frame = KVADDR_TO_PADDR(kpage) / PAGE_SIZE;
+
+	victim = NULL;
+	lock_acquire(textcache_lock);
+
+	/* checked under textcache_lock, which textcache_purge also takes */
+	spinlock_acquire(&v->vn_countlock);
+	writers = v->vn_writers > 0;
+	spinlock_release(&v->vn_countlock);
+	if (writers) {
+		/* don't cache it; the caller gets the page to itself */
+		lock_release(textcache_lock);
+		kfree(tp);
+		*ret = KVADDR_TO_PADDR(kpage) / PAGE_SIZE;
+		return 0;
+	}
+
+	found = textcache_find(v, offset, pageoff, len);
+	if (found == NULL) {
+		if (textcache_npages >= textcache_maxpages) {
+			victim = textcache_evictone();
+		}
+		bucket = textcache_hash(v, offset);
+		tp->tp_next = textcache_buckets[bucket];
+		textcache_buckets[bucket] = tp;
+		textcache_npages++;
+		VOP_INCREF(v);
+		found = tp;
+		tp = NULL;
+	}
+	frame_add(found->tp_frame);
+	*ret = found->tp_frame;
+	lock_release(textcache_lock);
+
+	if (tp != NULL) {
+		/* lost a race with another exec; use its page instead */
+		free_kpages(kpage);
+		kfree(tp);
+	}
+	if (victim != NULL) {
+		textpage_destroy(victim);
+	}
+	return 0;
+}
+
+int
+textcache_map(struct addrspace *as, struct vnode *v, off_t offset,
+	      vaddr_t vaddr, size_t len)
+{
+	struct textpage *tp;
+	unsigned pageoff;
+	uint32_t frame = 0;
+	int result;
+
+	pageoff = vaddr % PAGE_SIZE;
+	KASSERT(len > 0 && pageoff + len <= PAGE_SIZE);
+
+	lock_acquire(textcache_lock);
+	tp = textcache_find(v, offset, pageoff, len);
+	if (tp != NULL) {
+		frame_add(tp->tp_frame);
+		frame = tp->tp_frame;
+	}
+	lock_release(textcache_lock);
+
+	if (tp == NULL) {
+		result = textcache_fill(v, offset, pageoff, len, &frame);
+		if (result) {
+			return result;
+		}
+	}
+
+	/* hand our reference to the address space */
+	result = vm_mapkpage(as, vaddr - pageoff,
+			     PADDR_TO_KVADDR(frame * PAGE_SIZE));
+	if (result) {
+		free_frame(frame);
+		return result;
+	}
+	return 0;
+}
+
+/*
+ * Drop every cached page of V, or if V is null, of every file on FS.
+ */
+static
+void
+textcache_drop(struct vnode *v, struct fs *fs)
+{
+	struct textpage **tpp, *tp, *dead;
+	unsigned i;
+	bool match;
+
+	dead = NULL;
+	lock_acquire(textcache_lock);
+	for (i=0; i<TEXTCACHE_NBUCKETS; i++) {
+		tpp = &textcache_buckets[i];
+		while (*tpp != NULL) {
+			tp = *tpp;
+			if (v != NULL) {
+				match = tp->tp_vnode == v;
+			}
+			else {
+				match = tp->tp_vnode->vn_fs == fs;
+			}
+			if (match) {
+				*tpp = tp->tp_next;
+				tp->tp_next = dead;
+				dead = tp;
+				textcache_npages--;
+			}
+			else {
+				tpp = &tp->tp_next;
+			}
+		}
+	}
+	lock_release(textcache_lock);
+
+	while (dead != NULL) {
+		tp = dead;
+		dead = tp->tp_next;
+		textpage_destroy(tp);
+	}
+}
+
+void
+textcache_purge(struct vnode *v)
+{
+	textcache_drop(v, NULL);
+}
+
+void
+textcache_purgefs(struct fs *fs)
+{
+	KASSERT(fs != NULL);
+	textcache_drop(NULL, fs);
+}
@@ -7,6 +7,10 @@
 #include <machine/tlb.h>
 #include <proc.h>
 #include <spl.h>
+#include <synch.h>
+#include <cpu.h>
+#include <current.h>
+#include <ktrace.h>
 
 /* Place your page table functions here */
 
@@ -138,6 +142,87 @@ int page_table_get(page_table_t page_table, int page){
 	return page_table[index1][index2][index3];
 }
 
+int vm_mapkpage(struct addrspace *as, vaddr_t vaddr, vaddr_t kpage){
+	int page = vaddr / PAGE_SIZE;
+	int frame = KVADDR_TO_PADDR(kpage) / PAGE_SIZE;
+	int err;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+	KASSERT((kpage & PAGE_FRAME) == kpage);
+
+	lock_acquire(as->as_lock);
+	KASSERT(page_table_get(as->page_table, page) == PAGE_TABLE_UNUSED);
+	err = page_table_set(as->page_table, page, frame);
+	lock_release(as->as_lock);
+
+	return err;
+}
+
+// drops VADDR from the TLB, both here and (with vm_shootdown) on the other cpus. call with
+// as_lock held so a fault can't load it again in between.
+static void vm_tlbdrop(vaddr_t vaddr){
+	int spl = splhigh();
+	int ind = tlb_probe(vaddr, 0);
+	if (ind >= 0){
+		tlb_write(TLBHI_INVALID(ind), TLBLO_INVALID(), ind);
+	}
+	splx(spl);
+	vm_shootdown(vaddr);
+}
+
+int vm_loanpage(struct addrspace *as, vaddr_t vaddr){
+	int page = vaddr / PAGE_SIZE;
+	int frame, r, w;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	lock_acquire(as->as_lock);
+	if (as_region_check(as->asr, vaddr, &r, &w) || r == 0){
+		lock_release(as->as_lock);
+		return -1;
+	}
+	frame = page_table_get(as->page_table, page);
+	if (frame == PAGE_TABLE_UNUSED){
+		lock_release(as->as_lock);
+		return -1;
+	}
+
+	// with a second reference the next write to the page faults and copies it (COW).
+	// it may be loaded writeable right now, so make sure it isn't.
+	frame_add(frame);
+	vm_tlbdrop(vaddr);
+	lock_release(as->as_lock);
+
+	return frame;
+}
+
+int vm_givepage(struct addrspace *as, vaddr_t vaddr, uint32_t frame){
+	int page = vaddr / PAGE_SIZE;
+	int old, r, w, err;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	lock_acquire(as->as_lock);
+	if (as_region_check(as->asr, vaddr, &r, &w) || w == 0){
+		lock_release(as->as_lock);
+		return EFAULT;
+	}
+	old = page_table_get(as->page_table, page);
+	err = page_table_set(as->page_table, page, frame);
+	if (err){
+		lock_release(as->as_lock);
+		return err;
+	}
+	// the old frame may still be loaded
+	vm_tlbdrop(vaddr);
+	lock_release(as->as_lock);
+
+	if (old != PAGE_TABLE_UNUSED){
+		free_frame(old);
+	}
+	return 0;
+}
+
 void vm_bootstrap(void)
 {
     /* Initialise any global components of your VM sub-system here.  
@@ -156,13 +241,24 @@ void vm_bootstrap(void)
 	zero_frame = KVADDR_TO_PADDR(new_frame) / PAGE_SIZE;
 
 	// we assume allocating the zero frame does not fail
+
+	textcache_bootstrap();
 }
 
-int
-vm_fault(int faulttype, vaddr_t faultaddress)
+void vm_shootdown(vaddr_t vaddr){
+	struct tlbshootdown ts;
+
+	// other threads of a single-threaded process can't have anything loaded
+	if (curproc->p_nuthreads <= 1){
+		return;
+	}
+	ts.ts_vaddr = vaddr;
+	ipi_tlbshootdown_broadcast(&ts);
+}
+
+// does the work of vm_fault with the address space locked
+static int vm_fault_locked(struct addrspace *as, int faulttype, vaddr_t faultaddress)
 {
-	
-    struct addrspace *as = proc_getas();
     int page = faultaddress / PAGE_SIZE;
 	int err = 0;
 	int dirty = 0;
@@ -206,10 +302,27 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 				free_frame(new_frame);
 				return err;
 			}
+			// other threads may still have the old (readonly) frame loaded
+			vm_shootdown(page * PAGE_SIZE);
+			if (frame != (int)zero_frame){
+				KUSAGE_COUNT(ku_cowcopies);
+			}
 		}
 		frame = new_frame;
 	}
 
+	switch (faulttype){
+	case VM_FAULT_READ:
+		KUSAGE_COUNT(ku_rfaults);
+		break;
+	case VM_FAULT_WRITE:
+		KUSAGE_COUNT(ku_wfaults);
+		break;
+	case VM_FAULT_READONLY:
+		KUSAGE_COUNT(ku_mfaults);
+		break;
+	}
+
     // set values of entryhi and entrylo
     uint32_t entryhi, entrylo;
     entryhi = page << 12;
@@ -242,13 +355,44 @@ vm_fault(int faulttype, vaddr_t faultaddress)
     return 0;
 }
 
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+    struct addrspace *as = proc_getas();
+	int err;
+
+    KTRACE(KTRACE_VMFAULT, faulttype, faultaddress, 0, 0);
+	if (as == NULL){
+		return EFAULT;
+	}
+
+	// threads of the same process share the page table
+	lock_acquire(as->as_lock);
+	err = vm_fault_locked(as, faulttype, faultaddress);
+	lock_release(as->as_lock);
+
+	return err;
+}
+
 /*
- * SMP-specific functions.  Unused in our UNSW configuration.
+ * SMP-specific functions. Used when threads of one process run on
+ * several cpus at once.
  */
 
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	(void)ts;
-	panic("vm tried to do tlb shootdown?!\n");
+	int spl = splhigh();
+	if (ts->ts_vaddr == TLBSHOOTDOWN_ALL){
+		for (int i=0; i<NUM_TLB; i++){
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+	}
+	else {
+		int ind = tlb_probe(ts->ts_vaddr & PAGE_FRAME, 0);
+		if (ind >= 0){
+			tlb_write(TLBHI_INVALID(ind), TLBLO_INVALID(), ind);
+		}
+	}
+	splx(spl);
 }
\ No newline at end of file
@@ -36,6 +36,31 @@
  */
 
 
+/*
+ * Have the kernel move the data with copy_file_range, in chunks of
+ * this size, without bouncing it through our buffer.
+ */
+#define FASTCOPY_CHUNK (64*1024)
+
+/*
+ * Copy as much as we can with copy_file_range. Returns 0 if we got to
+ * EOF, or -1 if the kernel can't (or won't) do it for these files,
+ * in which case the caller carries on with read and write. The seek
+ * positions move with the data either way, so the fallback picks up
+ * wherever this stopped.
+ */
+static
+int
+fastcopy(int fromfd, int tofd)
+{
+	ssize_t len;
+
+	while ((len = copy_file_range(fromfd, tofd, FASTCOPY_CHUNK)) > 0) {
+		/* keep going */
+	}
+	return len == 0 ? 0 : -1;
+}
+
 /* Copy one file to another. */
 static
 void
@@ -58,6 +83,15 @@ copy(const char *from, const char *to)
 		err(1, "%s", to);
 	}
 
+	/*
+	 * Try the fast way first. If that doesn't get us to the end,
+	 * copy the rest by hand; if it failed for real, read or write
+	 * will fail too and tell us why.
+	 */
+	if (fastcopy(fromfd, tofd) == 0) {
+		goto done;
+	}
+
 	/*
 	 * As long as we get more than zero bytes, we haven't hit EOF.
 	 * Zero means EOF. Less than zero means an error occurred.
@@ -85,6 +119,7 @@ copy(const char *from, const char *to)
 		err(1, "%s", from);
 	}
 
+ done:
 	if (close(fromfd) < 0) {
 		err(1, "%s: close", from);
 	}
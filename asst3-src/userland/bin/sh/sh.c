@@ -355,12 +355,115 @@ static struct {
 	{ NULL, NULL }
 };
 
+/*
+ * dopipeline
+ * runs "cmd1 args | cmd2 args | ...": one child per command, each
+ * one's output going through a pipe to the next one's input. waits
+ * for all of them; the exit status is the last one's.
+ */
+static
+void
+dopipeline(char *args[], int nargs, struct exitinfo *ei)
+{
+	pid_t pids[NARG_MAX / 2 + 1];
+	int npids = 0;
+	int start, i, last;
+	int infd = -1, fds[2];
+	int status, failed = 0;
+	pid_t pid;
+
+	/* check for empty commands before starting anything */
+	start = 0;
+	for (i=0; i<=nargs; i++) {
+		if (i == nargs || !strcmp(args[i], "|")) {
+			if (i == start) {
+				printf("sh: Empty command in pipeline\n");
+				exitinfo_exit(ei, 1);
+				return;
+			}
+			start = i+1;
+		}
+	}
+
+	start = 0;
+	for (i=0; i<=nargs; i++) {
+		if (i < nargs && strcmp(args[i], "|")) {
+			continue;
+		}
+		/* args[start] through args[i-1] are one command */
+		last = (i == nargs);
+		args[i] = NULL;
+
+		if (!last && pipe(fds) < 0) {
+			warn("pipe");
+			failed = 1;
+			break;
+		}
+
+		pid = vfork();
+		if (pid < 0) {
+			warn("vfork");
+			if (!last) {
+				close(fds[0]);
+				close(fds[1]);
+			}
+			failed = 1;
+			break;
+		}
+		if (pid == 0) {
+			/* child: hook up stdin and stdout, then run it */
+			if (infd >= 0) {
+				dup2(infd, STDIN_FILENO);
+				close(infd);
+			}
+			if (!last) {
+				dup2(fds[1], STDOUT_FILENO);
+				close(fds[0]);
+				close(fds[1]);
+			}
+			execvp(args[start], &args[start]);
+			warn("%s", args[start]);
+			_exit(1);
+		}
+
+		/* parent: the pipe ends belong to the children now */
+		pids[npids++] = pid;
+		if (infd >= 0) {
+			close(infd);
+			infd = -1;
+		}
+		if (!last) {
+			close(fds[1]);
+			infd = fds[0];
+		}
+		start = i+1;
+	}
+
+	if (infd >= 0) {
+		close(infd);
+	}
+
+	for (i=0; i<npids; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			warn("waitpid");
+			failed = 1;
+		}
+		else if (i == npids-1 && !failed) {
+			readstatus(status, ei);
+		}
+	}
+	if (failed) {
+		exitinfo_exit(ei, 255);
+	}
+}
+
 /*
  * docommand
  * tokenizes the command line using strtok.  if there aren't any commands,
  * simply returns.  checks to see if it's a builtin, running it if it is.
  * otherwise, it's a standard command.  check for the '&', try to background
- * the job if possible, otherwise just run it and wait on it.
+ * the job if possible, otherwise just run it and wait on it. commands
+ * separated by '|' are run as a pipeline.
  */
 static
 void
@@ -418,15 +521,34 @@ docommand(char *buf, struct exitinfo *ei)
 		bg = 1;
 	}
 
+	for (i=0; i<nargs; i++) {
+		if (!strcmp(args[i], "|")) {
+			break;
+		}
+	}
+	if (i < nargs) {
+		if (bg) {
+			printf("%s: Pipelines can't be run in the "
+			       "background\n", args[0]);
+			exitinfo_exit(ei, 1);
+			return;
+		}
+		dopipeline(args, nargs, ei);
+		return;
+	}
+
 	if (timing) {
 		__time(&startsecs, &startnsecs);
 	}
-	//printf("hihihihi\n");
-	pid = fork();
+	/*
+	 * vfork, since all the child does is exec: it doesn't need
+	 * (and we don't want to pay for) a copy of our address space.
+	 */
+	pid = vfork();
 	switch (pid) {
 		case -1:
 			/* error */
-			warn("fork");
+			warn("vfork");
 			exitinfo_exit(ei, 255);
 			return;
 		case 0:
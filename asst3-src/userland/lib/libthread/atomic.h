@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LIBTHREAD_ATOMIC_H_
+#define _LIBTHREAD_ATOMIC_H_
+
+/*
+ * Atomic operations on ints for libthread (private header).
+ *
+ * These use LL/SC, the same way the kernel's spinlocks do; see the
+ * notes in the kernel's <mips/spinlock.h>. As there, nothing else may
+ * touch memory between the LL and the SC, so each operation is one
+ * asm block, retrying inside the block if the SC fails. The "memory"
+ * clobber also stops the compiler from moving loads and stores across
+ * the operation. On the hardware, a sync before the LL keeps earlier
+ * loads and stores from being seen after the update (so releasing a
+ * mutex with atomic_swap publishes what was done while holding it),
+ * and a sync after keeps later ones from being seen before it; so
+ * each operation is a full barrier.
+ */
+
+/*
+ * Compare-and-swap: if *p is OLD, set it to NEW. Returns the value
+ * *p had before, so the swap happened if that equals OLD.
+ */
+static __inline
+int
+atomic_cas(volatile int *p, int old, int new)
+{
+	int prev, tmp;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill the delay slots */
+		"sync;"			/* barrier */
+		"1: ll %0, 0(%2);"	/*   prev = *p */
+		"bne %0, %3, 2f;"	/*   if (prev != old) done */
+		" move %1, %4;"		/*   (delay slot) tmp = new */
+		"sc %1, 0(%2);"		/*   *p = tmp; tmp = success? */
+		"beqz %1, 1b;"		/*   if (!tmp) try again */
+		" nop;"			/*   (delay slot) */
+		"2: sync;"		/* barrier */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (prev), "=&r" (tmp)
+		: "r" (p), "r" (old), "r" (new)
+		: "memory");
+	return prev;
+}
+
+/*
+ * Swap: set *p to NEW and return the old value.
+ */
+static __inline
+int
+atomic_swap(volatile int *p, int new)
+{
+	int prev, tmp;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill the delay slots */
+		"sync;"			/* barrier */
+		"1: ll %0, 0(%2);"	/*   prev = *p */
+		"move %1, %3;"		/*   tmp = new */
+		"sc %1, 0(%2);"		/*   *p = tmp; tmp = success? */
+		"beqz %1, 1b;"		/*   if (!tmp) try again */
+		" nop;"			/*   (delay slot) */
+		"sync;"			/* barrier */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (prev), "=&r" (tmp)
+		: "r" (p), "r" (new)
+		: "memory");
+	return prev;
+}
+
+/*
+ * Fetch-and-add: add DELTA to *p and return the old value.
+ */
+static __inline
+int
+atomic_add(volatile int *p, int delta)
+{
+	int prev, tmp;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill the delay slots */
+		"sync;"			/* barrier */
+		"1: ll %0, 0(%2);"	/*   prev = *p */
+		"addu %1, %0, %3;"	/*   tmp = prev + delta */
+		"sc %1, 0(%2);"		/*   *p = tmp; tmp = success? */
+		"beqz %1, 1b;"		/*   if (!tmp) try again */
+		" nop;"			/*   (delay slot) */
+		"sync;"			/* barrier */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (prev), "=&r" (tmp)
+		: "r" (p), "r" (delta)
+		: "memory");
+	return prev;
+}
+
+#endif /* _LIBTHREAD_ATOMIC_H_ */
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Condition variables.
+ *
+ * c_seq is bumped by every signal and broadcast; a waiter samples it
+ * before dropping the mutex and asks the kernel to sleep only if it
+ * hasn't moved, so a signal sent after we unlock can't be missed.
+ * c_waiters counts threads in cond_wait, so that signalling a
+ * condition nobody is waiting on doesn't make a system call.
+ *
+ * Wakeups may be spurious, as usual; callers recheck their condition
+ * in a loop.
+ */
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <mutex.h>
+#include "atomic.h"
+
+/* FUTEX_WAKE count meaning "everyone" */
+#define WAKE_ALL 0x7fffffff
+
+void
+cond_init(struct cond *c)
+{
+	c->c_seq = 0;
+	c->c_waiters = 0;
+}
+
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+	int seq;
+
+	atomic_add(&c->c_waiters, 1);
+	seq = c->c_seq;
+	mutex_unlock(m);
+
+	futex((int *)&c->c_seq, FUTEX_WAIT, seq);
+
+	atomic_add(&c->c_waiters, -1);
+	mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+	atomic_add(&c->c_seq, 1);
+	if (c->c_waiters > 0) {
+		futex((int *)&c->c_seq, FUTEX_WAKE, 1);
+	}
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+	atomic_add(&c->c_seq, 1);
+	if (c->c_waiters > 0) {
+		futex((int *)&c->c_seq, FUTEX_WAKE, WAKE_ALL);
+	}
+}
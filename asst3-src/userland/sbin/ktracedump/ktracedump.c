@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * ktracedump - decode a kernel event trace.
+ *
+ * Reads a trace file written by the kernel menu's "ktrace dump"
+ * command, merges the per-cpu records into time order, and prints
+ * one line per event. Runs either on the host or on OS/161.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#include "kern/ktrace.h"
+
+#ifdef HOST
+/*
+ * OS/161 runs natively on a big-endian platform, so we can
+ * conveniently use the byteswapping functions for network byte order.
+ */
+#include <netinet/in.h> // for arpa/inet.h
+#include <arpa/inet.h>  // for ntohl
+#include "hostcompat.h"
+#define SWAP32(x) ntohl(x)
+#define SWAP16(x) ntohs(x)
+
+extern const char *hostcompat_progname;
+
+#else
+
+#define SWAP32(x) (x)
+#define SWAP16(x) (x)
+
+#endif
+
+#define ARRAYCOUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+/* Thread states, as in the kernel's threadstate_t */
+static const char *const statenames[] = {
+	"run", "ready", "sleep", "zombie",
+};
+
+/* VM fault types, as in the kernel's vm.h */
+static const char *const faultnames[] = {
+	"read", "write", "readonly",
+};
+
+/* A record, plus its place in the file to keep the sort stable */
+struct entry {
+	struct ktrace_record e_kr;
+	uint32_t e_seq;
+};
+
+static int onlycpu = -1;
+static int onlyevent = -1;
+
+////////////////////////////////////////////////////////////
+// reading
+
+static
+void
+doread(int fd, void *buf, size_t len, const char *file)
+{
+	ssize_t r;
+
+	r = read(fd, buf, len);
+	if (r < 0) {
+		err(1, "%s", file);
+	}
+	if ((size_t)r != len) {
+		errx(1, "%s: Short file", file);
+	}
+}
+
+static
+void
+swaprecord(struct ktrace_record *kr)
+{
+	unsigned i;
+
+	kr->kr_sec = SWAP32(kr->kr_sec);
+	kr->kr_nsec = SWAP32(kr->kr_nsec);
+	kr->kr_cpu = SWAP16(kr->kr_cpu);
+	kr->kr_event = SWAP16(kr->kr_event);
+	kr->kr_thread = SWAP32(kr->kr_thread);
+	for (i=0; i<ARRAYCOUNT(kr->kr_arg); i++) {
+		kr->kr_arg[i] = SWAP32(kr->kr_arg[i]);
+	}
+}
+
+/*
+ * Sort by time, then by cpu. Records from one cpu with the same
+ * timestamp stay in file order, which is the order they happened in.
+ */
+static
+int
+entrycmp(const void *av, const void *bv)
+{
+	const struct entry *a = av;
+	const struct entry *b = bv;
+
+	if (a->e_kr.kr_sec != b->e_kr.kr_sec) {
+		return a->e_kr.kr_sec < b->e_kr.kr_sec ? -1 : 1;
+	}
+	if (a->e_kr.kr_nsec != b->e_kr.kr_nsec) {
+		return a->e_kr.kr_nsec < b->e_kr.kr_nsec ? -1 : 1;
+	}
+	if (a->e_kr.kr_cpu != b->e_kr.kr_cpu) {
+		return a->e_kr.kr_cpu < b->e_kr.kr_cpu ? -1 : 1;
+	}
+	if (a->e_seq != b->e_seq) {
+		return a->e_seq < b->e_seq ? -1 : 1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// printing
+
+static
+const char *
+lookup(const char *const *names, unsigned num, uint32_t val)
+{
+	return val < num ? names[val] : "?";
+}
+
+static
+void
+printrecord(const struct ktrace_record *kr, const struct ktrace_record *first)
+{
+	uint32_t sec, nsec;
+
+	/* time relative to the first record */
+	sec = kr->kr_sec - first->kr_sec;
+	if (kr->kr_nsec >= first->kr_nsec) {
+		nsec = kr->kr_nsec - first->kr_nsec;
+	}
+	else {
+		sec--;
+		nsec = kr->kr_nsec + 1000000000 - first->kr_nsec;
+	}
+
+	printf("%4lu.%09lu cpu%-2u %08lx ", (unsigned long)sec,
+	       (unsigned long)nsec, kr->kr_cpu,
+	       (unsigned long)kr->kr_thread);
+
+	switch (kr->kr_event) {
+	    case KTRACE_SWITCH:
+		printf("switch   -> %08lx (was %s, pri %lu -> %lu)\n",
+		       (unsigned long)kr->kr_arg[0],
+		       lookup(statenames, ARRAYCOUNT(statenames),
+			      kr->kr_arg[1]),
+		       (unsigned long)kr->kr_arg[2],
+		       (unsigned long)kr->kr_arg[3]);
+		break;
+	    case KTRACE_WAKEUP:
+		printf("wakeup   %08lx on cpu%lu\n",
+		       (unsigned long)kr->kr_arg[0],
+		       (unsigned long)kr->kr_arg[1]);
+		break;
+	    case KTRACE_VMFAULT:
+		printf("vmfault  %s 0x%08lx\n",
+		       lookup(faultnames, ARRAYCOUNT(faultnames),
+			      kr->kr_arg[0]),
+		       (unsigned long)kr->kr_arg[1]);
+		break;
+	    case KTRACE_SYSCALL:
+		printf("syscall  %lu (0x%lx, 0x%lx, 0x%lx)\n",
+		       (unsigned long)kr->kr_arg[0],
+		       (unsigned long)kr->kr_arg[1],
+		       (unsigned long)kr->kr_arg[2],
+		       (unsigned long)kr->kr_arg[3]);
+		break;
+	    case KTRACE_SYSRET:
+		if (kr->kr_arg[1] != 0) {
+			/* OS/161 errno, which may not match the host's */
+			printf("sysret   %lu error %lu\n",
+			       (unsigned long)kr->kr_arg[0],
+			       (unsigned long)kr->kr_arg[1]);
+		}
+		else {
+			printf("sysret   %lu = %ld\n",
+			       (unsigned long)kr->kr_arg[0],
+			       (long)(int32_t)kr->kr_arg[2]);
+		}
+		break;
+	    default:
+		printf("event %u (0x%lx, 0x%lx, 0x%lx, 0x%lx)\n",
+		       kr->kr_event,
+		       (unsigned long)kr->kr_arg[0],
+		       (unsigned long)kr->kr_arg[1],
+		       (unsigned long)kr->kr_arg[2],
+		       (unsigned long)kr->kr_arg[3]);
+		break;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// main
+
+static
+void
+usage(void)
+{
+	warnx("Usage: ktracedump [options] tracefile");
+	warnx("   -c cpu: only show events from this cpu");
+	errx(1, "   -e event: only show this event code");
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *file = NULL;
+	struct ktrace_header kh;
+	struct entry *es;
+	uint32_t i;
+	int fd;
+
+#ifdef HOST
+	hostcompat_progname = argv[0];
+#endif
+
+	for (i=1; i<(unsigned)argc; i++) {
+		if (!strcmp(argv[i], "-c") && i+1 < (unsigned)argc) {
+			onlycpu = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-e") && i+1 < (unsigned)argc) {
+			onlyevent = atoi(argv[++i]);
+		}
+		else if (argv[i][0] == '-' || file != NULL) {
+			usage();
+		}
+		else {
+			file = argv[i];
+		}
+	}
+	if (file == NULL) {
+		usage();
+	}
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", file);
+	}
+	doread(fd, &kh, sizeof(kh), file);
+	kh.kh_magic = SWAP32(kh.kh_magic);
+	kh.kh_ncpus = SWAP32(kh.kh_ncpus);
+	kh.kh_nrecords = SWAP32(kh.kh_nrecords);
+	kh.kh_dropped = SWAP32(kh.kh_dropped);
+	if (kh.kh_magic != KTRACE_MAGIC) {
+		errx(1, "%s: Not a ktrace file", file);
+	}
+
+	printf("%lu cpus, %lu records, %lu dropped\n",
+	       (unsigned long)kh.kh_ncpus, (unsigned long)kh.kh_nrecords,
+	       (unsigned long)kh.kh_dropped);
+	if (kh.kh_nrecords == 0) {
+		close(fd);
+		return 0;
+	}
+
+	es = malloc(kh.kh_nrecords * sizeof(es[0]));
+	if (es == NULL) {
+		errx(1, "Out of memory");
+	}
+	for (i=0; i<kh.kh_nrecords; i++) {
+		doread(fd, &es[i].e_kr, sizeof(es[i].e_kr), file);
+		swaprecord(&es[i].e_kr);
+		es[i].e_seq = i;
+	}
+	close(fd);
+
+	qsort(es, kh.kh_nrecords, sizeof(es[0]), entrycmp);
+
+	for (i=0; i<kh.kh_nrecords; i++) {
+		if (onlycpu >= 0 && es[i].e_kr.kr_cpu != onlycpu) {
+			continue;
+		}
+		if (onlyevent >= 0 && es[i].e_kr.kr_event != onlyevent) {
+			continue;
+		}
+		printrecord(&es[i].e_kr, &es[0].e_kr);
+	}
+
+	free(es);
+	return 0;
+}
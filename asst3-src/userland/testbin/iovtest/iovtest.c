@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * iovtest - test readv and writev.
+ *
+ * Usage: iovtest [filename]
+ *
+ * Writes a file with writev using several segments, including an
+ * empty one and ones that cut across the filesystem's blocks, reads
+ * it back with readv using a different split, and checks the result
+ * against plain read. Then checks that bad iovec counts and totals
+ * too big to return are rejected with EINVAL.
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define TESTFILE	"iovtestfile"
+#define SIZE		1536	/* three 512-byte blocks */
+
+/* what byte N of the file should be */
+#define PATTERN(n)	((char)('a' + (n) % 23))
+
+static char wbuf[SIZE];
+static char rbuf[SIZE];
+
+/*
+ * Fill in IOV to cover BUF with segments of the lengths in LENS
+ * (which must add up to SIZE).
+ */
+static
+void
+split(struct iovec *iov, const size_t *lens, int n, char *buf)
+{
+	size_t pos;
+	int i;
+
+	pos = 0;
+	for (i=0; i<n; i++) {
+		iov[i].iov_base = buf + pos;
+		iov[i].iov_len = lens[i];
+		pos += lens[i];
+	}
+	if (pos != SIZE) {
+		errx(1, "Bad segment lengths (test is broken)");
+	}
+}
+
+static
+void
+check(const char *what)
+{
+	size_t i;
+
+	for (i=0; i<SIZE; i++) {
+		if (rbuf[i] != PATTERN(i)) {
+			errx(1, "%s: wrong data at offset %lu", what,
+			     (unsigned long)i);
+		}
+	}
+}
+
+static
+void
+seekstart(int fd)
+{
+	if (lseek(fd, 0, SEEK_SET) != 0) {
+		err(1, "lseek");
+	}
+}
+
+static
+void
+test_data(int fd)
+{
+	/* the block boundaries at 512 and 1024 fall inside segments */
+	static const size_t wlens[] = { 100, 0, 700, 1, 0, 735 };
+	static const size_t rlens[] = { 511, 2, 0, 510, 513 };
+	struct iovec iov[6];
+	ssize_t r;
+	size_t i;
+
+	for (i=0; i<SIZE; i++) {
+		wbuf[i] = PATTERN(i);
+	}
+
+	split(iov, wlens, 6, wbuf);
+	r = writev(fd, iov, 6);
+	if (r < 0) {
+		err(1, "writev");
+	}
+	if (r != SIZE) {
+		errx(1, "writev: wrote %ld of %d bytes", (long)r, SIZE);
+	}
+
+	/* the file position should have moved past all of it */
+	if (lseek(fd, 0, SEEK_CUR) != SIZE) {
+		errx(1, "writev: file position not advanced");
+	}
+
+	seekstart(fd);
+	memset(rbuf, 0, sizeof(rbuf));
+	r = read(fd, rbuf, SIZE);
+	if (r != SIZE) {
+		errx(1, "read: got %ld of %d bytes", (long)r, SIZE);
+	}
+	check("writev");
+
+	seekstart(fd);
+	memset(rbuf, 0, sizeof(rbuf));
+	split(iov, rlens, 5, rbuf);
+	r = readv(fd, iov, 5);
+	if (r < 0) {
+		err(1, "readv");
+	}
+	if (r != SIZE) {
+		errx(1, "readv: read %ld of %d bytes", (long)r, SIZE);
+	}
+	check("readv");
+
+	/* at EOF there's nothing more */
+	r = readv(fd, iov, 5);
+	if (r != 0) {
+		errx(1, "readv at EOF: got %ld, expected 0", (long)r);
+	}
+}
+
+static
+void
+expect_einval(const char *what, ssize_t r)
+{
+	if (r >= 0) {
+		errx(1, "%s: succeeded, expected EINVAL", what);
+	}
+	if (errno != EINVAL) {
+		err(1, "%s: expected EINVAL, got", what);
+	}
+}
+
+static
+void
+test_einval(int fd)
+{
+	struct iovec iov[2];
+
+	iov[0].iov_base = rbuf;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = rbuf;
+	iov[1].iov_len = 1;
+
+	expect_einval("readv, iovcnt 0", readv(fd, iov, 0));
+	expect_einval("writev, iovcnt 0", writev(fd, iov, 0));
+	expect_einval("readv, iovcnt -1", readv(fd, iov, -1));
+	expect_einval("writev, iovcnt -1", writev(fd, iov, -1));
+	expect_einval("readv, iovcnt IOV_MAX+1", readv(fd, iov, IOV_MAX+1));
+	expect_einval("writev, iovcnt IOV_MAX+1",
+		      writev(fd, iov, IOV_MAX+1));
+
+	/* the total doesn't fit in the return value */
+	iov[0].iov_len = 0x40000000;
+	iov[1].iov_len = 0x40000000;
+	expect_einval("readv, total 2G", readv(fd, iov, 2));
+	expect_einval("writev, total 2G", writev(fd, iov, 2));
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *filename;
+	int fd;
+
+	if (argc > 2) {
+		errx(1, "Usage: iovtest [filename]");
+	}
+	filename = argc == 2 ? argv[1] : TESTFILE;
+
+	fd = open(filename, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", filename);
+	}
+
+	test_data(fd);
+	test_einval(fd);
+
+	close(fd);
+	if (remove(filename) < 0) {
+		err(1, "%s: remove", filename);
+	}
+
+	printf("Passed.\n");
+	return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * mutextest - exercise the libthread mutex and condition variable.
+ *
+ * Several threads bump a shared counter under a mutex; if the mutex
+ * doesn't exclude, increments get lost and the final count is short.
+ * Then a producer hands a sequence of values to the consumers one at
+ * a time through a condition variable, and we check every value
+ * arrives exactly once.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <err.h>
+#include <mutex.h>
+
+#define NTHREADS	4
+#define NINCS		100000
+#define NVALUES		1000
+
+static struct mutex lk = MUTEX_INITIALIZER;
+static struct cond cv = COND_INITIALIZER;
+
+static volatile int count;
+
+/* one-slot mailbox, protected by lk */
+static int slot;
+static bool slotfull;
+static bool done;
+static unsigned seen[NVALUES];
+
+static
+void *
+incthread(void *arg)
+{
+	int i;
+
+	(void)arg;
+	for (i=0; i<NINCS; i++) {
+		mutex_lock(&lk);
+		count = count + 1;
+		mutex_unlock(&lk);
+	}
+	return NULL;
+}
+
+static
+void *
+consumer(void *arg)
+{
+	(void)arg;
+	mutex_lock(&lk);
+	while (1) {
+		while (!slotfull && !done) {
+			cond_wait(&cv, &lk);
+		}
+		if (!slotfull) {
+			break;
+		}
+		seen[slot]++;
+		slotfull = false;
+		cond_broadcast(&cv);
+	}
+	mutex_unlock(&lk);
+	return NULL;
+}
+
+static
+void
+runthreads(void *(*func)(void *), int *tids)
+{
+	int i;
+
+	for (i=0; i<NTHREADS; i++) {
+		tids[i] = thread_create(func, NULL);
+		if (tids[i] < 0) {
+			err(1, "thread_create");
+		}
+	}
+}
+
+static
+void
+jointhreads(int *tids)
+{
+	int i;
+
+	for (i=0; i<NTHREADS; i++) {
+		if (thread_join(tids[i], NULL) < 0) {
+			err(1, "thread_join");
+		}
+	}
+}
+
+int
+main(void)
+{
+	int tids[NTHREADS];
+	int i, bad;
+
+	printf("mutextest: counting...\n");
+	runthreads(incthread, tids);
+	jointhreads(tids);
+	if (count != NTHREADS * NINCS) {
+		errx(1, "FAILED: count is %d, expected %d",
+		     count, NTHREADS * NINCS);
+	}
+
+	printf("mutextest: handing off...\n");
+	runthreads(consumer, tids);
+	for (i=0; i<NVALUES; i++) {
+		mutex_lock(&lk);
+		while (slotfull) {
+			cond_wait(&cv, &lk);
+		}
+		slot = i;
+		slotfull = true;
+		cond_signal(&cv);
+		mutex_unlock(&lk);
+	}
+	mutex_lock(&lk);
+	while (slotfull) {
+		cond_wait(&cv, &lk);
+	}
+	done = true;
+	cond_broadcast(&cv);
+	mutex_unlock(&lk);
+	jointhreads(tids);
+
+	bad = 0;
+	for (i=0; i<NVALUES; i++) {
+		if (seen[i] != 1) {
+			printf("mutextest: value %d seen %u times\n",
+			       i, seen[i]);
+			bad++;
+		}
+	}
+	if (bad) {
+		errx(1, "FAILED");
+	}
+	printf("mutextest: passed.\n");
+	return 0;
+}
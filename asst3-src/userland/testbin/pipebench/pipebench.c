@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * pipebench - measure pipe throughput.
+ *
+ * Usage: pipebench [megabytes]
+ *
+ * A child writes the given amount of data (default 4 MB) into a pipe
+ * and the parent reads it, first with page-aligned buffers and then
+ * with buffers one byte off. The kernel moves whole aligned pages
+ * between the processes without copying them, so the first run
+ * should be the faster one. Every byte is checked on the way out,
+ * which is part of the time measured for both runs.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <err.h>
+
+#define PAGESIZE	4096
+#define CHUNK		(4 * PAGESIZE)
+#define DEFAULT_MB	4
+
+/* room for a CHUNK-sized buffer at any alignment */
+static char space[CHUNK + 2 * PAGESIZE];
+
+/* what byte N of the stream should be */
+#define PATTERN(n)	((char)(((n) % CHUNK) % 251))
+
+static
+char *
+getbuf(int misalign)
+{
+	uintptr_t p;
+
+	p = ((uintptr_t)space + PAGESIZE - 1) & ~(uintptr_t)(PAGESIZE - 1);
+	return (char *)p + misalign;
+}
+
+static
+void
+writer(int fd, char *buf, size_t total)
+{
+	size_t done, off;
+	ssize_t r;
+
+	for (off = 0; off < CHUNK; off++) {
+		buf[off] = PATTERN(off);
+	}
+
+	done = 0;
+	while (done < total) {
+		off = done % CHUNK;
+		r = write(fd, buf + off, CHUNK - off);
+		if (r < 0) {
+			err(1, "write");
+		}
+		done += r;
+	}
+}
+
+static
+void
+reader(int fd, char *buf, size_t total)
+{
+	size_t done, i;
+	ssize_t r;
+
+	done = 0;
+	while ((r = read(fd, buf, CHUNK)) > 0) {
+		/* check all of it; a misplaced page only shows in the middle */
+		for (i = 0; i < (size_t)r; i++) {
+			if (buf[i] != PATTERN(done + i)) {
+				errx(1, "Wrong data at offset %lu",
+				     (unsigned long)(done + i));
+			}
+		}
+		done += r;
+	}
+	if (r < 0) {
+		err(1, "read");
+	}
+	if (done != total) {
+		errx(1, "Read %lu bytes; expected %lu",
+		     (unsigned long)done, (unsigned long)total);
+	}
+}
+
+static
+void
+run(const char *name, int misalign, size_t total)
+{
+	int fds[2];
+	pid_t pid;
+	int status;
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs, msecs;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	__time(&startsecs, &startnsecs);
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		writer(fds[1], getbuf(misalign), total);
+		close(fds[1]);
+		_exit(0);
+	}
+
+	close(fds[1]);
+	reader(fds[0], getbuf(misalign), total);
+	close(fds[0]);
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (WIFSIGNALED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "%s: writer failed", name);
+	}
+
+	__time(&endsecs, &endnsecs);
+	if (endnsecs < startnsecs) {
+		endnsecs += 1000000000;
+		endsecs--;
+	}
+	msecs = (endsecs - startsecs) * 1000 +
+		(endnsecs - startnsecs) / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+
+	printf("%s: %lu KB in %lu.%03lu seconds, %lu KB/sec\n", name,
+	       (unsigned long)(total / 1024), msecs / 1000, msecs % 1000,
+	       (unsigned long)(total / 1024) * 1000 / msecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t total;
+
+	if (argc > 2) {
+		errx(1, "Usage: pipebench [megabytes]");
+	}
+	total = (argc == 2 ? atoi(argv[1]) : DEFAULT_MB) * 1024 * 1024;
+	if (total == 0) {
+		errx(1, "Nothing to do");
+	}
+
+	run("page-aligned", 0, total);
+	run("unaligned", 1, total);
+	return 0;
+}
@@ -123,6 +123,9 @@ static unsigned long checksum;
 #define NOBODY (-1)
 static int me = NOBODY;
 
+/* PATH_KEYS, opened once and shared by all the workers of a phase */
+static int keysfd = -1;
+
 static const char *progname;
 
 ////////////////////////////////////////////////////////////
@@ -412,6 +415,50 @@ dowrite(const char *path, int fd, const void *buf, size_t len)
 	}
 }
 
+static
+size_t
+dopread(const char *path, int fd, void *buf, size_t len, off_t pos)
+{
+	int result;
+
+	result = pread(fd, buf, len, pos);
+	if (result < 0) {
+		complain("%s: pread", path);
+		exit(1);
+	}
+	return (size_t) result;
+}
+
+static
+void
+doexactpread(const char *path, int fd, void *buf, size_t len, off_t pos)
+{
+	size_t result;
+
+	result = dopread(path, fd, buf, len, pos);
+	if (result != len) {
+		complainx("%s: pread: short count", path);
+		exit(1);
+	}
+}
+
+static
+void
+dopwrite(const char *path, int fd, const void *buf, size_t len, off_t pos)
+{
+	int result;
+
+	result = pwrite(fd, buf, len, pos);
+	if (result < 0) {
+		complain("%s: pwrite", path);
+		exit(1);
+	}
+	if ((size_t) result != len) {
+		complainx("%s: pwrite: short count", path);
+		exit(1);
+	}
+}
+
 static
 void
 dolseek(const char *name, int fd, off_t offset, int whence)
@@ -517,18 +564,21 @@ doforkall(const char *phasename, void (*func)(void))
 	}
 }
 
+/*
+ * Where our keys start. The workers that generate and toss the keys
+ * all use one open file for PATH_KEYS, opened before forking, so
+ * they share its seek position; they use pread/pwrite from here on
+ * rather than seeking, so they don't move it under each other.
+ */
 static
-void
-seekmyplace(const char *name, int fd)
+off_t
+getmyplace(void)
 {
 	int keys_per, myfirst;
-	off_t offset;
 
 	keys_per = numkeys / numprocs;
 	myfirst = me*keys_per;
-	offset = myfirst * sizeof(int);
-
-	dolseek(name, fd, offset, SEEK_SET);
+	return myfirst * sizeof(int);
 }
 
 static
@@ -576,12 +626,11 @@ static
 void
 genkeys_sub(void)
 {
-	int fd, i, mykeys, keys_done, keys_to_do, value;
-
-	fd = doopen(PATH_KEYS, O_WRONLY, 0);
+	int i, mykeys, keys_done, keys_to_do, value;
+	off_t pos;
 
 	mykeys = getmykeys();
-	seekmyplace(PATH_KEYS, fd);
+	pos = getmyplace();
 
 	srandom(seeds[me]);
 	keys_done = 0;
@@ -606,11 +655,11 @@ genkeys_sub(void)
 			workspace[i] = value;
 		}
 
-		dowrite(PATH_KEYS, fd, workspace, keys_to_do*sizeof(int));
+		dopwrite(PATH_KEYS, keysfd, workspace,
+			 keys_to_do*sizeof(int), pos);
+		pos += keys_to_do*sizeof(int);
 		keys_done += keys_to_do;
 	}
-
-	doclose(PATH_KEYS, fd);
 }
 
 static
@@ -620,8 +669,8 @@ genkeys(void)
 	long seedspace[numprocs];
 	int i;
 
-	/* Create the file. */
-	docreate(PATH_KEYS);
+	/* Create the file; the workers all write through this one open. */
+	keysfd = doopen(PATH_KEYS, O_WRONLY|O_CREAT|O_TRUNC, 0664);
 
 	/* Generate random seeds for each subprocess. */
 	srandom(randomseed);
@@ -634,6 +683,8 @@ genkeys(void)
 	seeds = seedspace;
 	doforkall("Initialization", genkeys_sub);
 	seeds = NULL;
+	doclose(PATH_KEYS, keysfd);
+	keysfd = -1;
 
 	/* Cross-check the size of the output. */
 	if (getsize(PATH_KEYS) != correctsize) {
@@ -671,15 +722,14 @@ static
 void
 bin(void)
 {
-	int infd, outfds[numprocs];
+	int outfds[numprocs];
 	const char *name;
 	int i, mykeys, keys_done, keys_to_do;
 	int key, pivot, binnum;
-
-	infd = doopen(PATH_KEYS, O_RDONLY, 0);
+	off_t pos;
 
 	mykeys = getmykeys();
-	seekmyplace(PATH_KEYS, infd);
+	pos = getmyplace();
 
 	for (i=0; i<numprocs; i++) {
 		name = binname(me, i);
@@ -695,8 +745,9 @@ bin(void)
 			keys_to_do = WORKNUM;
 		}
 
-		doexactread(PATH_KEYS, infd, workspace,
-			    keys_to_do * sizeof(int));
+		doexactpread(PATH_KEYS, keysfd, workspace,
+			     keys_to_do * sizeof(int), pos);
+		pos += keys_to_do * sizeof(int);
 
 		for (i=0; i<keys_to_do; i++) {
 			key = workspace[i];
@@ -713,7 +764,6 @@ bin(void)
 
 		keys_done += keys_to_do;
 	}
-	doclose(PATH_KEYS, infd);
 
 	for (i=0; i<numprocs; i++) {
 		doclose(binname(me, i), outfds[i]);
@@ -913,7 +963,10 @@ sort(void)
 	/* Step 1. Toss into bins. */
 	complainx("Tossing into %d bins using %d procs",
 		  numprocs*numprocs, numprocs);
+	keysfd = doopen(PATH_KEYS, O_RDONLY, 0);
 	doforkall("Tossing", bin);
+	doclose(PATH_KEYS, keysfd);
+	keysfd = -1;
 	checksize_bins();
 	complainx("Done tossing into bins.");
 
@@ -1002,12 +1055,13 @@ dovalidate(void)
 	const char *name;
 	int fd, i, mykeys, keys_done, keys_to_do;
 	int key, smallest, largest;
+	off_t pos;
 
 	name = PATH_SORTED;
 	fd = doopen(name, O_RDONLY, 0);
 
 	mykeys = getmykeys();
-	seekmyplace(name, fd);
+	pos = getmyplace();
 
 	smallest = RANDOM_MAX;
 	largest = 0;
@@ -1019,7 +1073,8 @@ dovalidate(void)
 			keys_to_do = WORKNUM;
 		}
 
-		doexactread(name, fd, workspace, keys_to_do * sizeof(int));
+		doexactpread(name, fd, workspace, keys_to_do * sizeof(int), pos);
+		pos += keys_to_do * sizeof(int);
 
 		for (i=0; i<keys_to_do; i++) {
 			key = workspace[i];
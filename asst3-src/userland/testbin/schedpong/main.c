@@ -221,9 +221,10 @@ waitstart(void)
 static
 void
 runit(unsigned numthinkers, unsigned numgrinders,
-      unsigned numponggroups, unsigned ponggroupsize)
+      unsigned numponggroups, unsigned ponggroupsize,
+      unsigned numprobegroups)
 {
-	pid_t pids[numponggroups + 2];
+	pid_t pids[numponggroups + numprobegroups + 2];
 	time_t startsecs;
 	unsigned long startnsecs;
 	char buf[32];
@@ -232,6 +233,10 @@ runit(unsigned numthinkers, unsigned numgrinders,
 	printf("Running with %u thinkers, %u grinders, and %u pong groups "
 	       "of size %u each.\n", numthinkers, numgrinders, numponggroups,
 	       ponggroupsize);
+	if (numprobegroups > 0) {
+		printf("Also running %u latency probe groups.\n",
+		       numprobegroups);
+	}
 
 	usem_init(&startsem, STARTSEM);
 	createresultsfile();
@@ -241,12 +246,16 @@ runit(unsigned numthinkers, unsigned numgrinders,
 		forkem(ponggroupsize, pong_prep, pong, pong_cleanup, i+2,
 		       &pids[i+2]);
 	}
+	for (i=0; i<numprobegroups; i++) {
+		forkem(2, probe_prep, probe, probe_cleanup,
+		       numponggroups+i+2, &pids[numponggroups+i+2]);
+	}
 	usem_open(&startsem);
 	printf("Forking done; starting the workload.\n");
 	__time(&startsecs, &startnsecs);
 	Vn(&startsem, numthinkers + numgrinders +
-	   numponggroups * ponggroupsize);
-	waitall(pids, numponggroups + 2);
+	   numponggroups * ponggroupsize + numprobegroups * 2);
+	waitall(pids, numponggroups + numprobegroups + 2);
 	usem_close(&startsem);
 	usem_cleanup(&startsem);
 
@@ -268,6 +277,12 @@ runit(unsigned numthinkers, unsigned numgrinders,
 		printf("Pong group %u: %s\n", i, buf);
 	}
 
+	for (i=0; i<numprobegroups; i++) {
+		calcresult(numponggroups+i+2, startsecs, startnsecs,
+			   buf, sizeof(buf));
+		printf("Probe group %u: %s\n", i, buf);
+	}
+
 	closeresultsfile();
 	destroyresultsfile();
 }
@@ -281,8 +296,10 @@ usage(const char *av0)
 	warnx("  [-g grinders]         set number of grinders (default 0)");
 	warnx("  [-p ponggroups]       set number of pong groups (default 1)");
 	warnx("  [-s ponggroupsize]    set pong group size (default 6)");
+	warnx("  [-l probegroups]      set number of latency probes (default 0)");
 	warnx("Thinkers are CPU bound; grinders are memory-bound;");
-	warnx("pong groups are I/O bound.");
+	warnx("pong groups are I/O bound; latency probes measure how long");
+	warnx("a woken process waits to run.");
 	exit(1);
 }
 
@@ -293,6 +310,7 @@ main(int argc, char *argv[])
 	unsigned numgrinders = 0;
 	unsigned numponggroups = 1;
 	unsigned ponggroupsize = 6;
+	unsigned numprobegroups = 0;
 
 	int i;
 
@@ -309,11 +327,15 @@ main(int argc, char *argv[])
 		else if (!strcmp(argv[i], "-s")) {
 			ponggroupsize = atoi(argv[++i]);
 		}
+		else if (!strcmp(argv[i], "-l")) {
+			numprobegroups = atoi(argv[++i]);
+		}
 		else {
 			usage(argv[0]);
 		}
 	}
 
-	runit(numthinkers, numgrinders, numponggroups, ponggroupsize);
+	runit(numthinkers, numgrinders, numponggroups, ponggroupsize,
+	      numprobegroups);
 	return 0;
 }
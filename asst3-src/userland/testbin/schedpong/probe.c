@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Latency probe.
+ *
+ * A probe group is a pair of processes that bounce a token back and
+ * forth through two semaphores and time each round trip. Each trip
+ * involves two sleeps and two wakeups and almost no computation, so
+ * the time taken is dominated by how long a woken process waits for
+ * the CPU. Run alongside thinkers (which never sleep) this measures
+ * how well the scheduler favors interactive jobs over CPU hogs.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <err.h>
+#include <assert.h>
+
+#include "usem.h"
+#include "tasks.h"
+
+#define PROBELOOPS 200
+
+static struct usem sems[2];
+
+void
+probe_prep(unsigned groupid, unsigned count)
+{
+	if (count != 2) {
+		errx(1, "probe: probe groups must have exactly 2 processes");
+	}
+	usem_init(&sems[0], "sem:probe-%u-0", groupid);
+	usem_init(&sems[1], "sem:probe-%u-1", groupid);
+}
+
+void
+probe_cleanup(unsigned groupid, unsigned count)
+{
+	assert(count == 2);
+	(void)groupid;
+
+	usem_cleanup(&sems[0]);
+	usem_cleanup(&sems[1]);
+}
+
+/*
+ * Microseconds from (s0, ns0) to (s1, ns1).
+ */
+static
+uint64_t
+elapsed_usecs(time_t s0, unsigned long ns0, time_t s1, unsigned long ns1)
+{
+	if (ns1 < ns0) {
+		ns1 += 1000000000;
+		s1--;
+	}
+	return (uint64_t)(s1 - s0) * 1000000 + (ns1 - ns0) / 1000;
+}
+
+/*
+ * Process 0 starts each round trip and does the timing; process 1
+ * just echoes.
+ */
+void
+probe(unsigned groupid, unsigned id)
+{
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	uint64_t usecs, total, max;
+	unsigned i;
+
+	assert(id < 2);
+	usem_open(&sems[0]);
+	usem_open(&sems[1]);
+
+	waitstart();
+
+	total = max = 0;
+	for (i=0; i<PROBELOOPS; i++) {
+		if (id == 1) {
+			P(&sems[1]);
+			V(&sems[0]);
+			continue;
+		}
+		__time(&s0, &ns0);
+		V(&sems[1]);
+		P(&sems[0]);
+		__time(&s1, &ns1);
+
+		usecs = elapsed_usecs(s0, ns0, s1, ns1);
+		total += usecs;
+		if (usecs > max) {
+			max = usecs;
+		}
+	}
+
+	if (id == 0) {
+		printf("Probe group %u: %u round trips, "
+		       "avg %llu us, max %llu us\n", groupid, PROBELOOPS,
+		       (unsigned long long)(total / PROBELOOPS),
+		       (unsigned long long)max);
+	}
+
+	usem_close(&sems[0]);
+	usem_close(&sems[1]);
+}
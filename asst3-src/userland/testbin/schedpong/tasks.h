@@ -36,3 +36,7 @@ void grind(unsigned groupid, unsigned id);
 void pong_prep(unsigned groupid, unsigned count);
 void pong_cleanup(unsigned groupid, unsigned count);
 void pong(unsigned groupid, unsigned id);
+
+void probe_prep(unsigned groupid, unsigned count);
+void probe_cleanup(unsigned groupid, unsigned count);
+void probe(unsigned groupid, unsigned id);